@@ -0,0 +1,405 @@
+/*!
+    \file
+    \brief Compiled filter of advertising reports.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CAdvFilter.h"
+#include <cstring>
+
+#define AD_TYPE_UUID16_INCOMPLETE (0x02) ///< Incomplete list of 16-bit service UUIDs
+#define AD_TYPE_UUID16_COMPLETE (0x03)   ///< Complete list of 16-bit service UUIDs
+#define AD_TYPE_SERVICE_DATA16 (0x16)    ///< Service data with a 16-bit UUID
+#define AD_TYPE_MFG_DATA (0xff)          ///< Manufacturer specific data
+
+/**
+ * @brief Destructor for the CAdvFilter class
+ */
+CAdvFilter::~CAdvFilter()
+{
+    release(mTable);
+}
+
+/**
+ * @brief Free a rule table
+ * @param table Table
+ */
+void CAdvFilter::release(STable *table)
+{
+    if (table == nullptr)
+        return;
+    delete[] table->rules;
+    delete table;
+}
+
+/**
+ * @brief Compile and activate a rule set
+ *
+ * The table is built outside the lock; only the pointer swap is locked,
+ * so the scanner is held up for a few instructions. A table that a
+ * match() call still uses is left for that call to free.
+ *
+ * @param rules Rules in priority order
+ * @param count Number of rules
+ * @param def Action when no rule matches
+ * @return true if the rules are active
+ */
+bool CAdvFilter::setRules(const SAdvRule *rules, uint8_t count, EAdvAction def)
+{
+    static const uint8_t extractSize[4] = {16, 2, 2, 1}; // id, major, minor, power
+    STable *table = nullptr;
+    uint8_t slots = 0;
+
+    if ((rules != nullptr) && (count != 0))
+    {
+        table = new STable;
+        table->rules = new SCompiled[count];
+        table->count = count;
+        table->users = 0;
+        table->retired = false;
+        std::memset(table->slotOf, ADVFILTER_NONE, sizeof(table->slotOf));
+
+        for (uint8_t i = 0; i < count; i++)
+        {
+            const SAdvRule *r = &rules[i];
+            SCompiled *c = &table->rules[i];
+            uint16_t need = 0;
+
+            if ((r->length > ADVFILTER_PATTERN) || (r->anyPosition && (r->length == 0)) ||
+                ((r->action == EAdvAction::Beacon) && (r->adType == 0)))
+            {
+                release(table);
+                return false;
+            }
+            std::memset(c, 0, sizeof(SCompiled));
+            c->slot = ADVFILTER_NONE;
+            if (r->adType != 0)
+            {
+                if (table->slotOf[r->adType] == ADVFILTER_NONE)
+                {
+                    if (slots == ADVFILTER_TYPES)
+                    {
+                        release(table);
+                        return false;
+                    }
+                    table->slotOf[r->adType] = slots++;
+                }
+                c->slot = table->slotOf[r->adType];
+            }
+            for (uint8_t k = 0; k < r->length; k++)
+            {
+                c->mask[k] = r->mask[k];
+                c->value[k] = r->value[k] & r->mask[k];
+            }
+            c->offset = r->offset;
+            c->length = r->length;
+            c->step = r->anyPosition ? r->length : 0;
+            c->addrTypes = r->addrTypes;
+            c->rssiMin = r->rssiMin;
+            c->action = r->action;
+            c->extract[0] = r->idOffset;
+            c->extract[1] = r->majorOffset;
+            c->extract[2] = r->minorOffset;
+            c->extract[3] = r->powerOffset;
+
+            // The shortest AD data that holds the pattern and every extracted field
+            if (!r->anyPosition)
+                need = r->offset + r->length;
+            if (r->action == EAdvAction::Beacon)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    if ((c->extract[k] != ADVFILTER_NONE) && (c->extract[k] + extractSize[k] > need))
+                        need = c->extract[k] + extractSize[k];
+                }
+            }
+            if (need > 254) // An AD structure carries up to 254 data bytes
+            {
+                release(table);
+                return false;
+            }
+            c->need = (uint8_t)need;
+        }
+    }
+
+    STable *old;
+    portENTER_CRITICAL(&mMux);
+    old = mTable;
+    mTable = table;
+    mDefault = def;
+    if ((old != nullptr) && (old->users != 0))
+    {
+        old->retired = true;
+        old = nullptr;
+    }
+    portEXIT_CRITICAL(&mMux);
+    release(old);
+    return true;
+}
+
+/**
+ * @brief Match a report
+ *
+ * The table is pinned under the lock and matched outside of it.
+ *
+ * @param data Raw advertising data
+ * @param len Data length
+ * @param addrType Advertiser address type
+ * @param rssi RSSI in dBm
+ * @param res Receives the action and the beacon fields
+ */
+void CAdvFilter::match(const uint8_t *data, uint8_t len, uint8_t addrType, int8_t rssi, SAdvMatch *res)
+{
+    bool last;
+
+    portENTER_CRITICAL(&mMux);
+    STable *table = mTable;
+    res->action = mDefault;
+    if (table != nullptr)
+        table->users++;
+    portEXIT_CRITICAL(&mMux);
+    if (table == nullptr)
+        return;
+
+    matchTable(table, data, len, addrType, rssi, res);
+
+    portENTER_CRITICAL(&mMux);
+    last = (--table->users == 0) && table->retired;
+    portEXIT_CRITICAL(&mMux);
+    if (last)
+        release(table);
+}
+
+/**
+ * @brief Match a report against a table
+ *
+ * The AD structures are walked once and the first one of every AD type
+ * used by the rules is recorded; malformed tails are ignored.
+ *
+ * @param table Table
+ * @param data Raw advertising data
+ * @param len Data length
+ * @param addrType Advertiser address type
+ * @param rssi RSSI in dBm
+ * @param res Receives the action and the beacon fields of the first matching rule
+ */
+void CAdvFilter::matchTable(const STable *table, const uint8_t *data, uint8_t len, uint8_t addrType, int8_t rssi, SAdvMatch *res)
+{
+    uint8_t pos[ADVFILTER_TYPES];  // AD data offsets per slot
+    uint8_t size[ADVFILTER_TYPES]; // AD data lengths per slot
+    uint8_t found = 0;             // Slots present in the report
+
+    for (uint16_t i = 0; i + 1 < len;)
+    {
+        uint8_t l = data[i];
+        if ((l == 0) || (i + 1 + l > len))
+            break;
+        uint8_t s = table->slotOf[data[i + 1]];
+        if ((s != ADVFILTER_NONE) && !(found & (1 << s)))
+        {
+            found |= 1 << s;
+            pos[s] = i + 2;
+            size[s] = l - 1;
+        }
+        i += l + 1;
+    }
+
+    for (uint8_t i = 0; i < table->count; i++)
+    {
+        const SCompiled *c = &table->rules[i];
+        const uint8_t *ad = nullptr;
+
+        if ((c->addrTypes != 0) && !(c->addrTypes & (1 << addrType)))
+            continue;
+        if (rssi < c->rssiMin)
+            continue;
+        if (c->slot != ADVFILTER_NONE)
+        {
+            if (!(found & (1 << c->slot)) || (size[c->slot] < c->need))
+                continue;
+            ad = &data[pos[c->slot]];
+
+            bool hit = false;
+            uint16_t off = c->offset;
+            do
+            {
+                if ((uint16_t)(off + c->length) > size[c->slot])
+                    break;
+                hit = true;
+                for (uint8_t k = 0; k < c->length; k++)
+                {
+                    if ((ad[off + k] & c->mask[k]) != c->value[k])
+                    {
+                        hit = false;
+                        break;
+                    }
+                }
+                off += c->step;
+            } while (!hit && (c->step != 0));
+            if (!hit)
+                continue;
+        }
+
+        res->action = c->action;
+        if (c->action == EAdvAction::Beacon)
+        {
+            if (c->extract[0] != ADVFILTER_NONE)
+                std::memcpy(res->id, &ad[c->extract[0]], 16);
+            else
+                std::memset(res->id, 0, 16);
+            res->major = (c->extract[1] != ADVFILTER_NONE) ? (ad[c->extract[1]] << 8) + ad[c->extract[1] + 1] : 0;
+            res->minor = (c->extract[2] != ADVFILTER_NONE) ? (ad[c->extract[2]] << 8) + ad[c->extract[2] + 1] : 0;
+            res->power = (c->extract[3] != ADVFILTER_NONE) ? (int8_t)ad[c->extract[3]] : 0;
+        }
+        break;
+    }
+}
+
+/**
+ * @brief Empty rule
+ * @param action Action
+ * @param adType AD type of the pattern
+ * @return Rule without conditions or extracted fields
+ */
+static SAdvRule make_rule(EAdvAction action, uint8_t adType)
+{
+    SAdvRule r;
+    std::memset(&r, 0, sizeof(r));
+    r.action = action;
+    r.adType = adType;
+    r.rssiMin = -128;
+    r.idOffset = ADVFILTER_NONE;
+    r.majorOffset = ADVFILTER_NONE;
+    r.minorOffset = ADVFILTER_NONE;
+    r.powerOffset = ADVFILTER_NONE;
+    return r;
+}
+
+/**
+ * @brief Append bytes to the pattern of a rule
+ * @param r Rule
+ * @param data Bytes (nullptr - nothing)
+ * @param len Number of bytes
+ * @param mask Mask of the bytes
+ */
+static void rule_append(SAdvRule *r, const uint8_t *data, uint8_t len, uint8_t mask = 0xff)
+{
+    for (uint8_t k = 0; (data != nullptr) && (k < len) && (r->length < ADVFILTER_PATTERN); k++)
+    {
+        r->value[r->length] = data[k];
+        r->mask[r->length] = mask;
+        r->length++;
+    }
+}
+
+/**
+ * @brief Rule reporting iBeacons
+ *
+ * Manufacturer data: 4c 00 02 15, UUID, major, minor, power.
+ *
+ * @param uuid UUID prefix
+ * @param len Prefix length
+ * @return Rule
+ */
+SAdvRule CAdvFilter::iBeacon(const uint8_t *uuid, uint8_t len)
+{
+    static const uint8_t hdr[] = {0x4c, 0x00, 0x02, 0x15};
+    SAdvRule r = make_rule(EAdvAction::Beacon, AD_TYPE_MFG_DATA);
+    rule_append(&r, hdr, sizeof(hdr));
+    rule_append(&r, uuid, (len > 16) ? 16 : len);
+    r.idOffset = 4;
+    r.majorOffset = 20;
+    r.minorOffset = 22;
+    r.powerOffset = 24;
+    return r;
+}
+
+/**
+ * @brief Rule reporting AltBeacons
+ *
+ * Manufacturer data: company ID, be ac, 20-byte beacon ID, reference RSSI.
+ * The first 16 bytes of the beacon ID are the identifier, the last 4 bytes
+ * major and minor.
+ *
+ * @param id Beacon ID prefix
+ * @param len Prefix length
+ * @return Rule
+ */
+SAdvRule CAdvFilter::altBeacon(const uint8_t *id, uint8_t len)
+{
+    static const uint8_t hdr[] = {0xbe, 0xac};
+    SAdvRule r = make_rule(EAdvAction::Beacon, AD_TYPE_MFG_DATA);
+    r.offset = 2; // Any company
+    rule_append(&r, hdr, sizeof(hdr));
+    rule_append(&r, id, (len > 16) ? 16 : len);
+    r.idOffset = 4;
+    r.majorOffset = 20;
+    r.minorOffset = 22;
+    r.powerOffset = 24;
+    return r;
+}
+
+/**
+ * @brief Rule reporting Eddystone-UID frames
+ *
+ * Service data: aa fe, frame type 00, power, 10-byte namespace, 6-byte instance.
+ *
+ * @param ns Namespace prefix
+ * @param len Prefix length
+ * @return Rule
+ */
+SAdvRule CAdvFilter::eddystoneUid(const uint8_t *ns, uint8_t len)
+{
+    static const uint8_t hdr[] = {0xaa, 0xfe, 0x00, 0x00};
+    SAdvRule r = make_rule(EAdvAction::Beacon, AD_TYPE_SERVICE_DATA16);
+    rule_append(&r, hdr, 3);
+    rule_append(&r, &hdr[3], 1, 0x00); // Any power
+    rule_append(&r, ns, (len > 10) ? 10 : len);
+    r.idOffset = 4;
+    r.powerOffset = 3;
+    return r;
+}
+
+/**
+ * @brief Rule matching a company ID
+ * @param id Company identifier
+ * @param action Action
+ * @return Rule
+ */
+SAdvRule CAdvFilter::company(uint16_t id, EAdvAction action)
+{
+    uint8_t le[2] = {(uint8_t)id, (uint8_t)(id >> 8)};
+    SAdvRule r = make_rule(action, AD_TYPE_MFG_DATA);
+    rule_append(&r, le, 2);
+    return r;
+}
+
+/**
+ * @brief Rule matching a 16-bit service UUID
+ * @param uuid Service UUID
+ * @param action Action
+ * @param complete Complete or incomplete list
+ * @return Rule
+ */
+SAdvRule CAdvFilter::service(uint16_t uuid, EAdvAction action, bool complete)
+{
+    uint8_t le[2] = {(uint8_t)uuid, (uint8_t)(uuid >> 8)};
+    SAdvRule r = make_rule(action, complete ? AD_TYPE_UUID16_COMPLETE : AD_TYPE_UUID16_INCOMPLETE);
+    rule_append(&r, le, 2);
+    r.anyPosition = true;
+    return r;
+}
+
+/**
+ * @brief Rule matching the address type
+ * @param addrTypes Bit mask of address types
+ * @param action Action
+ * @return Rule
+ */
+SAdvRule CAdvFilter::address(uint8_t addrTypes, EAdvAction action)
+{
+    SAdvRule r = make_rule(action, 0);
+    r.addrTypes = addrTypes;
+    return r;
+}
@@ -0,0 +1,230 @@
+/*!
+    \file
+    \brief Runtime metrics of the BLE data channels.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CBTMetrics.h"
+#include "esp_timer.h"
+#include <cstring>
+
+const uint32_t CBTMetrics::bucketLimit[BTMETRICS_BUCKETS - 1] = {
+    500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000}; // The last bucket is unbounded
+
+static const char *channel_name[BTMETRICS_CHANNELS] = {"main", "second", "scan"};
+#ifdef CONFIG_BLE_DATA_PROBE
+static const char *stage_name[BTMETRICS_STAGES] = {"host", "queue", "txWait", "notify", "total"};
+#endif
+
+/**
+ * @brief Constructor for the CBTMetrics class
+ */
+CBTMetrics::CBTMetrics()
+{
+    reset();
+}
+
+/**
+ * @brief Reset all counters
+ *
+ * Packets already queued are not matched to a send time any more.
+ */
+void CBTMetrics::reset()
+{
+    std::memset(&mData, 0, sizeof(mData));
+    for (int i = 0; i < 2; i++)
+    {
+        mStampIn[i].store(0);
+        mStampOut[i].store(0);
+    }
+}
+
+/**
+ * @brief Register a packet accepted for transmission
+ *
+ * Called after the packet is queued, so the task may finish it first;
+ * stampPop() then skips the sample and the counters realign.
+ *
+ * @param ch Data channel
+ */
+void CBTMetrics::queued(EBTChannel ch)
+{
+    uint32_t n = mStampIn[(int)ch].fetch_add(1);
+    mStamps[(int)ch][n & (BTMETRICS_STAMPS - 1)] = (uint32_t)esp_timer_get_time();
+}
+
+/**
+ * @brief Take the enqueue time of the oldest packet of a channel
+ * @param ch Channel
+ * @param stamp Receives the enqueue time
+ * @return true if a time is available
+ */
+bool CBTMetrics::stampPop(EBTChannel ch, uint32_t &stamp)
+{
+    if (ch == EBTChannel::Scan)
+        return false; // Scan reports are not timed
+    uint32_t n = mStampOut[(int)ch].fetch_add(1);
+    int32_t pending = (int32_t)(mStampIn[(int)ch].load() - n);
+    if ((pending <= 0) || (pending > BTMETRICS_STAMPS))
+        return false; // Not registered yet or overwritten
+    stamp = mStamps[(int)ch][n & (BTMETRICS_STAMPS - 1)];
+    return true;
+}
+
+/**
+ * @brief Register a packet passed to the stack
+ * @param ch Data channel
+ * @param bytes Packet size
+ * @param error Stack error code
+ */
+void CBTMetrics::sent(EBTChannel ch, uint32_t bytes, int error)
+{
+    SBTChannelMetrics *m = &mData.channel[(int)ch];
+    uint32_t stamp;
+
+    if (error != 0)
+    {
+        m->errors++;
+        stampPop(ch, stamp);
+        return;
+    }
+    m->txPackets++;
+    m->txBytes += bytes;
+    if (!stampPop(ch, stamp))
+        return;
+
+    histogram(m->latency, m->latencyMax, (uint32_t)esp_timer_get_time() - stamp);
+}
+
+/**
+ * @brief Add a sample to a latency histogram
+ * @param hist Histogram
+ * @param max Maximum
+ * @param latency Latency in us
+ */
+void CBTMetrics::histogram(uint32_t *hist, uint32_t &max, uint32_t latency)
+{
+    int i = 0;
+    while ((i < BTMETRICS_BUCKETS - 1) && (latency >= bucketLimit[i]))
+        i++;
+    hist[i]++;
+    if (latency > max)
+        max = latency;
+}
+
+#ifdef CONFIG_BLE_DATA_PROBE
+/**
+ * @brief Register an echoed probe
+ *
+ * Stage k lasts from stamps[k] to stamps[k + 1]; the total spans all of them.
+ *
+ * @param stamps Times in us
+ */
+void CBTMetrics::probe(const uint32_t *stamps)
+{
+    SBTProbeMetrics *m = &mData.probe;
+    m->count++;
+    for (int k = 0; k < BTMETRICS_STAGES - 1; k++)
+        histogram(m->latency[k], m->latencyMax[k], stamps[k + 1] - stamps[k]);
+    histogram(m->latency[(int)EBTProbeStage::Total], m->latencyMax[(int)EBTProbeStage::Total], stamps[BTMETRICS_STAGES - 1] - stamps[0]);
+}
+#endif
+
+/**
+ * @brief Register a dropped packet
+ * @param ch Channel
+ */
+void CBTMetrics::dropped(EBTChannel ch)
+{
+    uint32_t stamp;
+    mData.channel[(int)ch].drops++;
+    stampPop(ch, stamp);
+}
+
+/**
+ * @brief Copy the counters
+ * @param data Receives the snapshot
+ */
+void CBTMetrics::get(SBTMetrics *data)
+{
+    std::memcpy(data, &mData, sizeof(mData));
+}
+
+/**
+ * @brief Convert a latency histogram to JSON
+ * @param hist Histogram of BTMETRICS_BUCKETS entries
+ * @return Array of {"le": upper bound in us or null, "count": samples}
+ */
+json CBTMetrics::histJSON(const uint32_t *hist)
+{
+    json arr = json::array();
+    for (int k = 0; k < BTMETRICS_BUCKETS; k++)
+    {
+        json b;
+        if (k < BTMETRICS_BUCKETS - 1)
+            b["le"] = bucketLimit[k];
+        else
+            b["le"] = nullptr; // Unbounded
+        b["count"] = hist[k];
+        arr.push_back(b);
+    }
+    return arr;
+}
+
+/**
+ * @brief Convert a snapshot to JSON
+ * @param data Snapshot
+ * @return A nlohmann::json object
+ */
+json CBTMetrics::toJSON(SBTMetrics *data)
+{
+    json j;
+    for (int i = 0; i < BTMETRICS_CHANNELS; i++)
+    {
+        SBTChannelMetrics *m = &data->channel[i];
+        json ch;
+        ch["txBytes"] = m->txBytes;
+        ch["txPackets"] = m->txPackets;
+        ch["rxBytes"] = m->rxBytes;
+        ch["rxPackets"] = m->rxPackets;
+        ch["errors"] = m->errors;
+        ch["retries"] = m->retries;
+        ch["drops"] = m->drops;
+        ch["rxDrops"] = m->rxDrops;
+        if (i != (int)EBTChannel::Scan)
+        {
+            ch["latency"] = histJSON(m->latency);
+            ch["latencyMax"] = m->latencyMax;
+        }
+        j[channel_name[i]] = ch;
+    }
+    j["txQueued"] = data->txQueued;
+    j["taskQueueHigh"] = data->taskQueueHigh;
+    j["txQueueHigh"] = data->txQueueHigh;
+    j["connects"] = data->connects;
+    j["disconnects"] = data->disconnects;
+    j["advertiseStarts"] = data->advertiseStarts;
+    j["scanStarts"] = data->scanStarts;
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    j["intervalFast"] = data->intervalFast;
+    j["intervalSlow"] = data->intervalSlow;
+    j["trafficRate"] = data->trafficRate;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    j["scanSuppressed"] = data->scanSuppressed;
+#endif
+#ifdef CONFIG_BLE_DATA_PROBE
+    json probe;
+    probe["count"] = data->probe.count;
+    for (int k = 0; k < BTMETRICS_STAGES; k++)
+    {
+        json st;
+        st["latency"] = histJSON(data->probe.latency[k]);
+        st["latencyMax"] = data->probe.latencyMax[k];
+        probe[stage_name[k]] = st;
+    }
+    j["probe"] = probe;
+#endif
+    return j;
+}
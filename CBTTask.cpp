@@ -13,6 +13,7 @@
 #include "services/gatt/ble_svc_gatt.h"
 #include "host/ble_hs_mbuf.h"
 #include "host/ble_gap.h"
+#include "os/os_mbuf.h"
 
 #ifdef CONFIG_BT_NIMBLE_ENABLED
 #include "nimble/ble.h"
@@ -24,8 +25,13 @@
 #include "nvs.h"
 #include "esp_random.h"
 
+#if defined(CONFIG_BLE_DATA_PROBE) || defined(CONFIG_BLE_DATA_SCAN_DEDUP)
+#include "esp_timer.h"
+#endif
+
 #include "CTrace.h"
 #include <cstring>
+#include <algorithm>
 
 #ifdef CONFIG_ESP_TASK_WDT
 #define TASK_MAX_BLOCK_TIME pdMS_TO_TICKS((CONFIG_ESP_TASK_WDT_TIMEOUT_S - 1) * 1000 + 500)
@@ -52,22 +58,48 @@ const ble_uuid16_t CBTTask::chr_uuid2 = BLE_UUID16_INIT(BLE_SVC_SPP_CHR_UUID16 +
 static uint16_t ble_spp_svc_gatt_read_val_handle2 = 0x31;
 #endif
 
+// Receive acknowledgement characteristic
+#ifdef CONFIG_BLE_DATA_RX_ACK
+const ble_uuid16_t CBTTask::chr_uuid_ack = BLE_UUID16_INIT(BLE_SVC_SPP_CHR_UUID16 + 2);
+static uint16_t ble_spp_svc_gatt_ack_val_handle = 0x32;
+#endif
+
+// Write Without Response lets the client send several packets per connection interval
+#ifdef CONFIG_BLE_DATA_WRITE_NO_RSP
+#define BLE_DATA_CHR_FLAGS (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY)
+#else
+#define BLE_DATA_CHR_FLAGS (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY)
+#endif
+#ifdef CONFIG_BLE_DATA_WRITE_NO_RSP2
+#define BLE_DATA_CHR_FLAGS2 (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY)
+#else
+#define BLE_DATA_CHR_FLAGS2 (BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY)
+#endif
+
 // Definition of GATT service characteristics
 const struct ble_gatt_chr_def CBTTask::gatt_svr_chrs[] = {
     {
         /* SPP service support */
         .uuid = (ble_uuid_t *)&chr_uuid,
         .access_cb = ble_svc_gatt_handler,                     // Callback for handling characteristic access
-        .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY, // Write and notify allowed
-        .val_handle = &ble_spp_svc_gatt_read_val_handle,       // Pointer to the value handle
+        .flags = BLE_DATA_CHR_FLAGS,                      // Write and notify allowed
+        .val_handle = &ble_spp_svc_gatt_read_val_handle,  // Pointer to the value handle
     },
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
     {
         .uuid = (ble_uuid_t *)&chr_uuid2,
         .access_cb = ble_svc_gatt_handler2, // Callback for second channel
-        .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+        .flags = BLE_DATA_CHR_FLAGS2,
         .val_handle = &ble_spp_svc_gatt_read_val_handle2,
     },
+#endif
+#ifdef CONFIG_BLE_DATA_RX_ACK
+    {
+        .uuid = (ble_uuid_t *)&chr_uuid_ack,
+        .access_cb = ble_svc_gatt_ack_handler, // Callback for the acknowledgement
+        .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+        .val_handle = &ble_spp_svc_gatt_ack_val_handle,
+    },
 #endif
     {
         0, /* No more characteristics in this service */
@@ -86,1073 +118,3150 @@ const struct ble_gatt_svc_def CBTTask::gatt_svr_svcs[] = {
 
 static const char *TAG = "BTTask"; // Tag for logging
 
+#ifdef CONFIG_BLE_DATA_METRICS
+#define BT_METRICS(x) x // Metrics update
+#else
+#define BT_METRICS(x) \
+    do                \
+    {                 \
+    } while (0)
+#endif
+
+#ifdef CONFIG_BLE_DATA_POOL_SCAN
+#define BT_POOL_SCAN true // Advertising reports use the pools
+#else
+#define BT_POOL_SCAN false
+#endif
+
+#ifdef CONFIG_BLE_DATA_PROBE
+// Header of a probe message body, followed by the probe
+struct SBTProbe
+{
+    uint16_t conn;     // Connection to echo to
+    uint32_t stamp[3]; // Times in us: write handler entry, posted, taken by the task
+};
+#endif
+
+// Link parameters of EBTLinkProfile (0 - keep the current value)
+struct SLinkParams
+{
+    uint8_t phy;       // Preferred PHY mask
+    uint16_t txOctets; // Maximum link layer payload
+    uint16_t mtu;      // Preferred ATT MTU
+    uint16_t itvlMin;  // Connection interval in 1.25 ms units
+    uint16_t itvlMax;
+    uint16_t latency;  // Peripheral latency
+    uint16_t timeout;  // Supervision timeout in 10 ms units
+};
+
+static const SLinkParams link_params[] = {
+    {BLE_GAP_LE_PHY_2M_MASK, 251, BLE_ATT_MTU_MAX, 6, 12, 0, 400}, // Throughput
+    {BLE_GAP_LE_PHY_2M_MASK, 251, BLE_ATT_MTU_MAX, 24, 40, 0, 400}, // Balanced
+    {0, 0, 0, 80, 160, 4, 600},                                     // LowPower
+};
+
+/**
+ * @brief Request the connection interval of link parameters
+ * @param handle Connection handle
+ * @param lp Link parameters
+ */
+static void link_update(uint16_t handle, const SLinkParams *lp)
+{
+    struct ble_gap_upd_params params;
+    memset(&params, 0, sizeof(params));
+    params.itvl_min = lp->itvlMin;
+    params.itvl_max = lp->itvlMax;
+    params.latency = lp->latency;
+    params.supervision_timeout = lp->timeout;
+    int rc = ble_gap_update_params(handle, &params);
+    if (rc != 0)
+        ESP_LOGW(TAG, "connection update request failed; rc=%d", rc);
+}
+
 const char *CBTTask::device_name = CONFIG_BLE_DATA_DEVICE_NAME; // Device name from configuration
 
+#ifdef CONFIG_BLE_DATA_FRAMED
+#define BLE_FRAME_START (0x80) // First fragment, followed by the 2-byte frame length
+#define BLE_FRAME_END (0x40)   // Last fragment
+#define BLE_FRAME_SEQ (0x3f)   // Sequence number mask
+
 /**
- * @brief GATT characteristic write handler
- * @param om Pointer to the data buffer
- * @param chn Channel number (1 or 2)
- * @return BLE error code
+ * @brief Send a frame as MTU sized notifications
+ *
+ * Stops with BLE_HS_ENOMEM when the mbuf pool runs low; the next call
+ * with the same frame resumes from the first unsent fragment. Fragments of
+ * different frames must not interleave, so another frame also gets
+ * BLE_HS_ENOMEM until the started one is complete.
+ *
+ * @param conn Connection handle or BLE_HS_CONN_HANDLE_NONE for all connections
+ * @param attr Attribute handle
+ * @param data Frame data
+ * @param size Frame size
+ * @return 0 or BLE error code
  */
-int CBTTask::gatt_svr_chr_write(struct os_mbuf *om, uint16_t chn)
+int CBTTask::notifyFrame(uint16_t conn, uint16_t attr, uint8_t *data, uint16_t size)
 {
-    uint16_t om_len;  // Length of received data
-    int rc;           // Return code
-    STaskMessage msg; // Message to send to the task
+    uint8_t hdr[3];
+    uint16_t hlen;
+    uint16_t chunk;
+    uint16_t space = mMtu - 3; // ATT notification header
+    struct os_mbuf *om;
+    int rc;
 
-    om_len = OS_MBUF_PKTLEN(om); // Get the packet length
-    if (om_len < 1)
+    if ((mTxOffset != 0) && (data != mTxFrame))
+        return BLE_HS_ENOMEM; // Another frame is half sent
+    mTxFrame = data;
+    while (mTxOffset < size)
     {
-        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN; // Error: empty packet
-    }
+        if (mTxOffset == 0)
+        {
+            hdr[0] = BLE_FRAME_START | (mTxSeq & BLE_FRAME_SEQ);
+            hdr[1] = (uint8_t)size;
+            hdr[2] = (uint8_t)(size >> 8);
+            hlen = 3;
+        }
+        else
+        {
+            hdr[0] = mTxSeq & BLE_FRAME_SEQ;
+            hlen = 1;
+        }
+        chunk = std::min<uint16_t>(size - mTxOffset, space - hlen);
+        if (mTxOffset + chunk == size)
+            hdr[0] |= BLE_FRAME_END;
 
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-    // Determine message type based on channel
-    if (chn == 2)
-        allocNewMsg(&msg, MSG_READ_DATA2, om_len, true); // Second channel
-    else
-#endif
-        allocNewMsg(&msg, MSG_READ_DATA, om_len, true); // First channel
+        if (!txReady() || ((om = ble_hs_mbuf_att_pkt()) == nullptr))
+            return BLE_HS_ENOMEM;
+        if ((os_mbuf_append(om, hdr, hlen) != 0) || (os_mbuf_append(om, &data[mTxOffset], chunk) != 0))
+        {
+            os_mbuf_free_chain(om);
+            return BLE_HS_ENOMEM;
+        }
+        if ((rc = notify(conn, attr, om)) != 0)
+        {
+            if (rc != BLE_HS_ENOMEM)
+                mTxOffset = 0; // Frame is lost
+            return rc;
+        }
 
-    // Copy data from the BLE buffer to our message
-    rc = ble_hs_mbuf_to_flat(om, msg.msgBody, om_len, nullptr);
-    if (rc != 0)
-    {
-        return BLE_ATT_ERR_UNLIKELY; // Copy error
+        mTxOffset += chunk;
+        mTxSeq++;
     }
-
-    // Send message to the Bluetooth task
-    CBTTask::Instance()->sendMessage(&msg, portMAX_DELAY, true);
+    mTxOffset = 0;
     return 0;
 }
 
 /**
- * @brief GATT characteristic access event handler (channel 1)
- * @param conn_handle Connection identifier
- * @param attr_handle Attribute identifier
- * @param ctxt Access context
- * @param arg Additional arguments
- * @return Error code
+ * @brief Reassemble a fragment of the main channel frame
+ * @param conn Connection
+ * @param om Fragment
+ * @param len Fragment size
+ * @return BLE ATT error code
  */
-int CBTTask::ble_svc_gatt_handler(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+int CBTTask::rxFragment(SBTConn *conn, struct os_mbuf *om, uint16_t len)
 {
-    int rc = 0;
-    switch (ctxt->op)
+    uint8_t hdr[3];
+    uint16_t hlen = 1;
+
+    os_mbuf_copydata(om, 0, 1, hdr);
+    if (hdr[0] & BLE_FRAME_START)
     {
-    case BLE_GATT_ACCESS_OP_WRITE_CHR:
-        // Handle write operation to the characteristic
-        rc = gatt_svr_chr_write(ctxt->om);
-        return rc;
-    default:
-        return BLE_ATT_ERR_UNLIKELY; // Unknown operation
+        hlen = 3;
+        if ((len < hlen) || (os_mbuf_copydata(om, 1, 2, &hdr[1]) != 0))
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        if (conn->rxFrame.msgBody != nullptr)
+        {
+            TRACE_WARNING("BLE Rx: incomplete frame dropped", conn->rxOffset);
+            rxFrameReset(conn);
+        }
+        uint16_t total = hdr[1] | (hdr[2] << 8);
+        if ((total == 0) || (total > CONFIG_BLE_DATA_FRAME_MAX))
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        allocBody(&conn->rxFrame, MSG_READ_DATA, total);
+        conn->rxOffset = 0;
+    }
+    else if ((conn->rxFrame.msgBody == nullptr) || ((hdr[0] & BLE_FRAME_SEQ) != conn->rxSeq))
+    {
+        // Lost fragment: wait for the next frame start
+        if (conn->rxFrame.msgBody != nullptr)
+        {
+            TRACE_WARNING("BLE Rx: fragment lost", conn->rxSeq);
+            rxFrameReset(conn);
+        }
+        return 0;
+    }
+    conn->rxSeq = (hdr[0] + 1) & BLE_FRAME_SEQ;
+
+    len -= hlen;
+    if (conn->rxOffset + len > conn->rxFrame.shortParam)
+    {
+        rxFrameReset(conn);
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    os_mbuf_copydata(om, hlen, len, (uint8_t *)conn->rxFrame.msgBody + conn->rxOffset);
+    conn->rxOffset += len;
+
+    if (hdr[0] & BLE_FRAME_END)
+    {
+        if (conn->rxOffset == conn->rxFrame.shortParam)
+        {
+            bool res = postData(&conn->rxFrame, 0, true);
+            conn->rxFrame.msgBody = nullptr;
+            if (!res)
+                return rxDrop(1);
+        }
+        else
+        {
+            TRACE_WARNING("BLE Rx: short frame dropped", conn->rxOffset);
+            rxFrameReset(conn);
+        }
     }
     return 0;
 }
 
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
 /**
- * @brief GATT characteristic access event handler (channel 2)
- * @param conn_handle Connection identifier
- * @param attr_handle Attribute identifier
- * @param ctxt Access context
- * @param arg Additional arguments
- * @return Error code
+ * @brief Discard the frame being reassembled
+ * @param conn Connection
  */
-int CBTTask::ble_svc_gatt_handler2(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+void CBTTask::rxFrameReset(SBTConn *conn)
 {
-    int rc = 0;
-    switch (ctxt->op)
+    if (conn->rxFrame.msgBody != nullptr)
     {
-    case BLE_GATT_ACCESS_OP_WRITE_CHR:
-        // Handle write operation to the second characteristic
-        rc = gatt_svr_chr_write(ctxt->om, 2);
-        return rc;
-    default:
-        return BLE_ATT_ERR_UNLIKELY; // Unknown operation
+        freeBody(conn->rxFrame.msgBody);
+        conn->rxFrame.msgBody = nullptr;
     }
-    return 0;
+    conn->rxOffset = 0;
 }
 #endif
 
-// Pointer to the single instance of the class
-CBTTask *CBTTask::theSingleInstance = nullptr;
-
 /**
- * @brief Get the single instance of the class (Singleton)
- * @return Pointer to the CBTTask instance
+ * @brief Find a connection in the table
+ * @param handle Connection handle
+ * @return Connection or nullptr
  */
-CBTTask *CBTTask::Instance()
+SBTConn *CBTTask::connFind(uint16_t handle)
 {
-    if (theSingleInstance == nullptr)
+    for (uint8_t i = 0; i < mConnCount; i++)
     {
-        // Create a new instance if it doesn't exist yet
-        theSingleInstance = new CBTTask();
-        // Initialize the base task
-        theSingleInstance->CBaseTask::init(BTTASK_NAME, BTTASK_STACKSIZE, BTTASK_PRIOR, BTTASK_LENGTH, BTTASK_CPU);
+        if (mConn[i].handle == handle)
+            return &mConn[i];
     }
-    return theSingleInstance;
-};
+    return nullptr;
+}
 
 /**
- * @brief Free resources and delete the instance
+ * @brief Add a connection to the table
+ *
+ * Called in the NimBLE host task under lock().
+ *
+ * @param handle Connection handle
+ * @return false if the table is full
  */
-void CBTTask::free()
+bool CBTTask::connAdd(uint16_t handle)
 {
-    if (theSingleInstance != nullptr)
+    if (mConnCount == CONFIG_BLE_DATA_MAX_CONNECTIONS)
+        return false;
+    SBTConn *conn = &mConn[mConnCount];
+    conn->handle = handle;
+    conn->mtu = ble_att_mtu(handle);
+    conn->txOctets = BLE_HCI_SET_DATALEN_TX_OCTETS_MIN;
+#ifdef CONFIG_BLE_DATA_FRAMED
+    rxFrameReset(conn);
+    if (mConnCount == 0)
     {
-        // Send a command to terminate the task
-        theSingleInstance->sendCmd(MSG_END_TASK);
-        // Wait for the task to finish
-        do
-        {
-            vTaskDelay(1);
-        }
-#if (INCLUDE_vTaskDelete == 1)
-        while (theSingleInstance->mTaskHandle != nullptr);
-#else
-        while (theSingleInstance->mTaskQueue != nullptr);
+        mTxSeq = 0;
+        mTxOffset = 0;
+    }
 #endif
-        // Delete the instance
-        delete theSingleInstance;
-        theSingleInstance = nullptr;
+#ifdef CONFIG_BLE_DATA_L2CAP
+    conn->coc = nullptr;
+    conn->cocStalled = false;
+#endif
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    if (mConnCount == 0)
+    {
+        // Start from the interval the central chose; traffic or a later update changes it
+        adaptSync(handle);
+        mAdaptIdle = 0;
+    }
+#endif
+#ifdef CONFIG_BLE_DATA_RX_ACK
+    if (mConnCount == 0)
+    {
+        // Counters start from zero for each session
+        mRxCount[0] = mRxCount[1] = 0;
+        mRxUnacked = 0;
     }
+#endif
+    mConnCount++;
+    mConnect = true;
+    connMtu();
+    return true;
 }
 
 /**
- * @brief Constructor for the class
+ * @brief Remove a connection from the table
+ *
+ * Called in the NimBLE host task under lock().
+ *
+ * @param handle Connection handle
  */
-CBTTask::CBTTask() : CBaseTask(), CLock()
+void CBTTask::connRemove(uint16_t handle)
 {
-    // Initialize class members with default values
-    mManufacturerData = nullptr;
-    mManufacturerDataSize = 0;
-    mMode = EBTMode::Off;
-    mConnect = false;
-    mOnRx = nullptr;
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-    mOnRx2 = nullptr;
-#endif
-    mOnConnect = nullptr;
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-    mOnBeacon = nullptr;
-    mBeaconTimer = nullptr;
-    mBeaconSleep = false;
-    mBeaconSleepTime = 0;
+    SBTConn *conn = connFind(handle);
+    if (conn == nullptr)
+        return;
+#ifdef CONFIG_BLE_DATA_FRAMED
+    rxFrameReset(conn);
 #endif
-#ifdef CONFIG_BLE_DATA_IBEACON_TX
-    mBeaconTx = 0;
-    mBeaconMajor = 0;
-    mBeaconMinor = 0;
+    mConnCount--;
+    if (conn != &mConn[mConnCount])
+    {
+        // Move the last entry into the hole
+        *conn = mConn[mConnCount];
+#ifdef CONFIG_BLE_DATA_FRAMED
+        mConn[mConnCount].rxFrame.msgBody = nullptr;
 #endif
+    }
+    mConnect = (mConnCount != 0);
+    connMtu();
 }
 
 /**
- * @brief Destructor for the class
+ * @brief Update the transmit MTU: fan-out sends have to fit every connection
  */
-CBTTask::~CBTTask()
+void CBTTask::connMtu()
 {
+    uint16_t mtu = UINT16_MAX;
+    for (uint8_t i = 0; i < mConnCount; i++)
+        mtu = std::min(mtu, mConn[i].mtu);
+    mMtu = (mConnCount != 0) ? mtu : BLE_ATT_MTU_DFLT;
 }
 
 /**
- * @brief BLE stack reset handler
- * @param reason Reason for the reset
+ * @brief Get handles of the established connections
+ * @param handles Receives up to CONFIG_BLE_DATA_MAX_CONNECTIONS handles
+ * @return Number of connections
  */
-void CBTTask::ble_on_reset(int reason)
+uint8_t CBTTask::getConnections(uint16_t *handles)
 {
-    ESP_LOGW(TAG, "Resetting state; reason=%d\n", reason);
+    lock();
+    uint8_t n = mConnCount;
+    for (uint8_t i = 0; i < n; i++)
+        handles[i] = mConn[i].handle;
+    unlock();
+    return n;
 }
 
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
 /**
- * @brief Synchronization handler for iBeacon scanning mode
+ * @brief Send a notification to one or all connections
+ *
+ * The handles are copied under lock(): a handle that has just gone fails
+ * with BLE_HS_ENOTCONN.
+ *
+ * @param conn Connection handle or BLE_HS_CONN_HANDLE_NONE for all connections
+ * @param attr Attribute handle
+ * @param om Payload, consumed in all cases
+ * @return BLE_HS_ENOMEM if nothing was sent for lack of mbufs, otherwise 0 or BLE error code
  */
-void CBTTask::ble_on_sync_rx()
+int CBTTask::notify(uint16_t conn, uint16_t attr, struct os_mbuf *om)
 {
-    ESP_LOGD(TAG, "BLE rx");
-    int rc;
+    uint16_t handles[CONFIG_BLE_DATA_MAX_CONNECTIONS];
+    struct os_mbuf *txom;
+    uint8_t n;
+    uint8_t sent = 0;
+    int rc = 0;
+    int er;
 
-    /* Ensure the correct device address is set (preferably public) */
-    rc = ble_hs_util_ensure_addr(0);
-    if (rc != 0)
+    if (conn != BLE_HS_CONN_HANDLE_NONE)
+        return connSend(conn, attr, om);
+    n = getConnections(handles);
+    if (n == 0)
     {
-        ESP_LOGE(TAG, "error ble_hs_util_ensure_addr; rc=%d", rc);
-        return;
+        os_mbuf_free_chain(om);
+        return BLE_HS_ENOTCONN;
     }
-
-    /* Start scanning to find peripheral devices */
-    ble_scan();
+    for (uint8_t i = 0; i < n; i++)
+    {
+        txom = (i == n - 1) ? om : os_mbuf_dup(om);
+        if (txom == nullptr)
+            er = BLE_HS_ENOMEM;
+        else
+            er = connSend(handles[i], attr, txom);
+        if (er == 0)
+            sent++;
+        else
+            rc = er;
+    }
+    if ((sent != 0) && (rc == BLE_HS_ENOMEM))
+    {
+        // Retrying would duplicate the packet for the other connections
+        TRACE_WARNING("BLE Tx: fan-out incomplete", n - sent);
+        rc = 0;
+    }
+    return rc;
 }
 
 /**
- * @brief Start BLE device scanning
+ * @brief Send a packet to one connection
+ *
+ * Main channel packets go over the L2CAP CoC channel when the central has
+ * opened one, otherwise they are notified.
+ *
+ * @param handle Connection handle
+ * @param attr Attribute handle
+ * @param om Payload, consumed in all cases
+ * @return 0 or BLE error code
  */
-void CBTTask::ble_scan()
+int CBTTask::connSend(uint16_t handle, uint16_t attr, struct os_mbuf *om)
 {
-    uint8_t own_addr_type; // Type of the own device address
-    int rc;
-
-    /* Determine the address type to use for advertising (without privacy) */
-    rc = ble_hs_id_infer_auto(0, &own_addr_type);
-    if (rc != 0)
+#ifdef CONFIG_BLE_DATA_L2CAP
+    if (attr == ble_spp_svc_gatt_read_val_handle)
     {
-        ESP_LOGE(TAG, "error determining address type; rc=%d", rc);
-        return;
-    }
-
-#ifdef CONFIG_BT_NIMBLE_EXT_ADV
-    // Extended scanning parameters
-    struct ble_gap_ext_disc_params disc_params;
-    disc_params.passive = 1; // Passive scanning
-
-    /* Use default values for other parameters */
-    disc_params.itvl = 0;   // BLE_GAP_SCAN_ITVL_MS(600);
-    disc_params.window = 0; // BLE_GAP_SCAN_ITVL_MS(300);
-
-    // Start extended scanning
-    rc = ble_gap_ext_disc(own_addr_type, 0, 0, 1, 0, 0,
-                          &disc_params, &disc_params, ble_rx_gap_event, NULL);
-    assert(rc == 0);
-
-#else
-    // Standard scanning parameters
-    struct ble_gap_disc_params disc_params;
-    /* Filter duplicates - do not process repeated advertisements from one device */
-    disc_params.filter_duplicates = 1;
-
-    /**
-     * Perform passive scanning. I.e., do not send scan requests
-     * to each advertiser.
-     */
-    disc_params.passive = 1;
-
-    /* Use default values for other parameters */
-    disc_params.itvl = 0;
-    disc_params.window = 0;
-    disc_params.filter_policy = 0;
-    disc_params.limited = 0;
+        bool coc = false;
+        int rc = 0;
 
-    // Start standard scanning
-    rc = ble_gap_disc(own_addr_type, BLE_HS_FOREVER, &disc_params,
-                      ble_rx_gap_event, NULL);
-    if (rc != 0)
-    {
-        ESP_LOGE(TAG, "Error initiating GAP discovery procedure; rc=%d", rc);
+        // The channel is used under lock(): the host task clears it when it closes
+        lock();
+        SBTConn *conn = connFind(handle);
+        if ((conn != nullptr) && (conn->coc != nullptr))
+        {
+            coc = true;
+            if (conn->cocStalled)
+                rc = BLE_HS_ENOMEM; // Keep the order until the peer grants credits
+            else
+            {
+                rc = ble_l2cap_send(conn->coc, om);
+                if (rc == BLE_HS_ESTALLED)
+                {
+                    // Accepted; the next SDU waits for BLE_L2CAP_EVENT_COC_TX_UNSTALLED
+                    conn->cocStalled = true;
+                    rc = 0;
+                }
+            }
+        }
+        unlock();
+        if (coc)
+        {
+            if (rc != 0)
+                os_mbuf_free_chain(om); // Only accepted SDUs are consumed
+            return rc;
+        }
     }
 #endif
+    return ble_gatts_notify_custom(handle, attr, om);
 }
 
+#ifdef CONFIG_BLE_DATA_L2CAP
 /**
- * @brief GAP event handler for scanning
- * @param event GAP event
- * @param arg Additional arguments
- * @return Return code
+ * @brief L2CAP CoC event handler
+ *
+ * Received SDUs take the path of main channel writes, so they reach
+ * onBLEDataRx the same way.
+ *
+ * @param event Event
+ * @param arg Not used
+ * @return 0 to accept the channel
  */
-int CBTTask::ble_rx_gap_event(struct ble_gap_event *event, void *arg)
+int CBTTask::ble_l2cap_event(struct ble_l2cap_event *event, void *arg)
 {
-    struct ble_hs_adv_fields fields; // Advertising data fields
-    int rc;
-    STaskMessage msg;
-    SBeacon *beacon; // Structure for iBeacon data
-    SMac *mac;       // Structure for MAC address
+    CBTTask *bt = CBTTask::Instance();
+    SBTConn *conn;
+    struct os_mbuf *sdu;
 
     switch (event->type)
     {
-    case BLE_GAP_EVENT_DISC_COMPLETE:
-        // Scanning completed
-        return 0;
-
-#ifdef CONFIG_BT_NIMBLE_EXT_ADV
-    case BLE_GAP_EVENT_EXT_DISC:
-        // Extended device discovery
-        if (event->ext_disc.legacy_event_type == BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND)
+    case BLE_L2CAP_EVENT_COC_ACCEPT:
+        // Receive buffer for the first SDU
+        sdu = os_msys_get_pkthdr(0, 0);
+        if (sdu == nullptr)
+            return BLE_HS_ENOMEM;
+        return ble_l2cap_recv_ready(event->accept.chan, sdu);
+    case BLE_L2CAP_EVENT_COC_CONNECTED:
+        if (event->connect.status != 0)
         {
-            // Parse advertising fields
-            rc = ble_hs_adv_parse_fields(&fields, event->ext_disc.data,
-                                         event->ext_disc.length_data);
-            if (rc == 0)
-            {
-                // Check if the device is an iBeacon
-                if ((fields.mfg_data_len == 25) && (fields.mfg_data[0] == 0x4c) && (fields.mfg_data[1] == 0) && (fields.mfg_data[2] == 0x02) && (fields.mfg_data[3] == 0x15))
-                {
-                    // Create a message with iBeacon data
-                    beacon = (SBeacon *)allocNewMsg(&msg, MSG_BEACON_DATA, sizeof(SBeacon), true);
-                    std::memcpy(beacon->uuid, &fields.mfg_data[4], 16);              // Copy UUID
-                    beacon->major = fields.mfg_data[21] + fields.mfg_data[20] * 256; // Major
-                    beacon->minor = fields.mfg_data[23] + fields.mfg_data[22] * 256; // Minor
-                    beacon->power = fields.mfg_data[24];                             // Power
-                    beacon->rssi = event->ext_disc.rssi;                             // RSSI
-                    CBTTask::Instance()->sendMessage(&msg, 10, true);                // Send message
-                    return 0;
-                }
-            }
+            TRACE_WARNING("BLE CoC: connect failed", event->connect.status);
+            return 0;
         }
-        // Process public device MAC addresses
-        if (event->ext_disc.addr.type == BLE_ADDR_PUBLIC)
+        bt->lock();
+        conn = bt->connFind(event->connect.conn_handle);
+        if (conn != nullptr)
         {
-            mac = (SMac *)allocNewMsg(&msg, MSG_MAC_DATA, sizeof(SMac), true);
-            std::memcpy(mac->mac, event->ext_disc.addr.val, 6); // Copy MAC
-            CBTTask::Instance()->sendMessage(&msg, 10, true);
-            mac->rssi = event->ext_disc.rssi; // RSSI
+            conn->coc = event->connect.chan;
+            conn->cocStalled = false;
         }
+        bt->unlock();
+        ESP_LOGI(TAG, "L2CAP CoC open; conn_handle=%d", event->connect.conn_handle);
         return 0;
-#else
-    case BLE_GAP_EVENT_DISC:
-        // Standard device discovery
-        // ESP_LOGW(TAG,"rssi %d, type %d",event->disc.rssi, event->disc.event_type);
-        if (CBTTask::Instance()->mBeaconFilter)
+    case BLE_L2CAP_EVENT_COC_DISCONNECTED:
+        bt->lock();
+        conn = bt->connFind(event->disconnect.conn_handle);
+        if ((conn != nullptr) && (conn->coc == event->disconnect.chan))
         {
-            // Parse advertising fields
-            rc = ble_hs_adv_parse_fields(&fields, event->disc.data,
-                                         event->disc.length_data);
-            if (rc == 0)
-            {
-                // ESP_LOG_BUFFER_HEX("mfg", fields.mfg_data, fields.mfg_data_len);
-                // Check if the device is an iBeacon
-                if ((fields.mfg_data_len == 25) && (fields.mfg_data[0] == 0x4c) && (fields.mfg_data[1] == 0) && (fields.mfg_data[2] == 0x02) && (fields.mfg_data[3] == 0x15))
-                {
-                    // Create a message with iBeacon data
-                    beacon = (SBeacon *)allocNewMsg(&msg, MSG_BEACON_DATA, sizeof(SBeacon), true);
-                    std::memcpy(beacon->uuid.data(), &fields.mfg_data[4], 16);       // Copy UUID
-                    beacon->major = fields.mfg_data[21] + fields.mfg_data[20] * 256; // Major
-                    beacon->minor = fields.mfg_data[23] + fields.mfg_data[22] * 256; // Minor
-                    beacon->power = fields.mfg_data[24];                             // Power
-                    beacon->rssi = event->disc.rssi;                                 // RSSI
-                    CBTTask::Instance()->sendMessage(&msg, 10, true);                // Send message
-                    return 0;
-                }
-            }
+            conn->coc = nullptr;
+            conn->cocStalled = false;
+        }
+        bt->unlock();
+        return 0;
+    case BLE_L2CAP_EVENT_COC_DATA_RECEIVED:
+        sdu = event->receive.sdu_rx;
+        if (sdu != nullptr)
+        {
+            // There is no ATT response to reject the SDU, so every rejection is a drop
+            int rc = gatt_svr_chr_write(event->receive.conn_handle, sdu);
+            if ((rc != 0) && (rc != BLE_ATT_ERR_INSUFFICIENT_RES)) // Full queue is counted there
+                bt->rxDrop(1);
+            os_mbuf_free_chain(sdu);
         }
-        // Process public device MAC addresses
-        if (event->disc.addr.type == BLE_ADDR_PUBLIC)
+        // Buffer for the next SDU
+        sdu = os_msys_get_pkthdr(0, 0);
+        if ((sdu == nullptr) || (ble_l2cap_recv_ready(event->receive.chan, sdu) != 0))
         {
-            // ESP_LOG_BUFFER_HEX("mac", event->disc.addr.val, 6);
-            mac = (SMac *)allocNewMsg(&msg, MSG_MAC_DATA, sizeof(SMac), true);
-            std::memcpy(mac->mac.data(), event->disc.addr.val, 6); // Copy MAC
-            CBTTask::Instance()->sendMessage(&msg, 10, true);
-            mac->rssi = event->disc.rssi; // RSSI
+            TRACE_ERROR("BLE CoC: no receive buffer", event->receive.conn_handle);
+            if (sdu != nullptr)
+                os_mbuf_free_chain(sdu);
+            ble_l2cap_disconnect(event->receive.chan);
+        }
+        return 0;
+    case BLE_L2CAP_EVENT_COC_TX_UNSTALLED:
+        bt->lock();
+        conn = bt->connFind(event->tx_unstalled.conn_handle);
+        if (conn != nullptr)
+            conn->cocStalled = false;
+        bt->unlock();
+        if (!bt->mDataBell.exchange(true))
+        {
+            // Resume the transmit queue without waiting for the next poll
+            if (!bt->sendCmd(MSG_DATA_READY, 0, 0, 0))
+                bt->mDataBell.store(false);
         }
         return 0;
-#endif
-
     default:
         return 0;
     }
 }
 #endif
 
-#ifdef CONFIG_BLE_DATA_IBEACON_TX
 /**
- * @brief Synchronization handler for iBeacon transmission mode
+ * @brief Resume advertising if it is not running
  */
-void CBTTask::ble_on_sync_beacon()
+void CBTTask::advertiseResume()
 {
-    ESP_LOGD(TAG, "BLE sync beacon");
-    /* Generate a non-resolvable private address */
-    ble_app_set_addr();
-    /* Start advertising indefinitely */
-    ble_advertise_beacon();
+#ifdef CONFIG_BT_NIMBLE_EXT_ADV
+    if (!ble_gap_ext_adv_active(1))
+#else
+    if (!ble_gap_adv_active())
+#endif
+        ble_advertise_data();
 }
 
 /**
- * @brief Set the BLE device address
+ * @brief Request the link parameters of the current profile
+ *
+ * Each request completes with its own GAP event, which reports the current
+ * values through linkReport().
+ *
+ * @param conn Connection
  */
-void CBTTask::ble_app_set_addr()
+void CBTTask::linkNegotiate(SBTConn *conn)
 {
-    ble_addr_t addr; // Address structure
+    if (mLinkProfile == EBTLinkProfile::Default)
+        return;
+    const SLinkParams *lp = &link_params[(int)mLinkProfile - 1];
     int rc;
 
-    // Generate a random address
-    rc = ble_hs_id_gen_rnd(1, &addr);
-    if (rc != 0)
+    if (lp->phy != 0)
     {
-        ESP_LOGE(TAG, "error ble_hs_id_gen_rnd; rc=%d", rc);
-        return;
+        rc = ble_gap_set_prefered_le_phy(conn->handle, lp->phy, lp->phy, BLE_GAP_LE_PHY_CODED_ANY);
+        if (rc != 0)
+            ESP_LOGW(TAG, "PHY request failed; rc=%d", rc);
     }
-
-    // Set the random address
-    rc = ble_hs_id_set_rnd(addr.val);
-    if (rc != 0)
+    if (lp->txOctets != 0)
     {
-        ESP_LOGE(TAG, "error ble_app_set_addr; rc=%d", rc);
-        return;
+        rc = ble_gap_set_data_len(conn->handle, lp->txOctets, BLE_HCI_SET_DATALEN_TX_TIME_MAX);
+        if (rc == 0)
+            conn->txOctets = lp->txOctets;
+        else
+            ESP_LOGW(TAG, "data length request failed; rc=%d", rc);
+    }
+    if ((lp->mtu != 0) && (conn->mtu < lp->mtu))
+    {
+        ble_att_set_preferred_mtu(lp->mtu);
+        rc = ble_gattc_exchange_mtu(conn->handle, linkMtuEvent, nullptr);
+        if (rc != 0)
+            ESP_LOGW(TAG, "MTU exchange failed; rc=%d", rc);
     }
+    link_update(conn->handle, lp);
 }
 
 /**
- * @brief Start iBeacon advertising
+ * @brief Report the link parameters through the callback
+ * @param handle Connection handle
  */
-void CBTTask::ble_advertise_beacon()
+void CBTTask::linkReport(uint16_t handle)
 {
-    struct ble_gap_adv_params adv_params; // Advertising parameters
-    int rc;
+    onBLELink *onLink = mOnLink;
+    SBTConn *conn = connFind(handle);
+    struct ble_gap_conn_desc desc;
+    SBTLinkInfo info;
 
-    // Set the advertising data for iBeacon
-    rc = ble_ibeacon_set_adv_data(CBTTask::Instance()->mBeaconID,
-                                  CBTTask::Instance()->mBeaconMajor,
-                                  CBTTask::Instance()->mBeaconMinor,
-                                  CBTTask::Instance()->mBeaconTx);
-    if (rc != 0)
-    {
-        ESP_LOGE(TAG, "error setting advertisement iBeacon; rc=%d", rc);
+    if ((onLink == nullptr) || (conn == nullptr) || (ble_gap_conn_find(handle, &desc) != 0))
         return;
-    }
+    info.conn = handle;
+    if (ble_gap_read_le_phy(handle, &info.txPhy, &info.rxPhy) != 0)
+        info.txPhy = info.rxPhy = BLE_GAP_LE_PHY_1M;
+    info.txOctets = conn->txOctets;
+    info.mtu = conn->mtu;
+    info.interval = desc.conn_itvl;
+    info.latency = desc.conn_latency;
+    info.timeout = desc.supervision_timeout;
+    onLink(&info);
+}
 
-    /* Start advertising */
-    adv_params = (struct ble_gap_adv_params){0};
-    rc = ble_gap_adv_start(BLE_OWN_ADDR_RANDOM, nullptr, BLE_HS_FOREVER,
-                           &adv_params, nullptr, nullptr);
-    if (rc == 0)
-        ESP_LOGD(TAG, "iBeacon advertisement started");
-    else
-        ESP_LOGE(TAG, "error setting advertisement iBeacon; rc=%d", rc);
+/**
+ * @brief MTU exchange completion callback
+ *
+ * The new value arrives with BLE_GAP_EVENT_MTU.
+ *
+ * @param conn_handle Connection handle
+ * @param error Exchange status
+ * @param mtu Negotiated MTU
+ * @param arg Not used
+ * @return 0
+ */
+int CBTTask::linkMtuEvent(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg)
+{
+    if (error->status != 0)
+        ESP_LOGW(TAG, "MTU exchange failed; handle=%d status=%d", conn_handle, error->status);
+    return 0;
 }
-#endif
 
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
 /**
- * @brief GAP event handler for the data server
- * @param event GAP event
- * @param arg Additional arguments
- * @return Return code
+ * @brief Evaluate the traffic of the last window and switch the interval
+ *
+ * Any busy window selects the short interval at once; the long one needs
+ * CONFIG_BLE_DATA_ADAPTIVE_IDLE idle windows in a row, so short pauses in a
+ * transfer do not cause a pair of updates.
  */
-int CBTTask::ble_server_gap_event(struct ble_gap_event *event, void *arg)
+void CBTTask::adaptTick()
 {
-    switch (event->type)
+    uint32_t rate = (uint32_t)((uint64_t)mAdaptBytes.exchange(0) * 1000 / CONFIG_BLE_DATA_ADAPTIVE_WINDOW);
+
+    BT_METRICS(mMetrics.traffic(rate));
+    if (!mConnect || (mAdaptHigh == 0))
+        return;
+    uint16_t itvl = mAdaptItvl.load();
+    if ((rate >= mAdaptHigh) || !txIdle() || !dataIdle())
     {
-    case BLE_GAP_EVENT_CONNECT:
-        // Connection event
-        if (event->connect.status != 0)
-        {
-            ESP_LOGW(TAG, "Connection failed");
-            CBTTask::Instance()->mConnect = false;
-            /* Connection failed - resume advertising */
-            ble_advertise_data();
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Connection established");
-            CBTTask::Instance()->mConnect = true;
-            // Call the connection callback
-            if (CBTTask::Instance()->mOnConnect != nullptr)
-                CBTTask::Instance()->mOnConnect(true);
-        }
-        return 0;
+        mAdaptIdle = 0;
+        if (itvl > link_params[(int)EBTLinkProfile::Throughput - 1].itvlMax)
+            adaptSet(true);
+    }
+    else if (rate <= mAdaptLow)
+    {
+        // Any interval shorter than the long one, whoever chose it, is given up
+        if ((itvl < link_params[(int)EBTLinkProfile::LowPower - 1].itvlMin) && (++mAdaptIdle >= CONFIG_BLE_DATA_ADAPTIVE_IDLE))
+            adaptSet(false);
+    }
+    else
+        mAdaptIdle = 0; // Between the thresholds: keep the current interval
+}
 
-    case BLE_GAP_EVENT_DISCONNECT:
-        // Disconnection event
-        ESP_LOGW(TAG, "disconnect; reason=%d", event->disconnect.reason);
-        CBTTask::Instance()->mConnect = false;
-        // Call the disconnection callback
-        if (CBTTask::Instance()->mOnConnect != nullptr)
-            CBTTask::Instance()->mOnConnect(false);
-        ble_advertise_data(); // Resume advertising
-        return 0;
+/**
+ * @brief Request the short or the long connection interval on all connections
+ *
+ * Uses the intervals of the Throughput and LowPower link profiles.
+ *
+ * @param fast true for the short interval
+ */
+void CBTTask::adaptSet(bool fast)
+{
+    const SLinkParams *lp = &link_params[(int)(fast ? EBTLinkProfile::Throughput : EBTLinkProfile::LowPower) - 1];
+    uint16_t handles[CONFIG_BLE_DATA_MAX_CONNECTIONS];
+    uint8_t n = getConnections(handles);
+
+    for (uint8_t i = 0; i < n; i++)
+        link_update(handles[i], lp);
+    mAdaptItvl.store(lp->itvlMax);
+    mAdaptIdle = 0;
+    BT_METRICS(mMetrics.interval(fast));
+}
 
-    default:
-        return 0;
-    }
+/**
+ * @brief Take the interval in use on a connection
+ *
+ * Called by the host task on connection and on each completed parameter
+ * update, so the state follows the intervals requested by the central or
+ * by setLinkProfile(): the next busy window upgrades a long interval and
+ * idle windows downgrade any shorter one.
+ *
+ * @param handle Connection handle
+ */
+void CBTTask::adaptSync(uint16_t handle)
+{
+    struct ble_gap_conn_desc desc;
+
+    if (ble_gap_conn_find(handle, &desc) == 0)
+        mAdaptItvl.store(desc.conn_itvl);
 }
+#endif
 
 /**
- * @brief Start data advertising
+ * @brief GATT characteristic write handler
+ *
+ * A long write arrives here once, after the client executes it: NimBLE
+ * links the prepared parts into one mbuf chain. The chain is copied once,
+ * into the task message or the receive ring, and delivered as one buffer.
+ *
+ * @param conn_handle Connection identifier
+ * @param om Pointer to the data buffer
+ * @param chn Channel number (1 or 2)
+ * @return BLE error code
  */
-void CBTTask::ble_advertise_data()
+int CBTTask::gatt_svr_chr_write(uint16_t conn_handle, struct os_mbuf *om, uint16_t chn)
 {
-#ifdef CONFIG_BT_NIMBLE_EXT_ADV
-    int rc;
-    struct ble_gap_ext_adv_params params; // Extended advertising parameters
-    struct ble_hs_adv_fields adv_fields;  // Advertising data fields
-    struct os_mbuf *data;                 // Buffer for advertising data
+    uint16_t om_len; // Length of received data
+#ifdef CONFIG_BLE_DATA_PROBE
+    uint32_t stamp = (uint32_t)esp_timer_get_time(); // Probe entry time
+#endif
 
-    /* Set a random (NRPA) address for the instance */
-    if (CBTTask::Instance()->mAddr.type == 0)
+    om_len = OS_MBUF_PKTLEN(om); // Get the packet length
+    if (om_len < 1)
     {
-        rc = ble_hs_id_gen_rnd(1, &(CBTTask::Instance()->mAddr));
-        assert(rc == 0);
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN; // Error: empty packet
     }
+    BT_METRICS(CBTTask::Instance()->mMetrics.received((chn == 2) ? EBTChannel::Second : EBTChannel::Main, om_len));
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    CBTTask::Instance()->mAdaptBytes.fetch_add(om_len);
+#endif
 
-    /* For periodic advertising, use the instance with non-connectable advertising */
-    memset(&params, 0, sizeof(params));
-
-    /* Advertise using a random address */
-    params.own_addr_type = BLE_OWN_ADDR_RANDOM;
-    params.primary_phy = BLE_HCI_LE_PHY_1M;
-    params.secondary_phy = BLE_HCI_LE_PHY_2M;
-    params.sid = 1;
-    params.connectable = 1; // Connectable advertising
+#ifdef CONFIG_BLE_DATA_PROBE
+    if ((chn == 1) && CBTTask::Instance()->mProbe.load())
+        return CBTTask::Instance()->probeRx(conn_handle, om, om_len, stamp);
+#endif
 
-    const char *name = ble_svc_gap_device_name(); // Get the device name
+#ifdef CONFIG_BLE_DATA_FRAMED
+    if (chn == 1)
+    {
+        SBTConn *conn = CBTTask::Instance()->connFind(conn_handle);
+        if (conn == nullptr)
+            return BLE_ATT_ERR_UNLIKELY;
+        return CBTTask::Instance()->rxFragment(conn, om, om_len);
+    }
+#endif
 
-    CBTTask::Instance()->lock();
-    int size = (CBTTask::Instance()->mManufacturerDataSize + strlen(name));
-    // Allocate buffer for advertising data
-    if (size > 20)
+#ifdef CONFIG_BLE_DATA_RX_RING
+    // Copy into the receive ring; the host task never waits for the Bluetooth task
+    CBTTask *bt = CBTTask::Instance();
+    if (om_len + 3 > CONFIG_BLE_DATA_RX_RING_SIZE / 2)
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN; // Would never fit
+    uint8_t *dt = bt->mRxRing->reserve(om_len + 1);
+    if (dt == nullptr)
+        return bt->rxDrop(chn);
+    dt[0] = (uint8_t)chn;
+    os_mbuf_copydata(om, 0, om_len, &dt[1]);
+    bt->mRxRing->commit();
+    if (!bt->mRxBell.exchange(true))
     {
-        data = os_msys_get_pkthdr(size + (BLE_HS_ADV_MAX_SZ - 20), 0);
+        // If the queue is full the task finds the packet while polling the ring
+        if (!bt->sendCmd(MSG_RX_RING, 0, 0, 0))
+            bt->mRxBell.store(false);
     }
+    return 0;
+#else
+    int rc;           // Return code
+    STaskMessage msg; // Message to send to the task
+
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    // Determine message type based on channel
+    if (chn == 2)
+        allocBody(&msg, MSG_READ_DATA2, om_len); // Second channel
     else
+#endif
+        allocBody(&msg, MSG_READ_DATA, om_len); // First channel
+
+    // Copy data from the BLE buffer to our message
+    rc = ble_hs_mbuf_to_flat(om, msg.msgBody, om_len, nullptr);
+    if (rc != 0)
     {
-        data = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
-        params.scannable = 1;
-        params.legacy_pdu = 1;
+        freeBody(msg.msgBody);
+        return BLE_ATT_ERR_UNLIKELY; // Copy error
     }
-    assert(data);
 
-    /* Configure instance 1 */
-    rc = ble_gap_ext_adv_configure(1, &params, NULL, CBTTask::ble_server_gap_event, NULL);
-    assert(rc == 0);
+    // Send message to the Bluetooth task without blocking the host task
+    if (!CBTTask::Instance()->postData(&msg, 0, true))
+        return CBTTask::Instance()->rxDrop(chn);
+    return 0;
+#endif
+}
 
-    rc = ble_gap_ext_adv_set_addr(1, &(CBTTask::Instance()->mAddr));
-    assert(rc == 0);
+#ifdef CONFIG_BLE_DATA_PROBE
+/**
+ * @brief Queue a received probe for the echo
+ * @param conn_handle Connection handle
+ * @param om Probe
+ * @param len Probe size
+ * @param stamp Entry time of the write handler in us
+ * @return ATT error code
+ */
+int CBTTask::probeRx(uint16_t conn_handle, struct os_mbuf *om, uint16_t len, uint32_t stamp)
+{
+    STaskMessage msg;
+    uint8_t *dt = allocBody(&msg, MSG_PROBE, sizeof(SBTProbe) + len);
+    SBTProbe *probe = (SBTProbe *)dt;
+
+    os_mbuf_copydata(om, 0, len, &dt[sizeof(SBTProbe)]);
+    probe->conn = conn_handle;
+    probe->stamp[0] = stamp;
+    probe->stamp[1] = (uint32_t)esp_timer_get_time();
+    if (!postData(&msg, 0, true))
+        return rxDrop(1);
+    return 0;
+}
 
-    memset(&adv_fields, 0, sizeof(adv_fields));
+/**
+ * @brief Echo a probe
+ *
+ * The probe waits in the pending notification queue like any other packet,
+ * so the measured delay includes the transmit backlog.
+ *
+ * @param msg Probe message
+ * @return BLE_HS_ENOMEM if the probe must wait for free mbufs, otherwise 0
+ */
+int CBTTask::probeSend(STaskMessage *msg)
+{
+    SBTProbe *probe = (SBTProbe *)msg->msgBody;
+    uint32_t stamps[BTMETRICS_STAGES];
+    struct os_mbuf *txom;
+    int er;
 
-    /* Advertise two flags:
-     *     o Discoverability in subsequent advertising (general)
-     *     o BLE only (BR/EDR not supported).
-     */
-    adv_fields.flags = BLE_HS_ADV_F_DISC_GEN |
-                       BLE_HS_ADV_F_BREDR_UNSUP;
+    if (!mConnect)
+    {
+        txFree(msg);
+        return 0;
+    }
+    if (!txReady())
+        return BLE_HS_ENOMEM;
+    txom = ble_hs_mbuf_from_flat(&probe[1], msg->shortParam - sizeof(SBTProbe));
+    if (txom == nullptr)
+        return BLE_HS_ENOMEM;
+
+    std::memcpy(stamps, probe->stamp, sizeof(probe->stamp));
+    stamps[3] = (uint32_t)esp_timer_get_time();
+    er = notify(probe->conn, ble_spp_svc_gatt_read_val_handle, txom);
+    if (er == BLE_HS_ENOMEM)
+        return er; // Retry when the stack frees buffers
+    stamps[4] = (uint32_t)esp_timer_get_time();
+    if (er == 0)
+        mMetrics.probe(stamps);
+    else
+        TRACE_ERROR("bt: Error in sending probe", er);
+    txFree(msg);
+    return 0;
+}
+#endif
 
-    adv_fields.name = (const uint8_t *)name;
-    adv_fields.name_len = strlen(name);
-    adv_fields.name_is_complete = 1;
+/**
+ * @brief Drop a received packet
+ * @param chn Channel number (1 or 2)
+ * @return ATT error code
+ */
+int CBTTask::rxDrop(uint16_t chn)
+{
+    mRxDrops++;
+    BT_METRICS(mMetrics.rxDropped((chn == 2) ? EBTChannel::Second : EBTChannel::Main));
+    if ((mRxDrops & 0xff) == 1)
+        TRACE_WARNING("BLE Rx: packet dropped", mRxDrops);
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
+}
 
-    // Set the service UUID
-    ble_uuid16_t t[1] = {BLE_UUID16_INIT(BLE_SVC_SPP_UUID16)};
-    adv_fields.uuids16 = t;
-    adv_fields.num_uuids16 = 1;
+/**
+ * @brief GATT characteristic access event handler (channel 1)
+ * @param conn_handle Connection identifier
+ * @param attr_handle Attribute identifier
+ * @param ctxt Access context
+ * @param arg Additional arguments
+ * @return Error code
+ */
+int CBTTask::ble_svc_gatt_handler(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    int rc = 0;
+    switch (ctxt->op)
+    {
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        // Handle write operation to the characteristic
+        rc = gatt_svr_chr_write(conn_handle, ctxt->om);
+        return rc;
+    default:
+        return BLE_ATT_ERR_UNLIKELY; // Unknown operation
+    }
+    return 0;
+}
+
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+/**
+ * @brief GATT characteristic access event handler (channel 2)
+ * @param conn_handle Connection identifier
+ * @param attr_handle Attribute identifier
+ * @param ctxt Access context
+ * @param arg Additional arguments
+ * @return Error code
+ */
+int CBTTask::ble_svc_gatt_handler2(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    int rc = 0;
+    switch (ctxt->op)
+    {
+    case BLE_GATT_ACCESS_OP_WRITE_CHR:
+        // Handle write operation to the second characteristic
+        rc = gatt_svr_chr_write(conn_handle, ctxt->om, 2);
+        return rc;
+    default:
+        return BLE_ATT_ERR_UNLIKELY; // Unknown operation
+    }
+    return 0;
+}
+#endif
+
+#ifdef CONFIG_BLE_DATA_RX_ACK
+/**
+ * @brief Acknowledgement characteristic access event handler
+ * @param conn_handle Connection identifier
+ * @param attr_handle Attribute identifier
+ * @param ctxt Access context
+ * @param arg Additional arguments
+ * @return Error code
+ */
+int CBTTask::ble_svc_gatt_ack_handler(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
+{
+    uint8_t data[4];
+    switch (ctxt->op)
+    {
+    case BLE_GATT_ACCESS_OP_READ_CHR:
+        // Current delivered packet counters
+        CBTTask::Instance()->rxAckData(data);
+        return (os_mbuf_append(ctxt->om, data, sizeof(data)) == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+    default:
+        return BLE_ATT_ERR_UNLIKELY; // Unknown operation
+    }
+}
+
+/**
+ * @brief Fill the acknowledgement value
+ * @param data Receives the delivered packet counters of both channels (little-endian)
+ */
+void CBTTask::rxAckData(uint8_t *data)
+{
+    data[0] = (uint8_t)mRxCount[0];
+    data[1] = (uint8_t)(mRxCount[0] >> 8);
+    data[2] = (uint8_t)mRxCount[1];
+    data[3] = (uint8_t)(mRxCount[1] >> 8);
+}
+
+/**
+ * @brief Count a packet delivered to the application
+ *
+ * Every CONFIG_BLE_DATA_RX_ACK_EVERY packets the counters are notified.
+ *
+ * @param chn Channel number (1 or 2)
+ */
+void CBTTask::rxAck(uint16_t chn)
+{
+    mRxCount[chn - 1]++;
+    if (++mRxUnacked >= CONFIG_BLE_DATA_RX_ACK_EVERY)
+        rxAckSend();
+}
+
+/**
+ * @brief Notify the delivered packet counters
+ *
+ * The counters are shared by all connections, since received packets are
+ * not tagged with their connection, and every connection is notified of
+ * the total. The counters are cumulative, so a notification lost for lack of mbufs
+ * is covered by the next one. Like the data notifications it waits for
+ * txReady(), so the mbufs reserved for the host are never taken; the
+ * counters stay unacknowledged and are sent by a later call.
+ */
+void CBTTask::rxAckSend()
+{
+    uint8_t data[4];
+    struct os_mbuf *om;
+
+    if (!mConnect || !txReady())
+        return;
+    rxAckData(data);
+    om = ble_hs_mbuf_from_flat(data, sizeof(data));
+    if ((om != nullptr) && (notify(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_ack_val_handle, om) == 0))
+        mRxUnacked = 0;
+}
+#endif
+
+// Pointer to the single instance of the class
+CBTTask *CBTTask::theSingleInstance = nullptr;
+
+#ifdef CONFIG_BLE_DATA_POOL
+// Message body pools
+CBlockPool *CBTTask::mPool = nullptr;
+#endif
+
+/**
+ * @brief Get the single instance of the class (Singleton)
+ * @return Pointer to the CBTTask instance
+ */
+CBTTask *CBTTask::Instance()
+{
+    if (theSingleInstance == nullptr)
+    {
+        // Create a new instance if it doesn't exist yet
+        theSingleInstance = new CBTTask();
+        // Initialize the base task
+        theSingleInstance->CBaseTask::init(BTTASK_NAME, BTTASK_STACKSIZE, BTTASK_PRIOR, BTTASK_LENGTH, BTTASK_CPU);
+    }
+    return theSingleInstance;
+};
+
+/**
+ * @brief Free resources and delete the instance
+ */
+void CBTTask::free()
+{
+    if (theSingleInstance != nullptr)
+    {
+        // Send a command to terminate the task
+        theSingleInstance->sendCmd(MSG_END_TASK);
+        // Wait for the task to finish
+        do
+        {
+            vTaskDelay(1);
+        }
+#if (INCLUDE_vTaskDelete == 1)
+        while (theSingleInstance->mTaskHandle != nullptr);
+#else
+        while (theSingleInstance->mTaskQueue != nullptr);
+#endif
+        // Delete the instance
+        delete theSingleInstance;
+        theSingleInstance = nullptr;
+    }
+}
+
+/**
+ * @brief Constructor for the class
+ */
+CBTTask::CBTTask() : CBaseTask(), CLock()
+{
+    // Initialize class members with default values
+    mManufacturerData = nullptr;
+    mManufacturerDataSize = 0;
+    mMode = EBTMode::Off;
+    mConnect = false;
+    mOnRx = nullptr;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    mOnRx2 = nullptr;
+#endif
+    mOnConnect = nullptr;
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+    mOnBeacon = nullptr;
+    mBeaconTimer = nullptr;
+    mBeaconSleep = false;
+    mBeaconSleepTime = 0;
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_TX
+    mBeaconTx = 0;
+    mBeaconMajor = 0;
+    mBeaconMinor = 0;
+#endif
+#ifdef CONFIG_BLE_DATA_FRAMED
+    for (auto &conn : mConn)
+        conn.rxFrame.msgBody = nullptr;
+#endif
+#ifdef CONFIG_BLE_DATA_COALESCE
+    mCoalesce.msgBody = nullptr;
+#endif
+#ifdef CONFIG_BLE_DATA_TX_RING
+    mTxRing = new CRingBuffer(CONFIG_BLE_DATA_TX_RING_SIZE);
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    mTxRing2 = new CRingBuffer(CONFIG_BLE_DATA_TX_RING_SIZE);
+#endif
+    mTxRoom[0] = xSemaphoreCreateBinary();
+    mTxRoom[1] = xSemaphoreCreateBinary();
+#endif
+#ifdef CONFIG_BLE_DATA_RX_RING
+    mRxRing = new CRingBuffer(CONFIG_BLE_DATA_RX_RING_SIZE);
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+    mBatch[0] = new SScanRecord[CONFIG_BLE_DATA_SCAN_BATCH_SIZE];
+    mBatch[1] = new SScanRecord[CONFIG_BLE_DATA_SCAN_BATCH_SIZE];
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+    mAdvFilter = new CAdvFilter();
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+    mRpa = new CRpaResolver(CONFIG_BLE_DATA_SCAN_RPA_CACHE, CONFIG_BT_NIMBLE_MAX_BONDS);
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    mDedup = new CScanDedup(CONFIG_BLE_DATA_SCAN_DEDUP_SIZE, CONFIG_BLE_DATA_SCAN_DEDUP_WINDOW, CONFIG_BLE_DATA_SCAN_DEDUP_RSSI);
+#endif
+    mDataQueue = xQueueCreate(BTTASK_DATALENGTH, sizeof(STaskMessage));
+#ifdef CONFIG_BLE_DATA_POOL
+    if (mPool == nullptr)
+    {
+        // Kept after free(): the application may still hold beacon reports
+        static const uint16_t sizes[] = {32, 64, 256, 512};
+        static const uint16_t counts[] = {CONFIG_BLE_DATA_POOL_32, CONFIG_BLE_DATA_POOL_64,
+                                          CONFIG_BLE_DATA_POOL_256, CONFIG_BLE_DATA_POOL_512};
+#ifdef CONFIG_BLE_DATA_POOL_PSRAM
+        mPool = new CBlockPool(sizes, counts, 4, true);
+#else
+        mPool = new CBlockPool(sizes, counts, 4, false);
+#endif
+    }
+#endif
+}
+
+/**
+ * @brief Destructor for the class
+ */
+CBTTask::~CBTTask()
+{
+#ifdef CONFIG_BLE_DATA_TX_RING
+    delete mTxRing;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    delete mTxRing2;
+#endif
+    vSemaphoreDelete(mTxRoom[0]);
+    vSemaphoreDelete(mTxRoom[1]);
+#endif
+#ifdef CONFIG_BLE_DATA_RX_RING
+    delete mRxRing;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+    delete[] mBatch[0];
+    delete[] mBatch[1];
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+    delete mAdvFilter;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    delete mDedup;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+    delete mRpa;
+#endif
+    vQueueDelete(mDataQueue);
+}
+
+/**
+ * @brief BLE stack reset handler
+ * @param reason Reason for the reset
+ */
+void CBTTask::ble_on_reset(int reason)
+{
+    ESP_LOGW(TAG, "Resetting state; reason=%d\n", reason);
+}
+
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+/**
+ * @brief Synchronization handler for iBeacon scanning mode
+ */
+void CBTTask::ble_on_sync_rx()
+{
+    ESP_LOGD(TAG, "BLE rx");
+    int rc;
+
+    /* Ensure the correct device address is set (preferably public) */
+    rc = ble_hs_util_ensure_addr(0);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error ble_hs_util_ensure_addr; rc=%d", rc);
+        return;
+    }
+
+    /* Start scanning to find peripheral devices */
+    ble_scan();
+}
+
+/**
+ * @brief Start BLE device scanning
+ */
+void CBTTask::ble_scan()
+{
+    uint8_t own_addr_type; // Type of the own device address
+    int rc;
+
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+    /* Discovery is stopped: pick up bonds added since the last scan */
+    CBTTask::Instance()->mRpa->load();
+#endif
+
+    /* Determine the address type to use for advertising (without privacy) */
+    rc = ble_hs_id_infer_auto(0, &own_addr_type);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error determining address type; rc=%d", rc);
+        return;
+    }
+
+#ifdef CONFIG_BT_NIMBLE_EXT_ADV
+    // Extended scanning parameters
+    struct ble_gap_ext_disc_params disc_params;
+    disc_params.passive = 1; // Passive scanning
+
+    /* Runtime timing, 0 - controller default */
+    disc_params.itvl = CBTTask::Instance()->mScanItvl;
+    disc_params.window = CBTTask::Instance()->mScanWindow;
+
+    // Start extended scanning
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    uint8_t filter_duplicates = 0; // Repeats are suppressed by the host with an RSSI threshold
+#else
+    uint8_t filter_duplicates = 1;
+#endif
+    rc = ble_gap_ext_disc(own_addr_type, 0, 0, filter_duplicates, scanAcceptApply(), 0,
+                          &disc_params, &disc_params, ble_rx_gap_event, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "Error initiating extended discovery; rc=%d", rc);
+    }
+    else
+        BT_METRICS(CBTTask::Instance()->mMetrics.scanning());
+
+#else
+    // Standard scanning parameters
+    struct ble_gap_disc_params disc_params;
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    /* Repeats are suppressed by the host with an RSSI threshold */
+    disc_params.filter_duplicates = 0;
+#else
+    /* Filter duplicates - do not process repeated advertisements from one device */
+    disc_params.filter_duplicates = 1;
+#endif
+
+    /**
+     * Perform passive scanning. I.e., do not send scan requests
+     * to each advertiser.
+     */
+    disc_params.passive = 1;
+
+    /* Runtime timing, 0 - controller default */
+    disc_params.itvl = CBTTask::Instance()->mScanItvl;
+    disc_params.window = CBTTask::Instance()->mScanWindow;
+    disc_params.filter_policy = scanAcceptApply();
+    disc_params.limited = 0;
+
+    // Start standard scanning
+    rc = ble_gap_disc(own_addr_type, BLE_HS_FOREVER, &disc_params,
+                      ble_rx_gap_event, NULL);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "Error initiating GAP discovery procedure; rc=%d", rc);
+    }
+    else
+        BT_METRICS(CBTTask::Instance()->mMetrics.scanning());
+#endif
+}
+
+/**
+ * @brief Load the filter accept list into the controller
+ *
+ * The list can only be changed while discovery is stopped.
+ *
+ * @return Scan filter policy for the discovery parameters
+ */
+uint8_t CBTTask::scanAcceptApply()
+{
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+    CBTTask *bt = CBTTask::Instance();
+    if (bt->mAcceptCount != 0)
+    {
+        int rc = ble_gap_wl_set(bt->mAccept, bt->mAcceptCount);
+        if (rc == 0)
+            return BLE_HCI_SCAN_FILT_USE_WL;
+        ESP_LOGE(TAG, "error ble_gap_wl_set; rc=%d", rc);
+    }
+#endif
+    return BLE_HCI_SCAN_FILT_NO_WL;
+}
+
+/**
+ * @brief Pass a scan report to the task
+ *
+ * Called in the NimBLE host task.
+ *
+ * @param beacon iBeacon data or nullptr
+ * @param mac Device MAC address or nullptr
+ */
+void CBTTask::scanReport(const SBeacon *beacon, const SMac *mac)
+{
+    CBTTask *bt = CBTTask::Instance();
+    STaskMessage msg;
+
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+    if (bt->mOnBatch != nullptr)
+    {
+        bt->scanAppend(beacon, mac);
+        return;
+    }
+#endif
+    if (beacon != nullptr)
+        std::memcpy(allocBody(&msg, MSG_BEACON_DATA, sizeof(SBeacon), BT_POOL_SCAN), beacon, sizeof(SBeacon));
+    else
+        std::memcpy(allocBody(&msg, MSG_MAC_DATA, sizeof(SMac), BT_POOL_SCAN), mac, sizeof(SMac));
+    // The data lane keeps reports from delaying commands; the host task does not wait for room
+    if (!bt->postData(&msg, 0, true))
+        BT_METRICS(bt->mMetrics.dropped(EBTChannel::Scan));
+}
+
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+/**
+ * @brief Append a scan report to the batch being filled
+ *
+ * Called in the NimBLE host task. The record is copied inside the critical
+ * section, so scanFlush() never hands out a half-written record.
+ *
+ * @param beacon iBeacon data or nullptr
+ * @param mac Device MAC address or nullptr
+ */
+void CBTTask::scanAppend(const SBeacon *beacon, const SMac *mac)
+{
+    SScanRecord *rec = nullptr;
+    uint16_t n = 0;
+
+    portENTER_CRITICAL(&mBatchMux);
+    if (mBatchCount < CONFIG_BLE_DATA_SCAN_BATCH_SIZE)
+    {
+        rec = &mBatch[mBatchFill][mBatchCount];
+        n = ++mBatchCount;
+        rec->isBeacon = (beacon != nullptr);
+        if (beacon != nullptr)
+            rec->beacon = *beacon;
+        else
+            rec->mac = *mac;
+    }
+    portEXIT_CRITICAL(&mBatchMux);
+
+    if (rec == nullptr)
+    {
+        BT_METRICS(mMetrics.dropped(EBTChannel::Scan));
+        return;
+    }
+    if (n == 1)
+        mBatchTimer->start(this, ETimerEvent::SendBack, CONFIG_BLE_DATA_SCAN_BATCH_TIME);
+    if ((n == CONFIG_BLE_DATA_SCAN_BATCH_SIZE) && !mBatchBell.exchange(true))
+    {
+        // If the queue is full the batch goes out with the timer
+        if (!sendCmd(MSG_SCAN_BATCH, 0, 0, 0))
+            mBatchBell.store(false);
+    }
+}
+
+/**
+ * @brief Deliver the collected scan reports
+ *
+ * The host task goes on filling the other buffer while the callback runs.
+ * The batch timer is stopped, so a flush triggered by the batch size does
+ * not leave it running to cut the next batch short.
+ */
+void CBTTask::scanFlush()
+{
+    SScanRecord *batch;
+    uint16_t n;
+
+    mBatchBell.store(false);
+    // Stopped before the swap: the first record of the next batch starts it again
+    mBatchTimer->stop();
+    portENTER_CRITICAL(&mBatchMux);
+    batch = mBatch[mBatchFill];
+    n = mBatchCount;
+    mBatchFill ^= 1;
+    mBatchCount = 0;
+    portEXIT_CRITICAL(&mBatchMux);
+    if ((n != 0) && (mOnBatch != nullptr))
+        mOnBatch(batch, n);
+}
+#endif
+
+/**
+ * @brief Make the MAC report of an advertiser
+ *
+ * Random addresses are classified by their two most significant bits.
+ * A resolvable private address of a bonded peer is replaced by its
+ * identity address.
+ *
+ * @param addr Advertiser address
+ * @param rssi RSSI
+ * @param mac Receives the report
+ * @param any Report every address kind, the caller has already selected the device
+ * @return true if the address is reported
+ */
+bool CBTTask::scanMac(const ble_addr_t *addr, int8_t rssi, SMac *mac, bool any)
+{
+    std::memcpy(mac->mac.data(), addr->val, 6);
+    mac->rssi = rssi;
+    mac->type = addr->type;
+#ifdef CONFIG_BLE_DATA_SCAN_RANDOM
+    CBTTask *bt = CBTTask::Instance();
+    uint8_t kind;
+
+    switch (addr->type)
+    {
+    case BLE_ADDR_PUBLIC:
+    case BLE_ADDR_PUBLIC_ID:
+        kind = SCAN_ADDR_PUBLIC;
+        break;
+    case BLE_ADDR_RANDOM_ID:
+        kind = SCAN_ADDR_STATIC; // Resolved by the controller
+        break;
+    default:
+        switch (addr->val[5] >> 6)
+        {
+        case 0:
+            kind = SCAN_ADDR_NRPA;
+            break;
+        case 1:
+            kind = SCAN_ADDR_RPA;
+            break;
+        case 3:
+            kind = SCAN_ADDR_STATIC;
+            break;
+        default:
+            return false; // Reserved
+        }
+        break;
+    }
+    if (!any && !(bt->mScanAddr & kind))
+        return false;
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+    ble_addr_t id;
+    if ((kind == SCAN_ADDR_RPA) && bt->mRpa->resolve(addr->val, &id))
+    {
+        std::memcpy(mac->mac.data(), id.val, 6);
+        mac->type = (id.type == BLE_ADDR_PUBLIC) ? BLE_ADDR_PUBLIC_ID : BLE_ADDR_RANDOM_ID;
+    }
+#endif
+    return true;
+#else
+    return any || (addr->type == BLE_ADDR_PUBLIC);
+#endif
+}
+
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+/**
+ * @brief Suppress a repeated report
+ *
+ * Called in the NimBLE host task before the report is filtered or parsed.
+ *
+ * @param addr Advertiser address
+ * @param data Raw advertising data
+ * @param len Data length
+ * @param rssi RSSI
+ * @return true if the report is new or changed
+ */
+bool CBTTask::scanDedup(const ble_addr_t *addr, const uint8_t *data, uint8_t len, int8_t rssi)
+{
+    CBTTask *bt = CBTTask::Instance();
+    if (bt->mDedup->check(addr->val, addr->type, data, len, rssi, (uint32_t)(esp_timer_get_time() / 1000)))
+        return true;
+    BT_METRICS(bt->mMetrics.suppressed());
+    return false;
+}
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+/**
+ * @brief Apply the rule table to a report
+ *
+ * Called in the NimBLE host task on the raw advertising data, before it is
+ * parsed and before anything is allocated.
+ *
+ * @param data Raw advertising data
+ * @param len Data length
+ * @param addr Advertiser address
+ * @param rssi RSSI
+ * @return true if the report was handled by the rules
+ */
+bool CBTTask::scanFilter(const uint8_t *data, uint8_t len, const ble_addr_t *addr, int8_t rssi)
+{
+    CAdvFilter *filter = CBTTask::Instance()->mAdvFilter;
+    SAdvMatch res;
+
+    if (!filter->isActive())
+        return false;
+    filter->match(data, len, addr->type, rssi, &res);
+    switch (res.action)
+    {
+    case EAdvAction::Beacon:
+    {
+        SBeacon beacon;
+        std::memcpy(beacon.uuid.data(), res.id, 16);
+        beacon.major = res.major;
+        beacon.minor = res.minor;
+        beacon.power = res.power;
+        beacon.rssi = rssi;
+        scanReport(&beacon, nullptr);
+        break;
+    }
+    case EAdvAction::Mac:
+    {
+        SMac mac;
+        if (scanMac(addr, rssi, &mac, true))
+            scanReport(nullptr, &mac);
+        break;
+    }
+    default:
+        break;
+    }
+    return true;
+}
+#endif
+
+/**
+ * @brief GAP event handler for scanning
+ * @param event GAP event
+ * @param arg Additional arguments
+ * @return Return code
+ */
+int CBTTask::ble_rx_gap_event(struct ble_gap_event *event, void *arg)
+{
+    struct ble_hs_adv_fields fields; // Advertising data fields
+    int rc;
+    SBeacon beacon; // Structure for iBeacon data
+    SMac mac;       // Structure for MAC address
+
+    switch (event->type)
+    {
+    case BLE_GAP_EVENT_DISC_COMPLETE:
+        // Scanning completed
+        return 0;
+
+#ifdef CONFIG_BT_NIMBLE_EXT_ADV
+    case BLE_GAP_EVENT_EXT_DISC:
+        // Extended device discovery
+        BT_METRICS(CBTTask::Instance()->mMetrics.received(EBTChannel::Scan, event->ext_disc.length_data));
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+        if (!scanDedup(&event->ext_disc.addr, event->ext_disc.data, event->ext_disc.length_data, event->ext_disc.rssi))
+            return 0;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+        if (scanFilter(event->ext_disc.data, event->ext_disc.length_data, &event->ext_disc.addr, event->ext_disc.rssi))
+            return 0;
+#endif
+        if (event->ext_disc.legacy_event_type == BLE_HCI_ADV_RPT_EVTYPE_NONCONN_IND)
+        {
+            // Parse advertising fields
+            rc = ble_hs_adv_parse_fields(&fields, event->ext_disc.data,
+                                         event->ext_disc.length_data);
+            if (rc == 0)
+            {
+                // Check if the device is an iBeacon
+                if ((fields.mfg_data_len == 25) && (fields.mfg_data[0] == 0x4c) && (fields.mfg_data[1] == 0) && (fields.mfg_data[2] == 0x02) && (fields.mfg_data[3] == 0x15))
+                {
+                    // Report iBeacon data
+                    std::memcpy(beacon.uuid.data(), &fields.mfg_data[4], 16);       // Copy UUID
+                    beacon.major = fields.mfg_data[21] + fields.mfg_data[20] * 256; // Major
+                    beacon.minor = fields.mfg_data[23] + fields.mfg_data[22] * 256; // Minor
+                    beacon.power = fields.mfg_data[24];                             // Power
+                    beacon.rssi = event->ext_disc.rssi;                             // RSSI
+                    scanReport(&beacon, nullptr);
+                    return 0;
+                }
+            }
+        }
+        // Process device MAC addresses
+        if (scanMac(&event->ext_disc.addr, event->ext_disc.rssi, &mac, false))
+            scanReport(nullptr, &mac);
+        return 0;
+#else
+    case BLE_GAP_EVENT_DISC:
+        // Standard device discovery
+        BT_METRICS(CBTTask::Instance()->mMetrics.received(EBTChannel::Scan, event->disc.length_data));
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+        if (!scanDedup(&event->disc.addr, event->disc.data, event->disc.length_data, event->disc.rssi))
+            return 0;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+        if (scanFilter(event->disc.data, event->disc.length_data, &event->disc.addr, event->disc.rssi))
+            return 0;
+#endif
+        // ESP_LOGW(TAG,"rssi %d, type %d",event->disc.rssi, event->disc.event_type);
+        if (CBTTask::Instance()->mBeaconFilter)
+        {
+            // Parse advertising fields
+            rc = ble_hs_adv_parse_fields(&fields, event->disc.data,
+                                         event->disc.length_data);
+            if (rc == 0)
+            {
+                // ESP_LOG_BUFFER_HEX("mfg", fields.mfg_data, fields.mfg_data_len);
+                // Check if the device is an iBeacon
+                if ((fields.mfg_data_len == 25) && (fields.mfg_data[0] == 0x4c) && (fields.mfg_data[1] == 0) && (fields.mfg_data[2] == 0x02) && (fields.mfg_data[3] == 0x15))
+                {
+                    // Report iBeacon data
+                    std::memcpy(beacon.uuid.data(), &fields.mfg_data[4], 16);       // Copy UUID
+                    beacon.major = fields.mfg_data[21] + fields.mfg_data[20] * 256; // Major
+                    beacon.minor = fields.mfg_data[23] + fields.mfg_data[22] * 256; // Minor
+                    beacon.power = fields.mfg_data[24];                             // Power
+                    beacon.rssi = event->disc.rssi;                                 // RSSI
+                    scanReport(&beacon, nullptr);
+                    return 0;
+                }
+            }
+        }
+        // Process device MAC addresses
+        if (scanMac(&event->disc.addr, event->disc.rssi, &mac, false))
+            scanReport(nullptr, &mac);
+        return 0;
+#endif
+
+    default:
+        return 0;
+    }
+}
+#endif
+
+#ifdef CONFIG_BLE_DATA_IBEACON_TX
+/**
+ * @brief Synchronization handler for iBeacon transmission mode
+ */
+void CBTTask::ble_on_sync_beacon()
+{
+    ESP_LOGD(TAG, "BLE sync beacon");
+    /* Generate a non-resolvable private address */
+    ble_app_set_addr();
+    /* Start advertising indefinitely */
+    ble_advertise_beacon();
+}
+
+/**
+ * @brief Set the BLE device address
+ */
+void CBTTask::ble_app_set_addr()
+{
+    ble_addr_t addr; // Address structure
+    int rc;
+
+    // Generate a random address
+    rc = ble_hs_id_gen_rnd(1, &addr);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error ble_hs_id_gen_rnd; rc=%d", rc);
+        return;
+    }
+
+    // Set the random address
+    rc = ble_hs_id_set_rnd(addr.val);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error ble_app_set_addr; rc=%d", rc);
+        return;
+    }
+}
+
+/**
+ * @brief Start iBeacon advertising
+ */
+void CBTTask::ble_advertise_beacon()
+{
+    struct ble_gap_adv_params adv_params; // Advertising parameters
+    int rc;
+
+    // Set the advertising data for iBeacon
+    rc = ble_ibeacon_set_adv_data(CBTTask::Instance()->mBeaconID,
+                                  CBTTask::Instance()->mBeaconMajor,
+                                  CBTTask::Instance()->mBeaconMinor,
+                                  CBTTask::Instance()->mBeaconTx);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error setting advertisement iBeacon; rc=%d", rc);
+        return;
+    }
+
+    /* Start advertising */
+    adv_params = (struct ble_gap_adv_params){0};
+    rc = ble_gap_adv_start(BLE_OWN_ADDR_RANDOM, nullptr, BLE_HS_FOREVER,
+                           &adv_params, nullptr, nullptr);
+    if (rc == 0)
+        ESP_LOGD(TAG, "iBeacon advertisement started");
+    else
+        ESP_LOGE(TAG, "error setting advertisement iBeacon; rc=%d", rc);
+}
+#endif
+
+/**
+ * @brief GAP event handler for the data server
+ * @param event GAP event
+ * @param arg Additional arguments
+ * @return Return code
+ */
+int CBTTask::ble_server_gap_event(struct ble_gap_event *event, void *arg)
+{
+    switch (event->type)
+    {
+    case BLE_GAP_EVENT_CONNECT:
+        // Connection event
+        if (event->connect.status != 0)
+        {
+            ESP_LOGW(TAG, "Connection failed");
+            /* Connection failed - resume advertising */
+            advertiseResume();
+        }
+        else
+        {
+            ESP_LOGI(TAG, "Connection established; handle=%d", event->connect.conn_handle);
+            CBTTask::Instance()->lock();
+            bool added = CBTTask::Instance()->connAdd(event->connect.conn_handle);
+            uint8_t n = CBTTask::Instance()->mConnCount;
+            CBTTask::Instance()->unlock();
+            if (!added)
+            {
+                ble_gap_terminate(event->connect.conn_handle, BLE_ERR_CONN_LIMIT);
+                return 0;
+            }
+            // The table is only changed in this task
+            CBTTask::Instance()->linkNegotiate(CBTTask::Instance()->connFind(event->connect.conn_handle));
+            BT_METRICS(CBTTask::Instance()->mMetrics.connected());
+            // Call the connection callback
+            if (CBTTask::Instance()->mOnConnect != nullptr)
+                CBTTask::Instance()->mOnConnect(true);
+            // Keep advertising for more centrals
+            if (n < CONFIG_BLE_DATA_MAX_CONNECTIONS)
+                advertiseResume();
+        }
+        return 0;
+
+    case BLE_GAP_EVENT_DISCONNECT:
+        // Disconnection event
+        ESP_LOGW(TAG, "disconnect; reason=%d", event->disconnect.reason);
+        CBTTask::Instance()->lock();
+        CBTTask::Instance()->connRemove(event->disconnect.conn.conn_handle);
+        CBTTask::Instance()->unlock();
+        BT_METRICS(CBTTask::Instance()->mMetrics.disconnected());
+        // Call the disconnection callback
+        if (CBTTask::Instance()->mOnConnect != nullptr)
+            CBTTask::Instance()->mOnConnect(false);
+        advertiseResume(); // Resume advertising
+        return 0;
+
+    case BLE_GAP_EVENT_MTU:
+        // MTU exchange completed
+        ESP_LOGI(TAG, "mtu update; handle=%d mtu=%d", event->mtu.conn_handle, event->mtu.value);
+        CBTTask::Instance()->lock();
+        if (SBTConn *conn = CBTTask::Instance()->connFind(event->mtu.conn_handle))
+        {
+            conn->mtu = event->mtu.value;
+            CBTTask::Instance()->connMtu();
+        }
+        CBTTask::Instance()->unlock();
+        CBTTask::Instance()->linkReport(event->mtu.conn_handle);
+        return 0;
+
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        ESP_LOGI(TAG, "phy update; handle=%d tx=%d rx=%d", event->phy_updated.conn_handle,
+                 event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        CBTTask::Instance()->linkReport(event->phy_updated.conn_handle);
+        return 0;
+
+    case BLE_GAP_EVENT_CONN_UPDATE:
+        ESP_LOGI(TAG, "connection update; handle=%d status=%d", event->conn_update.conn_handle, event->conn_update.status);
+        if (event->conn_update.status == 0)
+        {
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+            CBTTask::Instance()->adaptSync(event->conn_update.conn_handle);
+#endif
+            CBTTask::Instance()->linkReport(event->conn_update.conn_handle);
+        }
+        return 0;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Start data advertising
+ */
+void CBTTask::ble_advertise_data()
+{
+#ifdef CONFIG_BT_NIMBLE_EXT_ADV
+    int rc;
+    struct ble_gap_ext_adv_params params; // Extended advertising parameters
+    struct ble_hs_adv_fields adv_fields;  // Advertising data fields
+    struct os_mbuf *data;                 // Buffer for advertising data
+
+    /* Set a random (NRPA) address for the instance */
+    if (CBTTask::Instance()->mAddr.type == 0)
+    {
+        rc = ble_hs_id_gen_rnd(1, &(CBTTask::Instance()->mAddr));
+        assert(rc == 0);
+    }
+
+    /* For periodic advertising, use the instance with non-connectable advertising */
+    memset(&params, 0, sizeof(params));
+
+    /* Advertise using a random address */
+    params.own_addr_type = BLE_OWN_ADDR_RANDOM;
+    params.primary_phy = BLE_HCI_LE_PHY_1M;
+    params.secondary_phy = BLE_HCI_LE_PHY_2M;
+    params.sid = 1;
+    params.connectable = 1; // Connectable advertising
+
+    const char *name = ble_svc_gap_device_name(); // Get the device name
+
+    CBTTask::Instance()->lock();
+    int size = (CBTTask::Instance()->mManufacturerDataSize + strlen(name));
+    // Allocate buffer for advertising data
+    if (size > 20)
+    {
+        data = os_msys_get_pkthdr(size + (BLE_HS_ADV_MAX_SZ - 20), 0);
+    }
+    else
+    {
+        data = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
+        params.scannable = 1;
+        params.legacy_pdu = 1;
+    }
+    assert(data);
+
+    /* Configure instance 1 */
+    rc = ble_gap_ext_adv_configure(1, &params, NULL, CBTTask::ble_server_gap_event, NULL);
+    assert(rc == 0);
+
+    rc = ble_gap_ext_adv_set_addr(1, &(CBTTask::Instance()->mAddr));
+    assert(rc == 0);
+
+    memset(&adv_fields, 0, sizeof(adv_fields));
+
+    /* Advertise two flags:
+     *     o Discoverability in subsequent advertising (general)
+     *     o BLE only (BR/EDR not supported).
+     */
+    adv_fields.flags = BLE_HS_ADV_F_DISC_GEN |
+                       BLE_HS_ADV_F_BREDR_UNSUP;
+
+    adv_fields.name = (const uint8_t *)name;
+    adv_fields.name_len = strlen(name);
+    adv_fields.name_is_complete = 1;
+
+    // Set the service UUID
+    ble_uuid16_t t[1] = {BLE_UUID16_INIT(BLE_SVC_SPP_UUID16)};
+    adv_fields.uuids16 = t;
+    adv_fields.num_uuids16 = 1;
     adv_fields.uuids16_is_complete = 1;
 
-    // Set the manufacturer data
-    adv_fields.mfg_data = CBTTask::Instance()->mManufacturerData;
-    adv_fields.mfg_data_len = CBTTask::Instance()->mManufacturerDataSize;
+    // Set the manufacturer data
+    adv_fields.mfg_data = CBTTask::Instance()->mManufacturerData;
+    adv_fields.mfg_data_len = CBTTask::Instance()->mManufacturerDataSize;
+
+    rc = ble_hs_adv_set_fields_mbuf(&adv_fields, data);
+    CBTTask::Instance()->unlock();
+    assert(rc == 0);
+
+    rc = ble_gap_ext_adv_set_data(1, data);
+    assert(rc == 0);
+
+    /* Start advertising */
+    rc = ble_gap_ext_adv_start(1, 0, 0);
+    assert(rc == 0);
+    BT_METRICS(CBTTask::Instance()->mMetrics.advertising());
+#else
+    // Standard advertising
+    struct ble_gap_adv_params adv_params;
+    struct ble_hs_adv_fields fields;
+    const char *name;
+    int rc;
+
+    name = ble_svc_gap_device_name();
+    CBTTask::Instance()->lock();
+    bool compact = (CBTTask::Instance()->mManufacturerDataSize + strlen(name)) > 16;
+    struct ble_hs_adv_fields scan_response_fields;
+    memset(&scan_response_fields, 0, sizeof scan_response_fields);
+
+    /**
+     *  Set the advertising data:
+     *     o Flags (indicate the type of advertising and other general info).
+     *     o Transmission power level.
+     *     o Device name.
+     *     o 16-bit service UUIDs.
+     */
+
+    memset(&fields, 0, sizeof fields);
+
+    /* Advertise two flags:
+     *     o Discoverability in subsequent advertising (general)
+     *     o BLE only (BR/EDR not supported).
+     */
+    fields.flags = BLE_HS_ADV_F_DISC_GEN |
+                   BLE_HS_ADV_F_BREDR_UNSUP;
+
+    /* Indicate that the transmission power level field should be included */
+    fields.tx_pwr_lvl_is_present = 1;
+    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
+
+    fields.name = (uint8_t *)name;
+    if (compact && (strlen(name) > 11))
+    {
+        // Compact name in main advertisement
+        fields.name_len = 11;
+        fields.name_is_complete = 0;
+
+        // Full name in scan response
+        scan_response_fields.name = (uint8_t *)name;
+        scan_response_fields.name_len = strlen(name);
+        scan_response_fields.name_is_complete = 1;
+    }
+    else
+    {
+        fields.name_len = strlen(name);
+        fields.name_is_complete = 1;
+    }
+
+    // Set the service UUID
+    ble_uuid16_t t[1] = {BLE_UUID16_INIT(BLE_SVC_SPP_UUID16)};
+    fields.uuids16 = t;
+    fields.num_uuids16 = 1;
+    fields.uuids16_is_complete = 1;
+
+    fields.mfg_data = CBTTask::Instance()->mManufacturerData;
+    if (compact)
+    {
+        // Compact manufacturer data
+        fields.mfg_data_len = 5;
+        scan_response_fields.mfg_data = CBTTask::Instance()->mManufacturerData;
+        scan_response_fields.name_len = CBTTask::Instance()->mManufacturerDataSize;
+
+        rc = ble_gap_adv_rsp_set_fields(&scan_response_fields);
+        if (rc != 0)
+        {
+            ESP_LOGE(TAG, "error setting response data; rc=%d", rc);
+        }
+    }
+    else
+    {
+        fields.mfg_data_len = CBTTask::Instance()->mManufacturerDataSize;
+    }
+
+    rc = ble_gap_adv_set_fields(&fields);
+    CBTTask::Instance()->unlock();
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error setting advertisement data; rc=%d", rc);
+        return;
+    }
+
+    /* Start advertising */
+    memset(&adv_params, 0, sizeof adv_params);
+    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND; // Undirected advertising
+    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN; // General discovery
+    rc = ble_gap_adv_start(CBTTask::Instance()->own_addr_type, nullptr, BLE_HS_FOREVER,
+                           &adv_params, ble_server_gap_event, nullptr);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error enabling advertisement; rc=%d", rc);
+        return;
+    }
+    ESP_LOGD(TAG, "Data advertisement started");
+    BT_METRICS(CBTTask::Instance()->mMetrics.advertising());
+#endif
+}
+
+/**
+ * @brief Synchronization handler for data transmission mode
+ */
+void CBTTask::ble_on_sync_data()
+{
+    int rc;
+
+    // Ensure the address is set correctly
+    rc = ble_hs_util_ensure_addr(0);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error ble_hs_util_ensure_addr ; rc=%d", rc);
+        return;
+    }
+
+    /* Determine the address type to use for advertising */
+    rc = ble_hs_id_infer_auto(0, &CBTTask::Instance()->own_addr_type);
+    if (rc != 0)
+    {
+        ESP_LOGE(TAG, "error determining address type; rc=%d", rc);
+        return;
+    }
+
+    /* Start data advertising */
+    ble_advertise_data();
+}
 
-    rc = ble_hs_adv_set_fields_mbuf(&adv_fields, data);
-    CBTTask::Instance()->unlock();
-    assert(rc == 0);
+/**
+ * @brief Initialize the GATT server
+ * @return Error code
+ */
+int CBTTask::gatt_svr_init()
+{
+    int rc = 0;
+    ble_svc_gap_init();  // Initialize GAP service
+    ble_svc_gatt_init(); // Initialize GATT service
 
-    rc = ble_gap_ext_adv_set_data(1, data);
-    assert(rc == 0);
+    rc = ble_gatts_count_cfg(gatt_svr_svcs); // Count service configuration
 
-    /* Start advertising */
-    rc = ble_gap_ext_adv_start(1, 0, 0);
-    assert(rc == 0);
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+    rc = ble_gatts_add_svcs(gatt_svr_svcs); // Add services
+    if (rc != 0)
+    {
+        return rc;
+    }
+
+#ifdef CONFIG_BLE_DATA_L2CAP
+    // Main channel over an L2CAP CoC opened by the central
+    rc = ble_l2cap_create_server(CONFIG_BLE_DATA_L2CAP_PSM, CONFIG_BLE_DATA_L2CAP_MTU, ble_l2cap_event, nullptr);
+    if (rc != 0)
+    {
+        return rc;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief Initialize Bluetooth
+ * @param mode Bluetooth operation mode
+ * @return Current operation mode
+ */
+EBTMode CBTTask::init_bt(EBTMode mode)
+{
+    // Check if Bluetooth is already initialized or mode is Off
+    if ((mMode != EBTMode::Off) || (mode == EBTMode::Off))
+        return mMode;
+
+    esp_err_t ret = nimble_port_init(); // Initialize the NimBLE port
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to init nimble %d ", ret);
+        return mMode;
+    }
+
+    // Set callback functions
+    ble_hs_cfg.reset_cb = ble_on_reset;
+    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
+
+    // Choose the callback depending on the mode
+    switch (mode)
+    {
+#ifdef CONFIG_BLE_DATA_IBEACON_TX
+    case EBTMode::iBeaconTx:
+        ble_hs_cfg.sync_cb = ble_on_sync_beacon; // iBeacon transmission mode
+        break;
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+    case EBTMode::iBeaconRx:
+        ble_hs_cfg.sync_cb = ble_on_sync_rx; // iBeacon scanning mode
+        break;
+#endif
+    case EBTMode::Data:
+        ble_hs_cfg.sync_cb = ble_on_sync_data; // Data transmission mode
+        if (gatt_svr_init() != 0)
+            ESP_LOGE(TAG, "Register custom service failed");
+        if (ble_svc_gap_device_name_set(CBTTask::device_name) != 0)
+            ESP_LOGE(TAG, "Set the default device name failed");
+        break;
+    default:
+        ESP_LOGE(TAG, "Wrong mode %d ", (int)mode);
+        break;
+    }
+
+    // Initialize the store configuration
+    ble_store_config_init();
+
+    // Start the BLE host task
+    nimble_port_freertos_init(ble_host_task);
+
+    mMode = mode;
+    return mMode;
+}
+
+/**
+ * @brief Deinitialize Bluetooth
+ */
+void CBTTask::deinit_bt()
+{
+    if (mMode == EBTMode::Off)
+        return;
+    // Drop pending notifications while their mbufs are still valid
+    while (mTxCount != 0)
+    {
+#ifdef CONFIG_BLE_DATA_PROBE
+        if (mTxQueue[mTxHead].msgID != MSG_PROBE) // Probes are not channel data
+#endif
+        {
+            BT_METRICS(mMetrics.dropped(txChannel(&mTxQueue[mTxHead])));
+            txDone(txLength(&mTxQueue[mTxHead]), txMbuf(mTxQueue[mTxHead].msgID));
+        }
+        txFree(&mTxQueue[mTxHead]);
+        mTxHead = (mTxHead + 1) % BTTASK_TXLENGTH;
+        mTxCount--;
+    }
+#ifdef CONFIG_BLE_DATA_TX_RING
+    txDone(ringClear(mTxRing));
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    txDone(ringClear(mTxRing2));
+#endif
+#endif
+#ifdef CONFIG_BLE_DATA_RX_RING
+    mRxRing->clear();
+#endif
+    // Messages still in the task queue are not matched to a send time
+    BT_METRICS(mMetrics.flush(EBTChannel::Main));
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    BT_METRICS(mMetrics.flush(EBTChannel::Second));
+#endif
+    // Mbufs still in the data queue are not sent and their length is lost with their pool
+    txDone(mTxMbufBytes.exchange(0));
+    // Invalidate mbufs still waiting in the queue: their pool is released by deinit
+    lock();
+    mConnect = false;
+    mConnCount = 0;
+    mMtu = BLE_ATT_MTU_DFLT;
+    mTxGen++;
+    unlock();
+    nimble_port_stop();   // Stop the NimBLE port
+    nimble_port_deinit(); // Deinitialize the NimBLE port
+#ifdef CONFIG_BLE_DATA_FRAMED
+    for (auto &conn : mConn)
+        rxFrameReset(&conn);
+#endif
+    mOnRx = nullptr;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    mOnRx2 = nullptr;
+#endif
+    mMode = EBTMode::Off;
+    mConnect = false;
+}
+
+/**
+ * @brief BLE host task
+ * @param param Task parameters
+ */
+void CBTTask::ble_host_task(void *param)
+{
+    /* This function returns only when nimble_port_stop() is called */
+    nimble_port_run();
+    nimble_port_freertos_deinit();
+}
+
+/**
+ * @brief Main function for the Bluetooth task execution
+ */
+void CBTTask::run()
+{
+#ifndef CONFIG_FREERTOS_CHECK_STACKOVERFLOW_NONE
+    UBaseType_t m1 = uxTaskGetStackHighWaterMark2(nullptr);
+#endif
+    STaskMessage msg;
+
+#ifdef CONFIG_BLE_DATA_IBEACON_TX
+    // Load iBeacon parameters from NVS
+    nvs_handle_t nvs_handle;
+    if (nvs_open("nvs", NVS_READWRITE, &nvs_handle) == ESP_OK)
+    {
+        size_t sz = sizeof(mBeaconID);
+        nvs_get_u8(nvs_handle, "btx", &mBeaconTx);
+        if (nvs_get_blob(nvs_handle, "beacon", mBeaconID, &sz) != ESP_OK)
+        {
+            esp_fill_random(mBeaconID, sizeof(mBeaconID)); // Generate a random ID
+            nvs_set_blob(nvs_handle, "beacon", mBeaconID, sizeof(mBeaconID));
+            nvs_commit(nvs_handle);
+        }
+        nvs_close(nvs_handle);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "nvs_open failed");
+        esp_fill_random(mBeaconID, sizeof(mBeaconID)); // Generate a random ID
+    }
+#endif
+
+#ifdef CONFIG_BLE_DATA_COALESCE
+    mCoalesceTimer = new CSoftwareTimer(0, MSG_COALESCE_TIMER);
+#endif
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    mAdaptTimer = new CSoftwareTimer(0, MSG_ADAPT_TIMER);
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+    mBatchTimer = new CSoftwareTimer(0, MSG_SCAN_BATCH);
+#endif
+
+    for (;;)
+    {
+        // Process control messages; poll while data or notifications are pending
+        while (getMessage(&msg, (txIdle() && rxIdle() && dataIdle() && ackIdle()) ? TASK_MAX_BLOCK_TIME : 1))
+        {
+            switch (msg.msgID)
+            {
+#ifdef CONFIG_BLE_DATA_IBEACON_TX
+            case MSG_INIT_BEACON_TX:
+                deinit_bt();
+                if (mBeaconTimer != nullptr)
+                {
+                    delete mBeaconTimer;
+                    mBeaconTimer = nullptr;
+                }
+                mBeaconMajor = msg.shortParam;
+                mBeaconMinor = msg.paramID;
+                init_bt(EBTMode::iBeaconTx);
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+            case MSG_INIT_BEACON_RX:
+                deinit_bt();
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+                mDedup->clear(); // The scanner is stopped
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+                mBatchCount = 0; // The scanner is stopped
+                if (msg.shortParam & 0x100)
+                {
+                    mOnBatch = (onScanBatch *)msg.msgBody;
+                    mOnBeacon = nullptr;
+                }
+                else
+                {
+                    mOnBatch = nullptr;
+                    mOnBeacon = (onBeaconRx *)msg.msgBody;
+                }
+#else
+                mOnBeacon = (onBeaconRx *)msg.msgBody;
+#endif
+                mBeaconSleepTime = (msg.shortParam & 0x7f) * 1000;
+                mBeaconFilter = (msg.shortParam & 0x80) != 0;
+                init_bt(EBTMode::iBeaconRx);
+                if (mBeaconTimer == nullptr)
+                {
+                    mBeaconTimer = new CSoftwareTimer(0, MSG_BEACON_TIMER);
+                }
+                mBeaconTimer->start(this, ETimerEvent::SendBack, mScanTime);
+                mBeaconSleep = false;
+                break;
+            case MSG_BEACON_TIMER:
+                // Duty cycle: the host stays up, only discovery is started and stopped
+                if ((mBeaconTimer != nullptr) && (mMode == EBTMode::iBeaconRx))
+                {
+                    if (!ble_hs_synced())
+                    {
+                        // The sync callback starts the scan
+                        mBeaconTimer->start(this, ETimerEvent::SendBack, mScanTime);
+                        break;
+                    }
+                    if (mBeaconSleep)
+                    {
+                        ble_scan();
+                        mBeaconTimer->start(this, ETimerEvent::SendBack, mScanTime);
+                        mBeaconSleep = false;
+                        break;
+                    }
+                    if (mBeaconSleepTime != 0)
+                    {
+                        ble_gap_disc_cancel();
+                        mBeaconSleep = true;
+                    }
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+                    scanFlush();
+#endif
+                    // End of the scan window
+                    if (mOnBeacon != nullptr)
+                        mOnBeacon(nullptr, nullptr);
+                    mBeaconTimer->start(this, ETimerEvent::SendBack, mBeaconSleep ? mBeaconSleepTime : mScanTime);
+                }
+                break;
+#endif
+            case MSG_INIT_DATA:
+                deinit_bt();
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+                if (mBeaconTimer != nullptr)
+                {
+                    delete mBeaconTimer;
+                    mBeaconTimer = nullptr;
+                }
+#endif
+                mOnRx = (onBLEDataRx *)msg.msgBody;
+                init_bt(EBTMode::Data);
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+                mAdaptBytes.store(0);
+                mAdaptTimer->start(this, ETimerEvent::SendBack, CONFIG_BLE_DATA_ADAPTIVE_WINDOW);
+#endif
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+                mTxSkip = false;
+#endif
+                break;
+            case MSG_OFF:
+                deinit_bt();
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+                if (mBeaconTimer != nullptr)
+                {
+                    delete mBeaconTimer;
+                    mBeaconTimer = nullptr;
+                }
+#endif
+                break;
+            case MSG_DATA_READY:
+                // The data queue is drained by dataFlush() below
+                break;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+            case MSG_SKIP_WRITE:
+                mTxSkip = true;
+                break;
+            case MSG_INIT_DATA2:
+                mOnRx2 = (onBLEDataRx *)msg.msgBody;
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+            case MSG_SCAN_BATCH:
+                scanFlush();
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+            case MSG_SCAN_TIMING:
+            {
+                uint32_t *dt = (uint32_t *)msg.msgBody;
+                mScanItvl = (uint16_t)dt[0];
+                mScanWindow = (uint16_t)(dt[0] >> 16);
+                mScanTime = dt[1];
+                mBeaconSleepTime = dt[2];
+                freeBody(msg.msgBody);
+                break;
+            }
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+            case MSG_SCAN_ACCEPT:
+                mAcceptCount = msg.shortParam / 6;
+                for (uint8_t i = 0; i < mAcceptCount; i++)
+                {
+                    mAccept[i].type = BLE_ADDR_PUBLIC;
+                    std::memcpy(mAccept[i].val, &((uint8_t *)msg.msgBody)[i * 6], 6);
+                }
+                freeBody(msg.msgBody);
+                // A running scan is restarted, a sleeping one picks the list up on wake-up
+                if ((mMode == EBTMode::iBeaconRx) && !mBeaconSleep && ble_hs_synced())
+                {
+                    ble_gap_disc_cancel();
+                    ble_scan();
+                }
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+            case MSG_ADAPT_TIMER:
+                // Runs while in data mode
+                if (mMode == EBTMode::Data)
+                {
+                    adaptTick();
+                    mAdaptTimer->start(this, ETimerEvent::SendBack, CONFIG_BLE_DATA_ADAPTIVE_WINDOW);
+                }
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_COALESCE
+            case MSG_COALESCE_TIMER:
+            {
+                // Deadline of the coalescing buffer expired; keep the order of the data queue
+                bool retry = false;
+                lock();
+                if (mCoalesce.msgBody != nullptr)
+                {
+                    // Posted under the lock, so a full queue leaves the buffer in place
+                    msg = mCoalesce;
+                    msg.shortParam = mCoalesceSize;
+                    if (postData(&msg, 0, false))
+                        coalesceTake(&msg);
+                    else
+                        retry = true;
+                }
+                unlock();
+                if (retry)
+                {
+                    // The producer posts the buffer once it is full, otherwise try on the next deadline
+                    mCoalesceTimer->start(this, ETimerEvent::SendBack, mCoalesceTime);
+                }
+                break;
+            }
+#endif
+#ifdef CONFIG_BLE_DATA_TX_RING
+            case MSG_TX_RING:
+                // Streaming rings are drained by txFlush() below
+                break;
+#endif
+#ifdef CONFIG_BLE_DATA_RX_RING
+            case MSG_RX_RING:
+                // The receive ring is drained by rxFlush() below
+                break;
+#endif
+            case MSG_INIT_DATA3:
+                mOnConnect = (onBLEConnect *)msg.msgBody;
+                break;
+            case MSG_SET_ADV_DATA:
+                // Set advertising data
+                lock();
+                if (mManufacturerData != nullptr)
+                    vPortFree(mManufacturerData);
+                mManufacturerData = (uint8_t *)msg.msgBody;
+                mManufacturerDataSize = msg.shortParam;
+                unlock();
+                if ((mMode == EBTMode::Data) && (mConnCount < CONFIG_BLE_DATA_MAX_CONNECTIONS) && (ble_hs_synced()))
+                {
+#ifdef CONFIG_BT_NIMBLE_EXT_ADV
+                    ble_gap_ext_adv_stop(1);
 #else
-    // Standard advertising
-    struct ble_gap_adv_params adv_params;
-    struct ble_hs_adv_fields fields;
-    const char *name;
-    int rc;
-
-    name = ble_svc_gap_device_name();
-    CBTTask::Instance()->lock();
-    bool compact = (CBTTask::Instance()->mManufacturerDataSize + strlen(name)) > 16;
-    struct ble_hs_adv_fields scan_response_fields;
-    memset(&scan_response_fields, 0, sizeof scan_response_fields);
-
-    /**
-     *  Set the advertising data:
-     *     o Flags (indicate the type of advertising and other general info).
-     *     o Transmission power level.
-     *     o Device name.
-     *     o 16-bit service UUIDs.
-     */
-
-    memset(&fields, 0, sizeof fields);
-
-    /* Advertise two flags:
-     *     o Discoverability in subsequent advertising (general)
-     *     o BLE only (BR/EDR not supported).
-     */
-    fields.flags = BLE_HS_ADV_F_DISC_GEN |
-                   BLE_HS_ADV_F_BREDR_UNSUP;
-
-    /* Indicate that the transmission power level field should be included */
-    fields.tx_pwr_lvl_is_present = 1;
-    fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
-
-    fields.name = (uint8_t *)name;
-    if (compact && (strlen(name) > 11))
-    {
-        // Compact name in main advertisement
-        fields.name_len = 11;
-        fields.name_is_complete = 0;
-
-        // Full name in scan response
-        scan_response_fields.name = (uint8_t *)name;
-        scan_response_fields.name_len = strlen(name);
-        scan_response_fields.name_is_complete = 1;
+                    ble_gap_adv_stop();
+#endif
+                    ble_advertise_data();
+                }
+                break;
+            case MSG_END_TASK:
+                goto endTask;
+            default:
+                TRACE_WARNING("CBTTask:unknown message", msg.msgID);
+                break;
+            }
+            dataFlush();
+#ifndef CONFIG_FREERTOS_CHECK_STACKOVERFLOW_NONE
+            UBaseType_t m2 = uxTaskGetStackHighWaterMark2(nullptr);
+            if (m2 != m1)
+            {
+                m1 = m2;
+                TDEC("free bttask stack", m2);
+            }
+#endif
+        }
+        dataFlush();
     }
-    else
+endTask:
+    deinit_bt();
+    if (mManufacturerData != nullptr)
+        vPortFree(mManufacturerData);
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+    if (mBeaconTimer != nullptr)
     {
-        fields.name_len = strlen(name);
-        fields.name_is_complete = 1;
+        delete mBeaconTimer;
     }
-
-    // Set the service UUID
-    ble_uuid16_t t[1] = {BLE_UUID16_INIT(BLE_SVC_SPP_UUID16)};
-    fields.uuids16 = t;
-    fields.num_uuids16 = 1;
-    fields.uuids16_is_complete = 1;
-
-    fields.mfg_data = CBTTask::Instance()->mManufacturerData;
-    if (compact)
+#endif
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    delete mAdaptTimer;
+    mAdaptTimer = nullptr;
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+    delete mBatchTimer;
+    mBatchTimer = nullptr;
+#endif
+#ifdef CONFIG_BLE_DATA_COALESCE
+    delete mCoalesceTimer;
+    mCoalesceTimer = nullptr;
+    if (mCoalesce.msgBody != nullptr)
+        freeBody(mCoalesce.msgBody);
+#endif
+    while (getMessage(&msg, 0))
     {
-        // Compact manufacturer data
-        fields.mfg_data_len = 5;
-        scan_response_fields.mfg_data = CBTTask::Instance()->mManufacturerData;
-        scan_response_fields.name_len = CBTTask::Instance()->mManufacturerDataSize;
-
-        rc = ble_gap_adv_rsp_set_fields(&scan_response_fields);
-        if (rc != 0)
+        switch (msg.msgID)
         {
-            ESP_LOGE(TAG, "error setting response data; rc=%d", rc);
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+        case MSG_SCAN_TIMING:
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+        case MSG_SCAN_ACCEPT:
+#endif
+        case MSG_SET_ADV_DATA:
+            freeBody(msg.msgBody);
+            break;
+        default:
+            break;
         }
     }
-    else
+    while (xQueueReceive(mDataQueue, &msg, 0) == pdTRUE)
     {
-        fields.mfg_data_len = CBTTask::Instance()->mManufacturerDataSize;
+        switch (msg.msgID)
+        {
+        // MSG_WRITE_MBUF/MSG_WRITE_MBUF2 belong to the released mbuf pool
+        case MSG_WRITE_MBUF:
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+        case MSG_WRITE_MBUF2:
+#endif
+            break;
+        default:
+            freeBody(msg.msgBody);
+            break;
+        }
     }
+}
 
-    rc = ble_gap_adv_set_fields(&fields);
-    CBTTask::Instance()->unlock();
-    if (rc != 0)
+/**
+ * @brief Allocate a message body
+ * @param msg Message
+ * @param id Message ID
+ * @param size Body size
+ * @param pooled Take the body from the pools
+ * @return Pointer to the body
+ */
+uint8_t *CBTTask::allocBody(STaskMessage *msg, uint16_t id, uint16_t size, bool pooled)
+{
+#ifdef CONFIG_BLE_DATA_POOL
+    if (pooled && (mPool != nullptr))
     {
-        ESP_LOGE(TAG, "error setting advertisement data; rc=%d", rc);
-        return;
+        msg->msgID = id;
+        msg->shortParam = size;
+        msg->msgBody = mPool->alloc(size);
+        return (uint8_t *)msg->msgBody;
     }
+#endif
+    return allocNewMsg(msg, id, size, true);
+}
 
-    /* Start advertising */
-    memset(&adv_params, 0, sizeof adv_params);
-    adv_params.conn_mode = BLE_GAP_CONN_MODE_UND; // Undirected advertising
-    adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN; // General discovery
-    rc = ble_gap_adv_start(CBTTask::Instance()->own_addr_type, nullptr, BLE_HS_FOREVER,
-                           &adv_params, ble_server_gap_event, nullptr);
-    if (rc != 0)
+/**
+ * @brief Release a message body
+ * @param data Body (pool block or heap memory)
+ */
+void CBTTask::freeBody(void *data)
+{
+#ifdef CONFIG_BLE_DATA_POOL
+    if (mPool != nullptr)
     {
-        ESP_LOGE(TAG, "error enabling advertisement; rc=%d", rc);
+        mPool->free(data); // Heap memory is passed on to vPortFree
         return;
     }
-    ESP_LOGD(TAG, "Data advertisement started");
 #endif
+    vPortFree(data);
 }
 
 /**
- * @brief Synchronization handler for data transmission mode
+ * @brief Post a data message to the data queue and wake the task
+ * @param msg Message
+ * @param xTicksToWait Time to wait for room in the queue
+ * @param free_mem Free the message body on failure
+ * @return true if successful, false if error
  */
-void CBTTask::ble_on_sync_data()
+bool CBTTask::postData(STaskMessage *msg, TickType_t xTicksToWait, bool free_mem)
 {
-    int rc;
-
-    // Ensure the address is set correctly
-    rc = ble_hs_util_ensure_addr(0);
-    if (rc != 0)
+    if (xQueueSend(mDataQueue, msg, xTicksToWait) != pdTRUE)
     {
-        ESP_LOGE(TAG, "error ble_hs_util_ensure_addr ; rc=%d", rc);
-        return;
+        if (free_mem && (msg->msgBody != nullptr))
+        {
+            freeBody(msg->msgBody);
+            msg->msgBody = nullptr;
+        }
+        return false;
+    }
+    if (!mDataBell.exchange(true))
+    {
+        // If the control queue is full the task finds the data while polling
+        if (!sendCmd(MSG_DATA_READY, 0, 0, 0))
+            mDataBell.store(false);
     }
+    return true;
+}
 
-    /* Determine the address type to use for advertising */
-    rc = ble_hs_id_infer_auto(0, &CBTTask::Instance()->own_addr_type);
-    if (rc != 0)
+/**
+ * @brief Process the data queue, the receive ring and pending notifications
+ *
+ * Stops as soon as a control message is queued, so commands never wait
+ * behind bulk data. Transmit messages stay in the data queue while the
+ * pending notification queue is full, blocking their producers.
+ */
+void CBTTask::dataFlush()
+{
+    STaskMessage msg;
+
+    // Producers ring the doorbell again for anything posted from now on
+    mDataBell.store(false);
+    while ((uxQueueMessagesWaiting(mTaskQueue) == 0) && (xQueuePeek(mDataQueue, &msg, 0) == pdTRUE))
     {
-        ESP_LOGE(TAG, "error determining address type; rc=%d", rc);
-        return;
+        if (txMessage(msg.msgID) && (mTxCount == BTTASK_TXLENGTH))
+        {
+            txFlush();
+            if (mTxCount == BTTASK_TXLENGTH)
+                break; // Wait for free mbufs
+        }
+        xQueueReceive(mDataQueue, &msg, 0);
+        dataHandle(&msg);
     }
+#ifdef CONFIG_BLE_DATA_RX_RING
+    if (!rxIdle())
+        rxFlush();
+#endif
+#ifdef CONFIG_BLE_DATA_RX_ACK
+    // Acknowledge the rest of a burst once it is delivered
+    if ((mRxUnacked != 0) && rxIdle() && dataIdle())
+        rxAckSend();
+#endif
+    if (!txIdle())
+        txFlush();
+}
 
-    /* Start data advertising */
-    ble_advertise_data();
+/**
+ * @brief Process one data message
+ * @param msg Message
+ */
+void CBTTask::dataHandle(STaskMessage *msg)
+{
+    switch (msg->msgID)
+    {
+    case MSG_WRITE_DATA:
+    case MSG_WRITE_DATA_TO:
+    case MSG_WRITE_MBUF:
+        // Send data via BLE notification
+        txPush(msg);
+        break;
+#ifdef CONFIG_BLE_DATA_PROBE
+    case MSG_PROBE:
+        ((SBTProbe *)msg->msgBody)->stamp[2] = (uint32_t)esp_timer_get_time();
+        txPush(msg);
+        break;
+#endif
+    case MSG_READ_DATA:
+        // Receive data via BLE
+        if (mOnRx != nullptr)
+            mOnRx((uint8_t *)msg->msgBody, msg->shortParam);
+        else
+        {
+            TRACEDATA("BLE Rx", (uint8_t *)msg->msgBody, msg->shortParam);
+        }
+        freeBody(msg->msgBody);
+#ifdef CONFIG_BLE_DATA_RX_ACK
+        rxAck(1);
+#endif
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+        mTxSkip = false;
+#endif
+        break;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    case MSG_WRITE_DATA2:
+    case MSG_WRITE_MBUF2:
+        // Send data via the second channel
+        txPush(msg);
+        break;
+    case MSG_READ_DATA2:
+        // Receive data via the second channel
+        if (mOnRx2 != nullptr)
+            mOnRx2((uint8_t *)msg->msgBody, msg->shortParam);
+        else
+        {
+            TRACEDATA("BLE Rx 2", (uint8_t *)msg->msgBody, msg->shortParam);
+        }
+        freeBody(msg->msgBody);
+#ifdef CONFIG_BLE_DATA_RX_ACK
+        rxAck(2);
+#endif
+        break;
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+    case MSG_BEACON_DATA:
+        if (mOnBeacon != nullptr)
+            mOnBeacon((SBeacon *)msg->msgBody, nullptr);
+        else
+        {
+            TRACEDATA("beacon", (uint8_t *)msg->msgBody, msg->shortParam);
+            freeBody(msg->msgBody);
+        }
+        break;
+    case MSG_MAC_DATA:
+        if (mOnBeacon != nullptr)
+            mOnBeacon(nullptr, (SMac *)msg->msgBody);
+        else
+        {
+            TRACEDATA("mac", (uint8_t *)msg->msgBody, msg->shortParam);
+            freeBody(msg->msgBody);
+        }
+        break;
+#endif
+    default:
+        TRACE_WARNING("CBTTask:unknown data message", msg->msgID);
+        break;
+    }
 }
 
+#ifdef CONFIG_BLE_DATA_RX_RING
 /**
- * @brief Initialize the GATT server
- * @return Error code
+ * @brief Deliver the packets from the receive ring to the callbacks
+ *
+ * The callbacks get a pointer into the ring, valid until they return.
  */
-int CBTTask::gatt_svr_init()
+void CBTTask::rxFlush()
 {
-    int rc = 0;
-    ble_svc_gap_init();  // Initialize GAP service
-    ble_svc_gatt_init(); // Initialize GATT service
-
-    rc = ble_gatts_count_cfg(gatt_svr_svcs); // Count service configuration
+    uint8_t *data;
+    uint16_t size;
 
-    if (rc != 0)
-    {
-        return rc;
-    }
-
-    rc = ble_gatts_add_svcs(gatt_svr_svcs); // Add services
-    if (rc != 0)
+    // The host task rings the doorbell again for anything pushed from now on
+    mRxBell.store(false);
+    while ((data = mRxRing->front(size)) != nullptr)
     {
-        return rc;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+        if (data[0] == 2)
+        {
+            if (mOnRx2 != nullptr)
+                mOnRx2(&data[1], size - 1);
+            else
+            {
+                TRACEDATA("BLE Rx 2", &data[1], size - 1);
+            }
+        }
+        else
+#endif
+        {
+            if (mOnRx != nullptr)
+                mOnRx(&data[1], size - 1);
+            else
+            {
+                TRACEDATA("BLE Rx", &data[1], size - 1);
+            }
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+            mTxSkip = false;
+#endif
+        }
+#ifdef CONFIG_BLE_DATA_RX_ACK
+        rxAck(data[0]);
+#endif
+        mRxRing->pop();
     }
-
-    return 0;
 }
+#endif
 
 /**
- * @brief Initialize Bluetooth
- * @param mode Bluetooth operation mode
- * @return Current operation mode
+ * @brief Check that the mbuf pool can take one more notification
+ *
+ * Some buffers are always left to the host for received data and ATT responses.
+ * With CONFIG_BLE_DATA_L2CAP the queue is held only when every connection has
+ * a stalled CoC channel; connSend() refuses packets for a stalled one, so a
+ * fan-out skips it like a connection without mbufs.
+ *
+ * @return true if a notification may be sent
  */
-EBTMode CBTTask::init_bt(EBTMode mode)
+bool CBTTask::txReady()
 {
-    // Check if Bluetooth is already initialized or mode is Off
-    if ((mMode != EBTMode::Off) || (mode == EBTMode::Off))
-        return mMode;
-
-    esp_err_t ret = nimble_port_init(); // Initialize the NimBLE port
-    if (ret != ESP_OK)
+#ifdef CONFIG_BLE_DATA_L2CAP
+    uint8_t stalled = 0;
+    lock();
+    for (uint8_t i = 0; i < mConnCount; i++)
     {
-        ESP_LOGE(TAG, "Failed to init nimble %d ", ret);
-        return mMode;
+        if (mConn[i].cocStalled)
+            stalled++;
     }
+    bool hold = (stalled != 0) && (stalled == mConnCount);
+    unlock();
+    if (hold)
+        return false; // Keep the order until a peer grants credits
+#endif
+    // A fan-out send takes a buffer per connection
+    return os_msys_num_free() > CONFIG_BLE_DATA_TX_RESERVE + ((mConnCount > 1) ? (mConnCount - 1) : 0);
+}
 
-    // Set callback functions
-    ble_hs_cfg.reset_cb = ble_on_reset;
-    ble_hs_cfg.store_status_cb = ble_store_util_status_rr;
-
-    // Choose the callback depending on the mode
-    switch (mode)
+/**
+ * @brief Free the body of a transmit message
+ * @param msg Message
+ */
+void CBTTask::txFree(STaskMessage *msg)
+{
+    if (msg->msgBody == nullptr)
+        return;
+    switch (msg->msgID)
     {
-#ifdef CONFIG_BLE_DATA_IBEACON_TX
-    case EBTMode::iBeaconTx:
-        ble_hs_cfg.sync_cb = ble_on_sync_beacon; // iBeacon transmission mode
-        break;
-#endif
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-    case EBTMode::iBeaconRx:
-        ble_hs_cfg.sync_cb = ble_on_sync_rx; // iBeacon scanning mode
-        break;
+    case MSG_WRITE_MBUF:
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    case MSG_WRITE_MBUF2:
 #endif
-    case EBTMode::Data:
-        ble_hs_cfg.sync_cb = ble_on_sync_data; // Data transmission mode
-        if (gatt_svr_init() != 0)
-            ESP_LOGE(TAG, "Register custom service failed");
-        if (ble_svc_gap_device_name_set(CBTTask::device_name) != 0)
-            ESP_LOGE(TAG, "Set the default device name failed");
+        // Mbufs from before the last deinit_bt belong to the released pool
+        if (msg->shortParam == mTxGen)
+            os_mbuf_free_chain((struct os_mbuf *)msg->msgBody);
         break;
     default:
-        ESP_LOGE(TAG, "Wrong mode %d ", (int)mode);
+        freeBody(msg->msgBody);
         break;
     }
-
-    // Initialize the store configuration
-    ble_store_config_init();
-
-    // Start the BLE host task
-    nimble_port_freertos_init(ble_host_task);
-
-    mMode = mode;
-    return mMode;
+    msg->msgBody = nullptr;
 }
 
 /**
- * @brief Deinitialize Bluetooth
+ * @brief Get the payload size of a transmit message
+ * @param msg Message
+ * @return Size in bytes
  */
-void CBTTask::deinit_bt()
+uint16_t CBTTask::txLength(STaskMessage *msg)
 {
-    if (mMode == EBTMode::Off)
-        return;
-    nimble_port_stop();   // Stop the NimBLE port
-    nimble_port_deinit(); // Deinitialize the NimBLE port
-    mOnRx = nullptr;
+    switch (msg->msgID)
+    {
+    case MSG_WRITE_MBUF:
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-    mOnRx2 = nullptr;
+    case MSG_WRITE_MBUF2:
 #endif
-    mMode = EBTMode::Off;
-    mConnect = false;
+        if ((msg->msgBody == nullptr) || (msg->shortParam != mTxGen))
+            return 0;
+        return OS_MBUF_PKTLEN((struct os_mbuf *)msg->msgBody);
+    default:
+        return msg->shortParam;
+    }
 }
 
+#ifdef CONFIG_BLE_DATA_METRICS
 /**
- * @brief BLE host task
- * @param param Task parameters
+ * @brief Get the metrics channel of a transmit message
+ * @param msg Message
+ * @return Channel
  */
-void CBTTask::ble_host_task(void *param)
+EBTChannel CBTTask::txChannel(STaskMessage *msg)
 {
-    /* This function returns only when nimble_port_stop() is called */
-    nimble_port_run();
-    nimble_port_freertos_deinit();
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    if ((msg->msgID == MSG_WRITE_DATA2) || (msg->msgID == MSG_WRITE_MBUF2))
+        return EBTChannel::Second;
+#endif
+    return EBTChannel::Main;
 }
 
 /**
- * @brief Main function for the Bluetooth task execution
+ * @brief Get a metrics snapshot
+ * @param data Receives the snapshot
  */
-void CBTTask::run()
+void CBTTask::getMetrics(SBTMetrics *data)
 {
-#ifndef CONFIG_FREERTOS_CHECK_STACKOVERFLOW_NONE
-    UBaseType_t m1 = uxTaskGetStackHighWaterMark2(nullptr);
+    mMetrics.get(data);
+    data->txQueued = mTxBytes.load();
+}
 #endif
-    STaskMessage msg;
 
-#ifdef CONFIG_BLE_DATA_IBEACON_TX
-    // Load iBeacon parameters from NVS
-    nvs_handle_t nvs_handle;
-    if (nvs_open("nvs", NVS_READWRITE, &nvs_handle) == ESP_OK)
-    {
-        size_t sz = sizeof(mBeaconID);
-        nvs_get_u8(nvs_handle, "btx", &mBeaconTx);
-        if (nvs_get_blob(nvs_handle, "beacon", mBeaconID, &sz) != ESP_OK)
-        {
-            esp_fill_random(mBeaconID, sizeof(mBeaconID)); // Generate a random ID
-            nvs_set_blob(nvs_handle, "beacon", mBeaconID, sizeof(mBeaconID));
-            nvs_commit(nvs_handle);
-        }
-        nvs_close(nvs_handle);
-    }
-    else
-    {
-        ESP_LOGE(TAG, "nvs_open failed");
-        esp_fill_random(mBeaconID, sizeof(mBeaconID)); // Generate a random ID
-    }
+/**
+ * @brief Account bytes accepted for transmission
+ *
+ * Called by the producer; reports the high watermark crossing.
+ *
+ * @param len Size in bytes
+ */
+void CBTTask::txAccount(uint32_t len)
+{
+    uint32_t queued = mTxBytes.fetch_add(len) + len;
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    mAdaptBytes.fetch_add(len);
 #endif
+    if ((mOnTxLevel != nullptr) && (queued >= mTxHighLevel) && !mTxHigh.exchange(true))
+        mOnTxLevel(true);
+}
 
-    struct os_mbuf *txom; // Buffer for data transmission
-    int er;
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-    bool skip = false; // Flag to skip transmission
-    int n;
+/**
+ * @brief Account bytes passed to the stack or dropped
+ *
+ * Called by the task; reports the low watermark crossing. Producers account
+ * their bytes before queuing them, so the counter never goes below zero.
+ *
+ * @param len Size in bytes
+ * @param mbuf The bytes come from an mbuf message of the current pool
+ */
+void CBTTask::txDone(uint32_t len, bool mbuf)
+{
+    if (mbuf)
+        mTxMbufBytes.fetch_sub(len);
+    uint32_t queued = mTxBytes.fetch_sub(len) - len;
+    if ((mOnTxLevel != nullptr) && (queued <= mTxLowLevel) && mTxHigh.exchange(false))
+        mOnTxLevel(false);
+}
+
+/**
+ * @brief Get the transmit pipeline state
+ * @param status Receives the state
+ */
+void CBTTask::getTxStatus(SBTTxStatus *status)
+{
+    int credits = 0;
+    lock();
+    if ((mMode == EBTMode::Data) && mConnect)
+        credits = os_msys_num_free() - CONFIG_BLE_DATA_TX_RESERVE;
+    unlock();
+    status->queued = mTxBytes.load();
+    status->credits = (credits > 0) ? credits : 0;
+    status->slots = uxQueueSpacesAvailable(mDataQueue);
+}
+
+/**
+ * @brief Try to send one transmit message
+ * @param msg Message; its body is freed unless BLE_HS_ENOMEM is returned
+ * @return BLE_HS_ENOMEM if the message must wait for free mbufs, otherwise 0
+ */
+int CBTTask::txSend(STaskMessage *msg)
+{
+    struct os_mbuf *txom;
+    int er = 0;
+    uint16_t len = txLength(msg);
+
+#ifdef CONFIG_BLE_DATA_PROBE
+    if (msg->msgID == MSG_PROBE)
+        return probeSend(msg); // Not counted as application data
 #endif
-    for (;;)
+    if (!mConnect)
     {
-        // Process incoming messages
-        while (getMessage(&msg, TASK_MAX_BLOCK_TIME))
-        {
-            switch (msg.msgID)
-            {
-#ifdef CONFIG_BLE_DATA_IBEACON_TX
-            case MSG_INIT_BEACON_TX:
-                deinit_bt();
-                if (mBeaconTimer != nullptr)
-                {
-                    delete mBeaconTimer;
-                    mBeaconTimer = nullptr;
-                }
-                mBeaconMajor = msg.shortParam;
-                mBeaconMinor = msg.paramID;
-                init_bt(EBTMode::iBeaconTx);
-                break;
-#endif
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-            case MSG_INIT_BEACON_RX:
-                deinit_bt();
-                mOnBeacon = (onBeaconRx *)msg.msgBody;
-                mBeaconSleepTime = (msg.shortParam & 0x7f) * 1000;
-                mBeaconFilter = (msg.shortParam & 0x80) != 0;
-                init_bt(EBTMode::iBeaconRx);
-                if (mBeaconTimer == nullptr)
-                {
-                    mBeaconTimer = new CSoftwareTimer(0, MSG_BEACON_TIMER);
-                }
-                mBeaconTimer->start(this, ETimerEvent::SendBack, CONFIG_BLE_DATA_IBEACON_SCAN_TIMER);
-                mBeaconSleep = false;
-                break;
-            case MSG_BEACON_DATA:
-                if (mOnBeacon != nullptr)
-                    mOnBeacon((SBeacon *)msg.msgBody, nullptr);
-                else
-                {
-                    TRACEDATA("beacon", (uint8_t *)msg.msgBody, msg.shortParam);
-                    vPortFree(msg.msgBody);
-                }
-                break;
-            case MSG_MAC_DATA:
-                if (mOnBeacon != nullptr)
-                {
-                    mOnBeacon(nullptr, (SMac *)msg.msgBody);
-                }
-                else
-                {
-                    TRACEDATA("mac", (uint8_t *)msg.msgBody, msg.shortParam);
-                    vPortFree(msg.msgBody);
-                }
-                break;
-            case MSG_BEACON_TIMER:
-                if (mBeaconTimer != nullptr)
-                {
-                    if (mBeaconSleep)
-                    {
-                        if (mMode == EBTMode::Off)
-                        {
-                            init_bt(EBTMode::iBeaconRx);
-                            mBeaconTimer->start(this, ETimerEvent::SendBack, CONFIG_BLE_DATA_IBEACON_SCAN_TIMER);
-                        }
-                    }
-                    else if (mMode == EBTMode::iBeaconRx)
-                    {
-                        deinit_bt();
-                        if (mOnBeacon != nullptr)
-                            mOnBeacon(nullptr, nullptr);
-                        mBeaconTimer->start(this, ETimerEvent::SendBack, mBeaconSleepTime);
-                    }
-                    mBeaconSleep = !mBeaconSleep;
-                }
-                break;
-#endif
-            case MSG_INIT_DATA:
-                deinit_bt();
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-                if (mBeaconTimer != nullptr)
-                {
-                    delete mBeaconTimer;
-                    mBeaconTimer = nullptr;
-                }
-#endif
-                mOnRx = (onBLEDataRx *)msg.msgBody;
-                init_bt(EBTMode::Data);
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-                skip = false;
-#endif
-                break;
-            case MSG_OFF:
-                deinit_bt();
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-                if (mBeaconTimer != nullptr)
-                {
-                    delete mBeaconTimer;
-                    mBeaconTimer = nullptr;
-                }
-#endif
-                break;
-            case MSG_WRITE_DATA:
-                // Send data via BLE notification
-                if (mConnect)
-                {
-                    txom = ble_hs_mbuf_from_flat(msg.msgBody, msg.shortParam);
-                    if ((er = ble_gatts_notify_custom(1, ble_spp_svc_gatt_read_val_handle, txom)) != 0)
-                    {
-                        TRACE_ERROR("bt: Error in sending notification", er);
-                    }
-                }
-                else
-                {
-                    TRACE_WARNING("BLE Tx: not connected", msg.shortParam);
-                }
-                vPortFree(msg.msgBody);
-                break;
-            case MSG_READ_DATA:
-                // Receive data via BLE
-                if (mOnRx != nullptr)
-                    mOnRx((uint8_t *)msg.msgBody, msg.shortParam);
-                else
-                {
-                    TRACEDATA("BLE Rx", (uint8_t *)msg.msgBody, msg.shortParam);
-                }
-                vPortFree(msg.msgBody);
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-                skip = false;
+        TRACE_WARNING("BLE Tx: not connected", msg->msgID);
+#ifdef CONFIG_BLE_DATA_FRAMED
+        mTxOffset = 0;
 #endif
-                break;
-#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-            case MSG_SKIP_WRITE:
-                skip = true;
-                break;
-            case MSG_WRITE_DATA2:
-                // Send data via the second channel
-                if (mConnect && (!skip))
-                {
-                    for (n = 0; n < 5; n++)
-                    {
-                        txom = ble_hs_mbuf_from_flat(msg.msgBody, msg.shortParam);
-                        if ((er = ble_gatts_notify_custom(1, ble_spp_svc_gatt_read_val_handle2, txom)) != 0)
-                        {
-                            vTaskDelay(pdMS_TO_TICKS(100));
-                        }
-                        else
-                        {
-                            break;
-                        }
-                    }
-                }
-                else
-                {
-                    TRACE_WARNING("BLE Tx: not connected", msg.shortParam);
-                }
-                vPortFree(msg.msgBody);
-                break;
-            case MSG_INIT_DATA2:
-                mOnRx2 = (onBLEDataRx *)msg.msgBody;
-                break;
-            case MSG_READ_DATA2:
-                // Receive data via the second channel
-                if (mOnRx2 != nullptr)
-                    mOnRx2((uint8_t *)msg.msgBody, msg.shortParam);
-                else
-                {
-                    TRACEDATA("BLE Rx 2", (uint8_t *)msg.msgBody, msg.shortParam);
-                }
-                vPortFree(msg.msgBody);
-                break;
+        BT_METRICS(mMetrics.dropped(txChannel(msg)));
+        txFree(msg);
+        txDone(len, txMbuf(msg->msgID));
+        return 0;
+    }
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    if (mTxSkip && ((msg->msgID == MSG_WRITE_DATA2) || (msg->msgID == MSG_WRITE_MBUF2)))
+    {
+        // Second channel write cancelled
+        BT_METRICS(mMetrics.dropped(EBTChannel::Second));
+        txFree(msg);
+        txDone(len, txMbuf(msg->msgID));
+        return 0;
+    }
 #endif
-            case MSG_INIT_DATA3:
-                mOnConnect = (onBLEConnect *)msg.msgBody;
-                break;
-            case MSG_SET_ADV_DATA:
-                // Set advertising data
-                lock();
-                if (mManufacturerData != nullptr)
-                    vPortFree(mManufacturerData);
-                mManufacturerData = (uint8_t *)msg.msgBody;
-                mManufacturerDataSize = msg.shortParam;
-                unlock();
-                if ((mMode == EBTMode::Data) && (!mConnect) && (ble_hs_synced()))
-                {
-#ifdef CONFIG_BT_NIMBLE_EXT_ADV
-                    ble_gap_ext_adv_stop(1);
+    if (!txReady())
+    {
+        BT_METRICS(mMetrics.retry(txChannel(msg)));
+        return BLE_HS_ENOMEM;
+    }
+
+    switch (msg->msgID)
+    {
+    case MSG_WRITE_DATA:
+#ifdef CONFIG_BLE_DATA_FRAMED
+        er = notifyFrame(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_read_val_handle, (uint8_t *)msg->msgBody, msg->shortParam);
 #else
-                    ble_gap_adv_stop();
+        txom = ble_hs_mbuf_from_flat(msg->msgBody, msg->shortParam);
+        er = (txom == nullptr) ? BLE_HS_ENOMEM : notify(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_read_val_handle, txom);
 #endif
-                    ble_advertise_data();
-                }
-                break;
-            case MSG_END_TASK:
-                goto endTask;
-            default:
-                TRACE_WARNING("CBTTask:unknown message", msg.msgID);
-                break;
-            }
-#ifndef CONFIG_FREERTOS_CHECK_STACKOVERFLOW_NONE
-            UBaseType_t m2 = uxTaskGetStackHighWaterMark2(nullptr);
-            if (m2 != m1)
-            {
-                m1 = m2;
-                TDEC("free bttask stack", m2);
-            }
+        break;
+    case MSG_WRITE_DATA_TO:
+    {
+        // Body: connection handle (2 bytes) and data
+        uint8_t *dt = (uint8_t *)msg->msgBody;
+        uint16_t conn = dt[0] | (dt[1] << 8);
+#ifdef CONFIG_BLE_DATA_FRAMED
+        er = notifyFrame(conn, ble_spp_svc_gatt_read_val_handle, &dt[2], msg->shortParam - 2);
+#else
+        txom = ble_hs_mbuf_from_flat(&dt[2], msg->shortParam - 2);
+        er = (txom == nullptr) ? BLE_HS_ENOMEM : notify(conn, ble_spp_svc_gatt_read_val_handle, txom);
 #endif
+        break;
+    }
+    case MSG_WRITE_MBUF:
+        if (msg->shortParam != mTxGen)
+            break; // Pool was released by deinit_bt
+#ifdef CONFIG_BLE_DATA_FRAMED
+        if (mTxOffset != 0)
+        {
+            er = BLE_HS_ENOMEM; // Wait for the half sent frame
+            break;
         }
+#endif
+        txom = (struct os_mbuf *)msg->msgBody;
+        msg->msgBody = nullptr; // Consumed by the stack in all cases
+#ifdef CONFIG_BLE_DATA_FRAMED
+        txom->om_data[0] = BLE_FRAME_START | BLE_FRAME_END | (mTxSeq++ & BLE_FRAME_SEQ);
+#endif
+        er = notify(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_read_val_handle, txom);
+        break;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    case MSG_WRITE_DATA2:
+        txom = ble_hs_mbuf_from_flat(msg->msgBody, msg->shortParam);
+        er = (txom == nullptr) ? BLE_HS_ENOMEM : notify(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_read_val_handle2, txom);
+        break;
+    case MSG_WRITE_MBUF2:
+        if (msg->shortParam != mTxGen)
+            break; // Pool was released by deinit_bt
+        txom = (struct os_mbuf *)msg->msgBody;
+        msg->msgBody = nullptr; // Consumed by the stack in all cases
+        er = notify(BLE_HS_CONN_HANDLE_NONE, ble_spp_svc_gatt_read_val_handle2, txom);
+        break;
+#endif
+    default:
+        break;
     }
-endTask:
-    deinit_bt();
-    if (mManufacturerData != nullptr)
-        vPortFree(mManufacturerData);
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-    if (mBeaconTimer != nullptr)
+
+    if ((er == BLE_HS_ENOMEM) && (msg->msgBody != nullptr))
     {
-        delete mBeaconTimer;
+        BT_METRICS(mMetrics.retry(txChannel(msg)));
+        return er; // Retry when the stack frees buffers
+    }
+    if (er != 0)
+        TRACE_ERROR("bt: Error in sending notification", er);
+    BT_METRICS(mMetrics.sent(txChannel(msg), len, er));
+    txFree(msg);
+    txDone(len, txMbuf(msg->msgID));
+    return 0;
+}
+
+/**
+ * @brief Queue a transmit message behind the pending ones and send what fits
+ * @param msg Message
+ */
+void CBTTask::txPush(STaskMessage *msg)
+{
+    if (mTxCount == BTTASK_TXLENGTH)
+    {
+        TRACE_WARNING("BLE Tx: queue overflow", msg->msgID);
+        BT_METRICS(mMetrics.dropped(txChannel(msg)));
+        txDone(txLength(msg), txMbuf(msg->msgID));
+        txFree(msg);
+        return;
+    }
+    mTxQueue[(mTxHead + mTxCount) % BTTASK_TXLENGTH] = *msg;
+    mTxCount++;
+    BT_METRICS(mMetrics.queueDepth(BTTASK_DATALENGTH - uxQueueSpacesAvailable(mDataQueue), mTxCount));
+    txFlush();
+}
+
+/**
+ * @brief Send pending messages while the mbuf pool has room
+ */
+void CBTTask::txFlush()
+{
+    while (mTxCount != 0)
+    {
+        if (txSend(&mTxQueue[mTxHead]) != 0)
+            break;
+        mTxHead = (mTxHead + 1) % BTTASK_TXLENGTH;
+        mTxCount--;
     }
+#ifdef CONFIG_BLE_DATA_TX_RING
+    // Producers ring the doorbell again for anything pushed from now on
+    mTxBell.store(false);
+    if (ringFlush(mTxRing, ble_spp_svc_gatt_read_val_handle) != 0)
+        return;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+    ringFlush(mTxRing2, ble_spp_svc_gatt_read_val_handle2);
 #endif
-    while (getMessage(&msg, 0))
+#endif
+}
+
+#ifdef CONFIG_BLE_DATA_TX_RING
+/**
+ * @brief Send packets from a streaming ring while the mbuf pool has room
+ * @param ring Ring
+ * @param attr Attribute handle
+ * @return BLE_HS_ENOMEM if packets are left in the ring, otherwise 0
+ */
+int CBTTask::ringFlush(CRingBuffer *ring, uint16_t attr)
+{
+    uint8_t *data;
+    uint16_t size;
+    struct os_mbuf *txom;
+    int er;
+#ifdef CONFIG_BLE_DATA_METRICS
+    EBTChannel ch = (ring == mTxRing) ? EBTChannel::Main : EBTChannel::Second;
+#endif
+
+    while ((data = ring->front(size)) != nullptr)
     {
-        switch (msg.msgID)
+        if (!mConnect)
         {
+            TRACE_WARNING("BLE Tx: not connected", ring->used());
+#ifdef CONFIG_BLE_DATA_FRAMED
+            mTxOffset = 0;
+#endif
+            txDone(ringClear(ring));
+            BT_METRICS(mMetrics.flush(ch));
+            return 0;
+        }
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
-        case MSG_WRITE_DATA2:
-        case MSG_READ_DATA2:
+        if (mTxSkip && (ring == mTxRing2))
+        {
+            // Second channel write cancelled
+            txDone(ringClear(ring));
+            BT_METRICS(mMetrics.flush(ch));
+            return 0;
+        }
 #endif
-#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
-        case MSG_BEACON_DATA:
-        case MSG_MAC_DATA:
+        if (!txReady())
+        {
+            BT_METRICS(mMetrics.retry(ch));
+            return BLE_HS_ENOMEM;
+        }
+
+#ifdef CONFIG_BLE_DATA_FRAMED
+        if (ring == mTxRing)
+            er = notifyFrame(BLE_HS_CONN_HANDLE_NONE, attr, data, size);
+        else
 #endif
-        case MSG_WRITE_DATA:
-        case MSG_READ_DATA:
-        case MSG_SET_ADV_DATA:
-            vPortFree(msg.msgBody);
-            break;
-        default:
-            break;
+        {
+            txom = ble_hs_mbuf_from_flat(data, size);
+            er = (txom == nullptr) ? BLE_HS_ENOMEM : notify(BLE_HS_CONN_HANDLE_NONE, attr, txom);
+        }
+        if (er == BLE_HS_ENOMEM)
+        {
+            BT_METRICS(mMetrics.retry(ch));
+            return er; // Retry when the stack frees buffers
+        }
+        if (er != 0)
+            TRACE_ERROR("bt: Error in sending notification", er);
+        BT_METRICS(mMetrics.sent(ch, size, er));
+        ring->pop();
+        ringRoom(ring);
+        txDone(size);
+    }
+    return 0;
+}
+
+/**
+ * @brief Drop all packets of a streaming ring
+ *
+ * The packets are popped one by one, so the result excludes the length
+ * prefixes, like the bytes counted by txAccount().
+ *
+ * @param ring Ring
+ * @return Payload bytes dropped
+ */
+uint32_t CBTTask::ringClear(CRingBuffer *ring)
+{
+    uint32_t bytes = 0;
+    uint16_t size;
+
+    while (ring->front(size) != nullptr)
+    {
+        bytes += size;
+        ring->pop();
+    }
+    ringRoom(ring);
+    return bytes;
+}
+
+/**
+ * @brief Write a packet into a streaming ring and wake the task
+ * @param ring Ring
+ * @param hdr Header (can be nullptr)
+ * @param hsize Header size
+ * @param data Data
+ * @param size Data size
+ * @param xTicksToWait Time to wait for room in the ring
+ * @return true if successful, false if error
+ */
+bool CBTTask::ringPush(CRingBuffer *ring, const uint8_t *hdr, uint16_t hsize, const uint8_t *data, uint16_t size, TickType_t xTicksToWait)
+{
+    if ((uint32_t)hsize + size + 2 > ring->size() / 2)
+        return false; // Would not fit in a drained ring
+    int ch = (ring == mTxRing) ? 0 : 1;
+    TickType_t start = xTaskGetTickCount();
+    // Account before the push: the task may send the packet before it returns
+    txAccount(hsize + size);
+    while (!ring->push(hdr, hsize, data, size))
+    {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= xTicksToWait)
+        {
+            txDone(hsize + size);
+            return false;
         }
+        // Announce the wait before the second try, so room freed in between is not missed
+        mTxWait[ch].store(true);
+        if (ring->push(hdr, hsize, data, size))
+            break;
+        xSemaphoreTake(mTxRoom[ch], (xTicksToWait == portMAX_DELAY) ? portMAX_DELAY : (xTicksToWait - elapsed));
     }
+    BT_METRICS(mMetrics.queued((ch == 0) ? EBTChannel::Main : EBTChannel::Second));
+    if (!mTxBell.exchange(true))
+    {
+        // A full task queue is not waited for: the task polls the rings while they are not empty
+        if (!sendCmd(MSG_TX_RING, 0, 0, 0))
+            mTxBell.store(false);
+    }
+    return true;
 }
+#endif
 
 /**
  * @brief Send data via BLE
@@ -1163,13 +3272,246 @@ endTask:
  */
 bool CBTTask::sendData(uint8_t *data, size_t size, TickType_t xTicksToWait)
 {
+#ifdef CONFIG_BLE_DATA_TX_RING
+    return ringPush(mTxRing, nullptr, 0, data, size, xTicksToWait);
+#else
     STaskMessage msg;
-    uint8_t *dt = allocNewMsg(&msg, MSG_WRITE_DATA, size, true);
+    // Account before queuing: the task may send the data before the post returns
+    txAccount(size);
+#ifdef CONFIG_BLE_DATA_COALESCE
+    if ((mCoalesceTime != 0) && (mCoalesceTimer != nullptr))
+    {
+        bool start = false;
+        bool res = true;
+        msg.msgBody = nullptr;
+
+        lock();
+        if ((mCoalesce.msgBody != nullptr) && (mCoalesceSize + size > mCoalesce.shortParam))
+        {
+            // No room left: queue the collected packet before starting the next one,
+            // so a pending deadline cannot send the next one first
+            coalesceTake(&msg);
+            unlock();
+            if (!postData(&msg, xTicksToWait, true))
+            {
+                // The new data is not taken either, so a retry does not send it twice
+                BT_METRICS(mMetrics.dropped(EBTChannel::Main));
+                txDone(msg.shortParam + size);
+                return false;
+            }
+            msg.msgBody = nullptr;
+            lock();
+        }
+        if (size < (size_t)(mMtu - 3))
+        {
+            if (mCoalesce.msgBody == nullptr)
+            {
+                allocBody(&mCoalesce, MSG_WRITE_DATA, mMtu - 3);
+                mCoalesceSize = 0;
+                start = true;
+            }
+            std::memcpy((uint8_t *)mCoalesce.msgBody + mCoalesceSize, data, size);
+            mCoalesceSize += size;
+            if (mCoalesceSize == mCoalesce.shortParam)
+                coalesceTake(&msg);
+            unlock();
+
+            if (start)
+                BT_METRICS(mMetrics.queued(EBTChannel::Main));
+
+            // Queue outside the lock: the task takes it to flush on the deadline
+            if ((msg.msgBody != nullptr) && !postData(&msg, xTicksToWait, true))
+            {
+                BT_METRICS(mMetrics.dropped(EBTChannel::Main));
+                txDone(msg.shortParam);
+                res = false;
+            }
+            if (start)
+                mCoalesceTimer->start(this, ETimerEvent::SendBack, mCoalesceTime);
+            return res;
+        }
+        unlock();
+    }
+#endif
+    uint8_t *dt = allocBody(&msg, MSG_WRITE_DATA, size);
     std::memcpy(dt, data, size);
-    return sendMessage(&msg, xTicksToWait, true);
+    if (!postData(&msg, xTicksToWait, true))
+    {
+        txDone(size);
+        return false;
+    }
+    BT_METRICS(mMetrics.queued(EBTChannel::Main));
+    return true;
+#endif
+}
+
+/**
+ * @brief Send data via BLE to one connection
+ * @param conn Connection handle
+ * @param data Pointer to data
+ * @param size Data size
+ * @param xTicksToWait Wait time
+ * @return true if successful, false if error
+ */
+bool CBTTask::sendDataTo(uint16_t conn, uint8_t *data, size_t size, TickType_t xTicksToWait)
+{
+    STaskMessage msg;
+    uint8_t *dt = allocBody(&msg, MSG_WRITE_DATA_TO, size + 2);
+    dt[0] = (uint8_t)conn;
+    dt[1] = (uint8_t)(conn >> 8);
+    std::memcpy(&dt[2], data, size);
+    txAccount(size + 2);
+    if (!postData(&msg, xTicksToWait, true))
+    {
+        txDone(size + 2);
+        return false;
+    }
+    BT_METRICS(mMetrics.queued(txChannel(&msg)));
+    return true;
+}
+
+#ifdef CONFIG_BLE_DATA_COALESCE
+/**
+ * @brief Take the collected packet out of the coalescing buffer
+ *
+ * Must be called under lock().
+ *
+ * @param msg Receives the packet (msgBody is nullptr if the buffer is empty)
+ */
+void CBTTask::coalesceTake(STaskMessage *msg)
+{
+    *msg = mCoalesce;
+    msg->shortParam = mCoalesceSize;
+    mCoalesce.msgBody = nullptr;
+    mCoalesceSize = 0;
+}
+#endif
+
+/**
+ * @brief Allocate a transmit mbuf with room for the payload
+ * @param size Payload size
+ * @param data Receives the pointer to the payload area
+ * @return Mbuf or nullptr
+ */
+struct os_mbuf *CBTTask::allocMbuf(uint16_t size, uint8_t **data)
+{
+    struct os_mbuf *om = nullptr;
+    lock();
+    if ((mMode == EBTMode::Data) && mConnect)
+    {
+        om = ble_hs_mbuf_att_pkt(); // Leading space reserved for ACL/L2CAP/ATT headers
+        if (om != nullptr)
+        {
+            *data = (uint8_t *)os_mbuf_extend(om, size);
+            if (*data == nullptr)
+            {
+                // Payload does not fit in one contiguous block
+                os_mbuf_free_chain(om);
+                om = nullptr;
+            }
+        }
+    }
+    unlock();
+    return om;
+}
+
+/**
+ * @brief Allocate a transmit mbuf for the main channel
+ * @param size Payload size
+ * @param data Receives the pointer to the payload area
+ * @return Mbuf or nullptr
+ */
+struct os_mbuf *CBTTask::allocTxBuffer(uint16_t size, uint8_t **data)
+{
+#ifdef CONFIG_BLE_DATA_FRAMED
+    // Single fragment frame; the sequence number is set when sending
+    uint8_t *dt;
+    if (size + 3 > mMtu - 3)
+        return nullptr;
+    struct os_mbuf *om = allocMbuf(size + 3, &dt);
+    if (om != nullptr)
+    {
+        dt[1] = (uint8_t)size;
+        dt[2] = (uint8_t)(size >> 8);
+        *data = &dt[3];
+    }
+    return om;
+#else
+    return allocMbuf(size, data);
+#endif
+}
+
+/**
+ * @brief Send a caller-filled mbuf via BLE
+ * @param om Buffer from allocTxBuffer
+ * @param xTicksToWait Wait time
+ * @return true if successful, false if error
+ */
+bool CBTTask::sendBuffer(struct os_mbuf *om, TickType_t xTicksToWait)
+{
+    STaskMessage msg;
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    msg.msgID = MSG_WRITE_MBUF;
+    msg.shortParam = mTxGen;
+    msg.msgBody = om;
+    mTxMbufBytes.fetch_add(len);
+    txAccount(len);
+    if (postData(&msg, xTicksToWait, false))
+    {
+        BT_METRICS(mMetrics.queued(txChannel(&msg)));
+        return true;
+    }
+    txDone(len, true);
+    os_mbuf_free_chain(om);
+    return false;
 }
 
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+/**
+ * @brief Allocate a transmit mbuf for the second channel
+ * @param index Data index
+ * @param size Payload size
+ * @param data Receives the pointer to the payload area
+ * @return Mbuf or nullptr
+ */
+struct os_mbuf *CBTTask::allocTxBuffer2(uint16_t index, uint16_t size, uint8_t **data)
+{
+    uint8_t *dt;
+    struct os_mbuf *om = allocMbuf(size + 2, &dt);
+    if (om != nullptr)
+    {
+        dt[0] = (uint8_t)index;
+        dt[1] = (uint8_t)(index >> 8);
+        *data = &dt[2];
+    }
+    return om;
+}
+
+/**
+ * @brief Send a caller-filled mbuf via the second BLE channel
+ * @param om Buffer from allocTxBuffer2
+ * @param xTicksToWait Wait time
+ * @return true if successful, false if error
+ */
+bool CBTTask::sendBuffer2(struct os_mbuf *om, TickType_t xTicksToWait)
+{
+    STaskMessage msg;
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    msg.msgID = MSG_WRITE_MBUF2;
+    msg.shortParam = mTxGen;
+    msg.msgBody = om;
+    mTxMbufBytes.fetch_add(len);
+    txAccount(len);
+    if (postData(&msg, xTicksToWait, false))
+    {
+        BT_METRICS(mMetrics.queued(txChannel(&msg)));
+        return true;
+    }
+    txDone(len, true);
+    os_mbuf_free_chain(om);
+    return false;
+}
+
 /**
  * @brief Send data via the second BLE channel
  * @param data Pointer to data
@@ -1180,11 +3522,86 @@ bool CBTTask::sendData(uint8_t *data, size_t size, TickType_t xTicksToWait)
  */
 bool CBTTask::sendData2(uint8_t *data, size_t size, uint16_t index, TickType_t xTicksToWait)
 {
+#ifdef CONFIG_BLE_DATA_TX_RING
+    uint8_t hdr[2] = {(uint8_t)index, (uint8_t)(index >> 8)};
+    return ringPush(mTxRing2, hdr, 2, data, size, xTicksToWait);
+#else
     STaskMessage msg;
-    uint8_t *dt = allocNewMsg(&msg, MSG_WRITE_DATA2, size + 2, true);
+    uint8_t *dt = allocBody(&msg, MSG_WRITE_DATA2, size + 2);
     std::memcpy(&dt[2], data, size);
     dt[0] = (uint8_t)index;
     dt[1] = (uint8_t)(index >> 8);
+    txAccount(size + 2);
+    if (!postData(&msg, xTicksToWait, true))
+    {
+        txDone(size + 2);
+        return false;
+    }
+    BT_METRICS(mMetrics.queued(txChannel(&msg)));
+    return true;
+#endif
+}
+#endif
+
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+/**
+ * @brief Set the scan timing
+ *
+ * The interval and window are checked against the range of the HCI scan
+ * parameters (2.5 ms to 10.24 s) before the conversion to 0.625 ms units.
+ *
+ * @param interval Scan interval in ms
+ * @param window Scan window in ms
+ * @param scanTime Scan time of a duty cycle in ms
+ * @param sleepTime Sleep time between scans in ms
+ * @param xTicksToWait Wait time
+ * @return true if successful, false if error
+ */
+bool CBTTask::setScanTiming(uint16_t interval, uint16_t window, uint32_t scanTime, uint32_t sleepTime, TickType_t xTicksToWait)
+{
+    STaskMessage msg;
+
+    if (scanTime == 0)
+        return false;
+    if ((interval == 0) != (window == 0))
+        return false; // The default of one could conflict with the other
+    if ((interval != 0) && ((interval < 3) || (interval > 10240) || (window < 3) || (window > interval)))
+        return false;
+
+    // Body: interval and window in 0.625 ms units, scan time, sleep time
+    uint32_t *dt = (uint32_t *)allocNewMsg(&msg, MSG_SCAN_TIMING, 12, true);
+    dt[0] = ((uint32_t)interval * 1000 / 625) | (((uint32_t)window * 1000 / 625) << 16);
+    dt[1] = scanTime;
+    dt[2] = sleepTime;
+    return sendMessage(&msg, xTicksToWait, true);
+}
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+/**
+ * @brief Set the filter accept list of the controller
+ * @param macs Public addresses
+ * @param count Number of addresses
+ * @param xTicksToWait Wait time
+ * @return true if successful, false if error
+ */
+bool CBTTask::setAcceptList(const std::array<uint8_t, 6> *macs, uint8_t count, TickType_t xTicksToWait)
+{
+    STaskMessage msg;
+    if ((macs == nullptr) || (count == 0))
+    {
+        msg.msgID = MSG_SCAN_ACCEPT;
+        msg.msgBody = nullptr;
+        msg.shortParam = 0;
+    }
+    else
+    {
+        if (count > CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE)
+            return false;
+        uint8_t *dt = allocNewMsg(&msg, MSG_SCAN_ACCEPT, count * 6, true);
+        for (uint8_t i = 0; i < count; i++)
+            std::memcpy(&dt[i * 6], macs[i].data(), 6);
+    }
     return sendMessage(&msg, xTicksToWait, true);
 }
 #endif
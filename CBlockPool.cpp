@@ -0,0 +1,134 @@
+/*!
+    \file
+    \brief Fixed-size block pools for message bodies.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CBlockPool.h"
+#include "esp_heap_caps.h"
+#include <cstring>
+
+/**
+ * @brief Constructor for the CBlockPool class
+ *
+ * @param sizes Block sizes in ascending order
+ * @param counts Number of blocks of each size
+ * @param n Number of sizes
+ * @param psram Place the blocks in PSRAM
+ */
+CBlockPool::CBlockPool(const uint16_t *sizes, const uint16_t *counts, uint8_t n, bool psram)
+{
+    uint32_t caps = psram ? (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT) : (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+
+    for (uint8_t i = 0; (i < n) && (mCount < BLOCKPOOL_MAX); i++)
+    {
+        if (counts[i] == 0)
+            continue;
+        SPool *pool = &mPools[mCount];
+        pool->region = (uint8_t *)heap_caps_malloc((size_t)sizes[i] * counts[i], caps);
+        if (pool->region == nullptr)
+            continue; // The heap serves this size
+        std::memset(&pool->stats, 0, sizeof(pool->stats));
+        pool->stats.size = sizes[i];
+        pool->stats.count = counts[i];
+        pool->stats.free = counts[i];
+        pool->stats.minFree = counts[i];
+
+        // Thread the free list through the blocks
+        pool->head = nullptr;
+        for (int k = counts[i] - 1; k >= 0; k--)
+        {
+            void *block = &pool->region[(size_t)k * sizes[i]];
+            *(void **)block = pool->head;
+            pool->head = block;
+        }
+        mCount++;
+    }
+}
+
+/**
+ * @brief Destructor for the CBlockPool class
+ */
+CBlockPool::~CBlockPool()
+{
+    for (uint8_t i = 0; i < mCount; i++)
+        heap_caps_free(mPools[i].region);
+}
+
+/**
+ * @brief Take a block
+ *
+ * @param size Requested size in bytes
+ * @return Block or heap memory
+ */
+void *CBlockPool::alloc(size_t size)
+{
+    void *block = nullptr;
+
+    portENTER_CRITICAL(&mMux);
+    for (uint8_t i = 0; i < mCount; i++)
+    {
+        SPool *pool = &mPools[i];
+        if (size > pool->stats.size)
+            continue;
+        if (pool->head == nullptr)
+            break; // Larger blocks are kept for larger requests
+        block = pool->head;
+        pool->head = *(void **)block;
+        pool->stats.allocs++;
+        if (--pool->stats.free < pool->stats.minFree)
+            pool->stats.minFree = pool->stats.free;
+        break;
+    }
+    if (block == nullptr)
+        mFallbacks++;
+    portEXIT_CRITICAL(&mMux);
+
+    if (block == nullptr)
+        block = pvPortMalloc(size);
+    return block;
+}
+
+/**
+ * @brief Return a block
+ *
+ * @param ptr Block from alloc()
+ */
+void CBlockPool::free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+    for (uint8_t i = 0; i < mCount; i++)
+    {
+        SPool *pool = &mPools[i];
+        if (((uint8_t *)ptr >= pool->region) && ((uint8_t *)ptr < pool->region + (size_t)pool->stats.size * pool->stats.count))
+        {
+            portENTER_CRITICAL(&mMux);
+            *(void **)ptr = pool->head;
+            pool->head = ptr;
+            pool->stats.free++;
+            portEXIT_CRITICAL(&mMux);
+            return;
+        }
+    }
+    vPortFree(ptr);
+}
+
+/**
+ * @brief Get the usage of the pools
+ *
+ * @param stats Receives BLOCKPOOL_MAX entries
+ * @param fallbacks Receives the number of requests served by the heap
+ * @return Number of pools
+ */
+uint8_t CBlockPool::getStats(SBlockPoolStats *stats, uint32_t *fallbacks)
+{
+    portENTER_CRITICAL(&mMux);
+    for (uint8_t i = 0; i < mCount; i++)
+        stats[i] = mPools[i].stats;
+    if (fallbacks != nullptr)
+        *fallbacks = mFallbacks;
+    portEXIT_CRITICAL(&mMux);
+    return mCount;
+}
@@ -113,6 +113,29 @@ void CMacStore::addMac(SMac *mac)
     // If mMacEnable is false, the data is simply ignored.
 }
 
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+/**
+ * @brief Load the whitelist into the controller
+ *
+ * Copies the whitelist into an array and sends it to the BT task. The filter
+ * in addMac() stays, so reports received before the list is applied are
+ * still checked.
+ *
+ * @return true if the command is sent successfully
+ */
+bool CMacStore::pushWhiteList()
+{
+    std::array<uint8_t, 6> macs[CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE];
+    uint8_t count = 0;
+
+    if ((mWhiteList == nullptr) || (mWhiteList->size() > CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE))
+        return false;
+    for (auto &var : *mWhiteList)
+        macs[count++] = var;
+    return CBTTask::Instance()->setAcceptList(macs, count);
+}
+#endif
+
 /**
  * @brief Calculate changes in scan data
  *
@@ -332,6 +355,7 @@ json CMacStore::getJSON()
         }
         j["mac"] = str;       // Add the formatted MAC string to the JSON object
         j["rssi"] = var.rssi; // Add the RSSI value
+        j["type"] = var.type; // Add the address type
         beacon.push_back(j);  // Add this MAC's JSON object to the main array
     }
 
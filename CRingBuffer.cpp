@@ -0,0 +1,146 @@
+/*!
+    \file
+    \brief Lock-free single producer/single consumer ring of packets.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CRingBuffer.h"
+#include <cstring>
+
+#define RING_HDR_SIZE (2)      ///< Length prefix size
+#define RING_WRAP (0xffff)     ///< Length marking the unused end of the storage
+
+/**
+ * @brief Constructor for the CRingBuffer class
+ *
+ * @param size Storage size in bytes
+ */
+CRingBuffer::CRingBuffer(uint32_t size) : mSize(size)
+{
+    mBuffer = new uint8_t[size];
+}
+
+/**
+ * @brief Destructor for the CRingBuffer class
+ */
+CRingBuffer::~CRingBuffer()
+{
+    delete[] mBuffer;
+}
+
+/**
+ * @brief Reserve room for a packet
+ *
+ * A packet never wraps around the end of the storage. If it does not fit
+ * there, the rest of the storage is marked as unused and the packet is
+ * written from the beginning. One byte is always kept free so that equal
+ * positions mean an empty ring.
+ *
+ * @param size Packet size
+ * @return Pointer to the packet area or nullptr if there is no room
+ */
+uint8_t *CRingBuffer::reserve(uint16_t size)
+{
+    uint32_t need = RING_HDR_SIZE + size;
+    uint32_t tail = mTail.load(std::memory_order_relaxed);
+    uint32_t head = mHead.load(std::memory_order_acquire);
+    uint32_t pos;
+
+    if (tail >= head)
+    {
+        if (need <= mSize - tail - ((head == 0) ? 1 : 0))
+        {
+            pos = tail;
+        }
+        else if (need < head)
+        {
+            // Mark the end as unused; fewer than 2 bytes left means the same
+            if (mSize - tail >= RING_HDR_SIZE)
+            {
+                mBuffer[tail] = (uint8_t)RING_WRAP;
+                mBuffer[tail + 1] = (uint8_t)(RING_WRAP >> 8);
+            }
+            pos = 0;
+        }
+        else
+            return nullptr;
+    }
+    else if (need < head - tail)
+    {
+        pos = tail;
+    }
+    else
+        return nullptr;
+
+    mBuffer[pos] = (uint8_t)size;
+    mBuffer[pos + 1] = (uint8_t)(size >> 8);
+    mReserved = pos + need;
+    if (mReserved == mSize)
+        mReserved = 0;
+    return &mBuffer[pos + RING_HDR_SIZE];
+}
+
+/**
+ * @brief Publish the packet from reserve()
+ */
+void CRingBuffer::commit()
+{
+    mTail.store(mReserved, std::memory_order_release);
+}
+
+/**
+ * @brief Append a packet
+ *
+ * @param hdr Header (can be nullptr)
+ * @param hsize Header size
+ * @param data Data
+ * @param size Data size
+ * @return true if the packet is stored
+ */
+bool CRingBuffer::push(const uint8_t *hdr, uint16_t hsize, const uint8_t *data, uint16_t size)
+{
+    uint8_t *dt = reserve(hsize + size);
+    if (dt == nullptr)
+        return false;
+    if (hsize != 0)
+        std::memcpy(dt, hdr, hsize);
+    std::memcpy(&dt[hsize], data, size);
+    commit();
+    return true;
+}
+
+/**
+ * @brief Get the oldest packet
+ *
+ * @param size Receives the packet size
+ * @return Pointer to the packet or nullptr
+ */
+uint8_t *CRingBuffer::front(uint16_t &size)
+{
+    uint32_t head = mHead.load(std::memory_order_relaxed);
+    uint32_t tail = mTail.load(std::memory_order_acquire);
+
+    if (head == tail)
+        return nullptr;
+    if ((mSize - head < RING_HDR_SIZE) || ((mBuffer[head] | (mBuffer[head + 1] << 8)) == RING_WRAP))
+    {
+        // The producer continued from the beginning
+        head = 0;
+        mHead.store(head, std::memory_order_release);
+    }
+    mFrontSize = mBuffer[head] | (mBuffer[head + 1] << 8);
+    size = mFrontSize;
+    return &mBuffer[head + RING_HDR_SIZE];
+}
+
+/**
+ * @brief Release the packet returned by front()
+ */
+void CRingBuffer::pop()
+{
+    uint32_t head = mHead.load(std::memory_order_relaxed) + RING_HDR_SIZE + mFrontSize;
+    if (head == mSize)
+        head = 0;
+    mHead.store(head, std::memory_order_release);
+}
@@ -0,0 +1,155 @@
+/*!
+    \file
+    \brief Resolution of resolvable private addresses.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CRpaResolver.h"
+#include "host/ble_store.h"
+#include "mbedtls/aes.h"
+#include <cstring>
+
+#define RPA_UNKNOWN (0xfe) ///< Cached address that matches no IRK
+#define RPA_EMPTY (0xff)   ///< Free cache entry
+
+/**
+ * @brief Constructor for the CRpaResolver class
+ *
+ * @param cacheSize Number of cached addresses
+ * @param maxIrk Maximum number of bonded peers
+ */
+CRpaResolver::CRpaResolver(uint16_t cacheSize, uint8_t maxIrk) : mIrkCount(0), mIrkMax(maxIrk), mCacheSize(cacheSize)
+{
+    mIrk = new SIrk[maxIrk];
+    mCache = new SCache[cacheSize];
+    for (uint16_t i = 0; i < cacheSize; i++)
+        mCache[i].irk = RPA_EMPTY;
+}
+
+/**
+ * @brief Destructor for the CRpaResolver class
+ */
+CRpaResolver::~CRpaResolver()
+{
+    delete[] mCache;
+    delete[] mIrk;
+}
+
+/**
+ * @brief Reload the IRKs of the bonded peers
+ */
+void CRpaResolver::load()
+{
+    ble_addr_t *peers = new ble_addr_t[mIrkMax];
+    SIrk *irk = new SIrk[mIrkMax];
+    int num = 0;
+    uint8_t count = 0;
+
+    if (ble_store_util_bonded_peers(peers, &num, mIrkMax) != 0)
+        num = 0;
+    for (int i = 0; i < num; i++)
+    {
+        struct ble_store_key_sec key;
+        struct ble_store_value_sec value;
+        std::memset(&key, 0, sizeof(key));
+        key.peer_addr = peers[i];
+        if ((ble_store_read_peer_sec(&key, &value) != 0) || !value.irk_present)
+            continue;
+        for (int k = 0; k < 16; k++)
+            irk[count].key[k] = value.irk[15 - k]; // The store keeps the IRK least significant byte first
+        irk[count].id = peers[i];
+        count++;
+    }
+
+    if ((count != mIrkCount) || (std::memcmp(irk, mIrk, sizeof(SIrk) * count) != 0))
+    {
+        std::memcpy(mIrk, irk, sizeof(SIrk) * count);
+        mIrkCount = count;
+        for (uint16_t i = 0; i < mCacheSize; i++)
+            mCache[i].irk = RPA_EMPTY;
+    }
+    delete[] irk;
+    delete[] peers;
+}
+
+/**
+ * @brief Check an address against an IRK
+ *
+ * Computes ah(IRK, prand) = e(IRK, 0...0 || prand) mod 2^24 and compares it
+ * with the hash part of the address (Core Spec Vol 3 Part H 2.2.2).
+ *
+ * @param key IRK, most significant byte first
+ * @param rpa Address, least significant byte first
+ * @return true if the address was generated with the IRK
+ */
+bool CRpaResolver::match(const uint8_t *key, const uint8_t *rpa)
+{
+    uint8_t in[16] = {0};
+    uint8_t out[16];
+    mbedtls_aes_context ctx;
+
+    in[13] = rpa[5];
+    in[14] = rpa[4];
+    in[15] = rpa[3];
+    mbedtls_aes_init(&ctx);
+    mbedtls_aes_setkey_enc(&ctx, key, 128);
+    mbedtls_aes_crypt_ecb(&ctx, MBEDTLS_AES_ENCRYPT, in, out);
+    mbedtls_aes_free(&ctx);
+    return (out[15] == rpa[0]) && (out[14] == rpa[1]) && (out[13] == rpa[2]);
+}
+
+/**
+ * @brief Resolve an address
+ *
+ * A miss replaces the least recently used cache entry.
+ *
+ * @param rpa Resolvable private address
+ * @param id Receives the identity address
+ * @return true if the address belongs to a bonded peer
+ */
+bool CRpaResolver::resolve(const uint8_t *rpa, ble_addr_t *id)
+{
+    SCache *victim = &mCache[0];
+    uint8_t irk = RPA_UNKNOWN;
+
+    if (mIrkCount == 0)
+        return false;
+    mClock++;
+    for (uint16_t i = 0; i < mCacheSize; i++)
+    {
+        SCache *c = &mCache[i];
+        if (c->irk == RPA_EMPTY)
+        {
+            if (victim->irk != RPA_EMPTY)
+                victim = c;
+            continue;
+        }
+        if (std::memcmp(c->rpa, rpa, 6) == 0)
+        {
+            c->used = mClock;
+            if (c->irk == RPA_UNKNOWN)
+                return false;
+            *id = mIrk[c->irk].id;
+            return true;
+        }
+        if ((victim->irk != RPA_EMPTY) && ((int32_t)(c->used - victim->used) < 0))
+            victim = c;
+    }
+
+    for (uint8_t k = 0; k < mIrkCount; k++)
+    {
+        if (match(mIrk[k].key, rpa))
+        {
+            irk = k;
+            break;
+        }
+    }
+    std::memcpy(victim->rpa, rpa, 6);
+    victim->irk = irk;
+    victim->used = mClock;
+    if (irk == RPA_UNKNOWN)
+        return false;
+    *id = mIrk[irk].id;
+    return true;
+}
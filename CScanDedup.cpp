@@ -0,0 +1,126 @@
+/*!
+    \file
+    \brief Suppression of repeated scan reports.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CScanDedup.h"
+#include <cstring>
+
+/**
+ * @brief FNV-1a hash step
+ * @param h Hash
+ * @param data Bytes
+ * @param len Number of bytes
+ * @return Updated hash
+ */
+static inline uint32_t fnv1a(uint32_t h, const uint8_t *data, uint8_t len)
+{
+    for (uint8_t i = 0; i < len; i++)
+    {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Constructor for the CScanDedup class
+ *
+ * @param size Number of slots
+ * @param window Suppression window in ms
+ * @param rssiDelta RSSI threshold in dB
+ */
+CScanDedup::CScanDedup(uint16_t size, uint32_t window, uint8_t rssiDelta) : mWindow(window), mRssiDelta(rssiDelta)
+{
+    uint32_t n = SCANDEDUP_PROBE;
+    while (n < size)
+        n <<= 1;
+    mMask = n - 1;
+    mTable = new SEntry[n];
+    clear();
+}
+
+/**
+ * @brief Destructor for the CScanDedup class
+ */
+CScanDedup::~CScanDedup()
+{
+    delete[] mTable;
+}
+
+/**
+ * @brief Forget all reports
+ */
+void CScanDedup::clear()
+{
+    std::memset(mTable, 0, sizeof(SEntry) * (mMask + 1));
+}
+
+/**
+ * @brief Check a report
+ *
+ * The home slot comes from a hash of the address. Up to SCANDEDUP_PROBE
+ * slots after it are searched for the same address; the payload hash is
+ * compared only then. A new device takes the first free or expired slot
+ * of that range, or the oldest one if all of them are live.
+ *
+ * @param addr Advertiser address
+ * @param addrType Address type
+ * @param data Advertising data
+ * @param len Data length
+ * @param rssi RSSI in dBm
+ * @param now Current time in ms
+ * @return true if the report must be forwarded
+ */
+bool CScanDedup::check(const uint8_t *addr, uint8_t addrType, const uint8_t *data, uint8_t len, int8_t rssi, uint32_t now)
+{
+    uint32_t window = mWindow;
+    if (window == 0)
+        return true;
+
+    uint32_t home = fnv1a(2166136261u, &addrType, 1);
+    home = fnv1a(home, addr, 6);
+    uint32_t hash = fnv1a(2166136261u, data, len);
+
+    SEntry *victim = nullptr;
+    uint32_t age = 0;
+    for (uint32_t i = 0; i < SCANDEDUP_PROBE; i++)
+    {
+        SEntry *e = &mTable[(home + i) & mMask];
+        uint32_t elapsed = now - e->time;
+        if (e->used && (e->addrType == addrType) && (std::memcmp(e->addr, addr, 6) == 0))
+        {
+            int delta = (int)rssi - (int)e->rssi;
+            if (delta < 0)
+                delta = -delta;
+            if ((e->hash == hash) && (elapsed < window) && ((mRssiDelta == 0) || (delta < mRssiDelta)))
+                return false;
+            e->hash = hash;
+            e->time = now;
+            e->rssi = rssi;
+            return true;
+        }
+        if (!e->used || (elapsed >= window))
+        {
+            if ((victim == nullptr) || (age != UINT32_MAX))
+            {
+                victim = e; // Free slots win over live ones
+                age = UINT32_MAX;
+            }
+        }
+        else if ((victim == nullptr) || (elapsed > age))
+        {
+            victim = e;
+            age = elapsed;
+        }
+    }
+    std::memcpy(victim->addr, addr, 6);
+    victim->addrType = addrType;
+    victim->used = 1;
+    victim->hash = hash;
+    victim->time = now;
+    victim->rssi = rssi;
+    return true;
+}
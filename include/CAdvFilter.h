@@ -0,0 +1,217 @@
+/*!
+    \file
+    \brief Compiled filter of advertising reports.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include <cstdint>
+#include <cstddef>
+
+#define ADVFILTER_PATTERN (24) ///< Maximum pattern length in bytes.
+#define ADVFILTER_TYPES (8)    ///< Maximum number of distinct AD types in a rule set.
+#define ADVFILTER_NONE (0xff)  ///< Field offset that is not extracted.
+
+/// What to do with a matching advertisement.
+enum class EAdvAction : uint8_t
+{
+    Drop,   ///< Do not report.
+    Mac,    ///< Report the address and RSSI.
+    Beacon  ///< Report the fields extracted by the rule as a beacon.
+};
+
+/**
+ * @brief Filter rule
+ *
+ * All set conditions must hold. The pattern is compared with the data of
+ * the first AD structure of type adType, at offset or, if anyPosition is
+ * set, at every multiple of length (lists of service UUIDs). Beacon fields
+ * are taken from the same AD structure; major and minor are big-endian.
+ */
+struct SAdvRule
+{
+    EAdvAction action;                 ///< Action on a match
+    uint8_t adType;                    ///< AD type of the pattern (0 - no pattern)
+    uint8_t offset;                    ///< Pattern offset in the AD data
+    uint8_t length;                    ///< Pattern length (up to ADVFILTER_PATTERN)
+    bool anyPosition;                  ///< Search the whole AD data with a step of length
+    uint8_t value[ADVFILTER_PATTERN];  ///< Pattern
+    uint8_t mask[ADVFILTER_PATTERN];   ///< Pattern mask (1 bits are compared)
+    uint8_t addrTypes;                 ///< Bit mask of accepted BLE_ADDR_* types (0 - any)
+    int8_t rssiMin;                    ///< Lowest accepted RSSI in dBm (-128 - any)
+    uint8_t idOffset;                  ///< Offset of the 16-byte identifier (ADVFILTER_NONE - zeros)
+    uint8_t majorOffset;               ///< Offset of major (ADVFILTER_NONE - 0)
+    uint8_t minorOffset;               ///< Offset of minor (ADVFILTER_NONE - 0)
+    uint8_t powerOffset;               ///< Offset of the calibrated power (ADVFILTER_NONE - 0)
+};
+
+/**
+ * @brief Result of a match
+ */
+struct SAdvMatch
+{
+    EAdvAction action; ///< Action of the matching rule or the default action
+    uint8_t id[16];    ///< Identifier (EAdvAction::Beacon)
+    uint16_t major;    ///< Major (EAdvAction::Beacon)
+    uint16_t minor;    ///< Minor (EAdvAction::Beacon)
+    int8_t power;      ///< Calibrated power (EAdvAction::Beacon)
+};
+
+/**
+ * @brief Filter of raw advertising data
+ *
+ * Rules are compiled into a flat table: masked patterns, a slot per
+ * distinct AD type and the minimum AD length each rule needs. match()
+ * walks the AD structures of a report once, then checks the rules in
+ * order; the first match wins. No memory is allocated while matching.
+ * setRules() may be called from any task while the scanner runs: only
+ * the table pointer and a user count are taken under the lock, and a
+ * replaced table is freed by whichever side finishes with it last.
+ */
+class CAdvFilter
+{
+protected:
+    /// Compiled rule.
+    struct SCompiled
+    {
+        uint8_t value[ADVFILTER_PATTERN]; ///< Pattern with the mask applied
+        uint8_t mask[ADVFILTER_PATTERN];  ///< Pattern mask
+        uint8_t slot;                     ///< AD type slot (ADVFILTER_NONE - no pattern)
+        uint8_t offset;                   ///< Pattern offset
+        uint8_t length;                   ///< Pattern length
+        uint8_t step;                     ///< Search step (0 - fixed offset)
+        uint8_t need;                     ///< Minimum AD data length
+        uint8_t addrTypes;                ///< Bit mask of accepted address types
+        int8_t rssiMin;                   ///< Lowest accepted RSSI
+        EAdvAction action;                ///< Action
+        uint8_t extract[4];               ///< Offsets of id, major, minor and power
+    };
+
+    /// Rule table.
+    struct STable
+    {
+        uint8_t slotOf[256]; ///< Slot of each AD type (ADVFILTER_NONE - not used)
+        uint8_t count;       ///< Number of rules
+        SCompiled *rules;    ///< Rules
+        uint8_t users;       ///< match() calls using the table (under mMux)
+        bool retired;        ///< Replaced; freed by the last user (under mMux)
+    };
+
+    STable *mTable = nullptr;                           ///< Active table (nullptr - no rules)
+    EAdvAction mDefault = EAdvAction::Drop;             ///< Action when no rule matches
+    portMUX_TYPE mMux = portMUX_INITIALIZER_UNLOCKED;   ///< Table lock
+
+    /**
+     * @brief Free a rule table
+     *
+     * @param[in] table Table (can be nullptr)
+     */
+    static void release(STable *table);
+
+    /**
+     * @brief Match a report against a table
+     *
+     * @param[in] table Table
+     * @param[in] data Raw advertising data
+     * @param[in] len Data length
+     * @param[in] addrType Advertiser address type (BLE_ADDR_*)
+     * @param[in] rssi RSSI in dBm
+     * @param[in,out] res Action and the extracted beacon fields; unchanged if no rule matches
+     */
+    static void matchTable(const STable *table, const uint8_t *data, uint8_t len, uint8_t addrType, int8_t rssi, SAdvMatch *res);
+
+public:
+    /**
+     * @brief Destructor for the CAdvFilter class
+     */
+    ~CAdvFilter();
+
+    /**
+     * @brief Compile and activate a rule set
+     *
+     * @param[in] rules Rules in priority order (nullptr - remove all rules)
+     * @param[in] count Number of rules
+     * @param[in] def Action when no rule matches
+     * @return false if a rule is invalid or the rules use more than ADVFILTER_TYPES AD types
+     */
+    bool setRules(const SAdvRule *rules, uint8_t count, EAdvAction def = EAdvAction::Drop);
+
+    /**
+     * @brief Check whether rules are set
+     *
+     * @return true if match() decides about reports
+     */
+    inline bool isActive() { return mTable != nullptr; };
+
+    /**
+     * @brief Match a report
+     *
+     * @param[in] data Raw advertising data
+     * @param[in] len Data length
+     * @param[in] addrType Advertiser address type (BLE_ADDR_*)
+     * @param[in] rssi RSSI in dBm
+     * @param[out] res Action and the extracted beacon fields
+     */
+    void match(const uint8_t *data, uint8_t len, uint8_t addrType, int8_t rssi, SAdvMatch *res);
+
+    /**
+     * @brief Rule reporting iBeacons
+     *
+     * @param[in] uuid UUID prefix (nullptr - any UUID)
+     * @param[in] len Prefix length (up to 16)
+     * @return Rule
+     */
+    static SAdvRule iBeacon(const uint8_t *uuid = nullptr, uint8_t len = 0);
+
+    /**
+     * @brief Rule reporting AltBeacons
+     *
+     * @param[in] id Beacon ID prefix (nullptr - any ID)
+     * @param[in] len Prefix length (up to 16)
+     * @return Rule
+     */
+    static SAdvRule altBeacon(const uint8_t *id = nullptr, uint8_t len = 0);
+
+    /**
+     * @brief Rule reporting Eddystone-UID frames
+     *
+     * The 10-byte namespace and 6-byte instance form the identifier.
+     *
+     * @param[in] ns Namespace prefix (nullptr - any namespace)
+     * @param[in] len Prefix length (up to 10)
+     * @return Rule
+     */
+    static SAdvRule eddystoneUid(const uint8_t *ns = nullptr, uint8_t len = 0);
+
+    /**
+     * @brief Rule matching a company ID of the manufacturer specific data
+     *
+     * @param[in] id Company identifier
+     * @param[in] action Action
+     * @return Rule
+     */
+    static SAdvRule company(uint16_t id, EAdvAction action = EAdvAction::Mac);
+
+    /**
+     * @brief Rule matching a 16-bit service UUID in the service lists
+     *
+     * @param[in] uuid Service UUID
+     * @param[in] action Action
+     * @param[in] complete true - complete list (0x03), false - incomplete list (0x02)
+     * @return Rule
+     */
+    static SAdvRule service(uint16_t uuid, EAdvAction action = EAdvAction::Mac, bool complete = true);
+
+    /**
+     * @brief Rule matching the advertiser address type only
+     *
+     * @param[in] addrTypes Bit mask of BLE_ADDR_* types
+     * @param[in] action Action
+     * @return Rule
+     */
+    static SAdvRule address(uint8_t addrTypes, EAdvAction action = EAdvAction::Mac);
+};
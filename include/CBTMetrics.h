@@ -0,0 +1,271 @@
+/*!
+    \file
+    \brief Runtime metrics of the BLE data channels.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstdint>
+#include <atomic>
+
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#define BTMETRICS_CHANNELS (3) ///< Number of channels.
+#define BTMETRICS_BUCKETS (10) ///< Number of latency histogram buckets.
+#define BTMETRICS_STAMPS (64)  ///< Enqueue timestamps kept per channel (power of 2).
+#define BTMETRICS_STAGES (5)   ///< Number of echo probe stages.
+
+/// Metrics channels.
+enum class EBTChannel
+{
+    Main,   ///< Main data channel.
+    Second, ///< Second data channel.
+    Scan    ///< Advertising reports.
+};
+
+/// Stages of an echo probe.
+enum class EBTProbeStage
+{
+    Host,   ///< Copy in the NimBLE host task.
+    Queue,  ///< Wait in the data queue of the BT task.
+    TxWait, ///< Wait for mbufs or credits behind earlier notifications.
+    Notify, ///< Notify call.
+    Total   ///< From the write handler to the end of the notify call.
+};
+
+/**
+ * @brief Counters of one channel
+ */
+struct SBTChannelMetrics
+{
+    uint32_t txBytes;                     ///< Bytes passed to the stack
+    uint32_t txPackets;                   ///< Packets passed to the stack
+    uint32_t rxBytes;                     ///< Bytes received
+    uint32_t rxPackets;                   ///< Packets received
+    uint32_t errors;                      ///< Notifications rejected by the stack
+    uint32_t retries;                     ///< Send attempts deferred for lack of mbufs
+    uint32_t drops;                       ///< Packets dropped (not connected, cancelled, queue overflow)
+    uint32_t rxDrops;                     ///< Received packets dropped (task queue or receive ring full)
+    uint32_t latency[BTMETRICS_BUCKETS];  ///< Enqueue-to-send latency histogram (see CBTMetrics::bucketLimit)
+    uint32_t latencyMax;                  ///< Maximum enqueue-to-send latency in us
+};
+
+/**
+ * @brief Echo probe latency breakdown
+ */
+struct SBTProbeMetrics
+{
+    uint32_t count;                                         ///< Probes echoed
+    uint32_t latency[BTMETRICS_STAGES][BTMETRICS_BUCKETS];  ///< Histogram per EBTProbeStage (see CBTMetrics::bucketLimit)
+    uint32_t latencyMax[BTMETRICS_STAGES];                  ///< Maximum per EBTProbeStage in us
+};
+
+/**
+ * @brief Metrics snapshot
+ */
+struct SBTMetrics
+{
+    SBTChannelMetrics channel[BTMETRICS_CHANNELS]; ///< Counters indexed by EBTChannel
+    uint32_t txQueued;                             ///< Transmit bytes in flight (heap messages and streaming rings)
+    uint16_t taskQueueHigh;                        ///< Task message queue high-water mark
+    uint16_t txQueueHigh;                          ///< Queue of notifications waiting for mbufs high-water mark
+    uint32_t connects;                             ///< Connections established
+    uint32_t disconnects;                          ///< Connections lost
+    uint32_t advertiseStarts;                      ///< Advertising (re)starts
+    uint32_t scanStarts;                           ///< Scanning (re)starts
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    uint32_t intervalFast;                         ///< Short connection interval requests
+    uint32_t intervalSlow;                         ///< Long connection interval requests
+    uint32_t trafficRate;                          ///< Traffic of the last measurement window in bytes/s
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    uint32_t scanSuppressed;                       ///< Scan reports suppressed as repeats
+#endif
+#ifdef CONFIG_BLE_DATA_PROBE
+    SBTProbeMetrics probe;                         ///< Echo probes
+#endif
+};
+
+/**
+ * @brief Collector of BLE channel metrics
+ *
+ * Each counter has a single writer task, so updates are plain increments.
+ * Snapshots are taken without locks and may be slightly inconsistent
+ * between fields. Latency is measured by matching enqueue and send events
+ * of a channel in FIFO order.
+ */
+class CBTMetrics
+{
+protected:
+    SBTMetrics mData;                                           ///< Counters
+    std::atomic<uint32_t> mStampIn[2];                          ///< Enqueued packets of the data channels
+    std::atomic<uint32_t> mStampOut[2];                         ///< Finished packets of the data channels
+    uint32_t mStamps[2][BTMETRICS_STAMPS];                      ///< Enqueue times in us
+    static const uint32_t bucketLimit[BTMETRICS_BUCKETS - 1];   ///< Upper bounds of the latency buckets in us
+
+    /**
+     * @brief Take the enqueue time of the oldest packet of a channel
+     *
+     * @param[in] ch Channel
+     * @param[out] stamp Enqueue time
+     * @return true if a time is available
+     */
+    bool stampPop(EBTChannel ch, uint32_t &stamp);
+
+    /**
+     * @brief Add a sample to a latency histogram
+     *
+     * @param[in,out] hist Histogram of BTMETRICS_BUCKETS entries
+     * @param[in,out] max Maximum
+     * @param[in] latency Latency in us
+     */
+    static void histogram(uint32_t *hist, uint32_t &max, uint32_t latency);
+
+    /**
+     * @brief Convert a latency histogram to JSON
+     *
+     * @param[in] hist Histogram of BTMETRICS_BUCKETS entries
+     * @return JSON array
+     */
+    static json histJSON(const uint32_t *hist);
+
+public:
+    /**
+     * @brief Constructor for the CBTMetrics class
+     */
+    CBTMetrics();
+
+    /**
+     * @brief Reset all counters
+     */
+    void reset();
+
+    /**
+     * @brief Register a packet accepted for transmission (producer)
+     *
+     * @param[in] ch Data channel
+     */
+    void queued(EBTChannel ch);
+
+    /**
+     * @brief Register a packet passed to the stack (BT task)
+     *
+     * @param[in] ch Data channel
+     * @param[in] bytes Packet size
+     * @param[in] error Stack error code (0 - sent)
+     */
+    void sent(EBTChannel ch, uint32_t bytes, int error);
+
+    /**
+     * @brief Register a dropped packet
+     *
+     * @param[in] ch Channel
+     */
+    void dropped(EBTChannel ch);
+
+    /**
+     * @brief Forget packets that left without being counted (e.g. a cleared ring)
+     *
+     * @param[in] ch Data channel
+     */
+    inline void flush(EBTChannel ch) { mStampOut[(int)ch].store(mStampIn[(int)ch].load()); };
+
+    /**
+     * @brief Register a send attempt deferred for lack of mbufs
+     *
+     * @param[in] ch Data channel
+     */
+    inline void retry(EBTChannel ch) { mData.channel[(int)ch].retries++; };
+
+    /**
+     * @brief Register a received packet
+     *
+     * @param[in] ch Channel
+     * @param[in] bytes Packet size
+     */
+    inline void received(EBTChannel ch, uint32_t bytes)
+    {
+        mData.channel[(int)ch].rxPackets++;
+        mData.channel[(int)ch].rxBytes += bytes;
+    };
+
+    /**
+     * @brief Register a dropped received packet
+     *
+     * @param[in] ch Channel
+     */
+    inline void rxDropped(EBTChannel ch) { mData.channel[(int)ch].rxDrops++; };
+
+    /**
+     * @brief Update the queue high-water marks
+     *
+     * @param[in] task Messages in the task queue
+     * @param[in] tx Notifications waiting for mbufs
+     */
+    inline void queueDepth(uint16_t task, uint16_t tx)
+    {
+        if (task > mData.taskQueueHigh)
+            mData.taskQueueHigh = task;
+        if (tx > mData.txQueueHigh)
+            mData.txQueueHigh = tx;
+    };
+
+    inline void connected() { mData.connects++; };          ///< Register a connection.
+    inline void disconnected() { mData.disconnects++; };    ///< Register a disconnection.
+    inline void advertising() { mData.advertiseStarts++; }; ///< Register an advertising start.
+    inline void scanning() { mData.scanStarts++; };         ///< Register a scanning start.
+
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+    /**
+     * @brief Register a measurement window of the adaptive interval
+     *
+     * @param[in] rate Traffic in bytes/s
+     */
+    inline void traffic(uint32_t rate) { mData.trafficRate = rate; };
+
+    /**
+     * @brief Register a connection interval switch
+     *
+     * @param[in] fast true for the short interval
+     */
+    inline void interval(bool fast)
+    {
+        if (fast)
+            mData.intervalFast++;
+        else
+            mData.intervalSlow++;
+    };
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+    inline void suppressed() { mData.scanSuppressed++; }; ///< Register a suppressed scan report.
+#endif
+
+#ifdef CONFIG_BLE_DATA_PROBE
+    /**
+     * @brief Register an echoed probe (BT task)
+     *
+     * @param[in] stamps Times in us: write handler entry, posted, taken by the task, notify start, notify end
+     */
+    void probe(const uint32_t *stamps);
+#endif
+
+    /**
+     * @brief Copy the counters
+     *
+     * @param[out] data Snapshot
+     */
+    void get(SBTMetrics *data);
+
+    /**
+     * @brief Convert a snapshot to JSON
+     *
+     * @param[in] data Snapshot
+     * @return A nlohmann::json object with one member per channel and the global counters
+     */
+    static json toJSON(SBTMetrics *data);
+};
@@ -19,7 +19,35 @@
 
 #include "host/ble_uuid.h"
 #include "host/ble_gatt.h"
+#ifdef CONFIG_BLE_DATA_L2CAP
+#include "host/ble_l2cap.h"
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+#include "nimble/ble.h"
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+#include "CAdvFilter.h"
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+#include "CScanDedup.h"
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+#include "CRpaResolver.h"
+#endif
 #include <array>
+#include <atomic>
+#if defined(CONFIG_BLE_DATA_TX_RING) || defined(CONFIG_BLE_DATA_RX_RING)
+#include "CRingBuffer.h"
+#endif
+#ifdef CONFIG_BLE_DATA_TX_RING
+#include "freertos/semphr.h"
+#endif
+#ifdef CONFIG_BLE_DATA_METRICS
+#include "CBTMetrics.h"
+#endif
+#ifdef CONFIG_BLE_DATA_POOL
+#include "CBlockPool.h"
+#endif
 
 #ifdef CONFIG_BLE_DATA_IBEACON_TX
 #define MSG_INIT_BEACON_TX (10) ///< Initialize iBeacon mode command.
@@ -42,12 +70,48 @@
 #define MSG_INIT_DATA2 (17)	 ///< Set callback function for receiving data from the second channel command.
 #define MSG_WRITE_DATA2 (18) ///< Message to write data to the second channel.
 #define MSG_SKIP_WRITE (19)	 ///< Cancel write to the second channel command.
+#define MSG_WRITE_MBUF2 (21) ///< Message to write an mbuf to the second channel.
+#endif
+#define MSG_WRITE_MBUF (20) ///< Message to write an mbuf to the main channel.
+#define MSG_WRITE_DATA_TO (24) ///< Message to write data to the main channel of one connection.
+#ifdef CONFIG_BLE_DATA_COALESCE
+#define MSG_COALESCE_TIMER (22) ///< Coalescing deadline timer message.
+#endif
+#ifdef CONFIG_BLE_DATA_TX_RING
+#define MSG_TX_RING (23) ///< Streaming ring doorbell.
+#endif
+#ifdef CONFIG_BLE_DATA_RX_RING
+#define MSG_RX_RING (25) ///< Receive ring doorbell.
+#endif
+#define MSG_DATA_READY (26) ///< Data queue doorbell.
+#ifdef CONFIG_BLE_DATA_PROBE
+#define MSG_PROBE (27) ///< Echo probe on the main channel.
+#endif
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+#define MSG_ADAPT_TIMER (28) ///< Traffic measurement window timer message.
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+#define MSG_SCAN_BATCH (29) ///< Scan batch is full or its deadline expired.
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+#define MSG_SCAN_ACCEPT (30) ///< Set the controller filter accept list command.
+#endif
+#ifdef CONFIG_BLE_DATA_IBEACON_SCAN
+#define MSG_SCAN_TIMING (31) ///< Set the scan timing command.
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_RANDOM
+#define SCAN_ADDR_PUBLIC (0x01) ///< Report public addresses.
+#define SCAN_ADDR_STATIC (0x02) ///< Report random static addresses.
+#define SCAN_ADDR_NRPA (0x04)	///< Report non-resolvable private addresses.
+#define SCAN_ADDR_RPA (0x08)	///< Report resolvable private addresses.
 #endif
 
 #define BTTASK_NAME "bt"			///< Task name for debugging.
 #define BTTASK_STACKSIZE (4 * 1024) ///< Task stack size.
 #define BTTASK_PRIOR (2)			///< Task priority.
-#define BTTASK_LENGTH (30)			///< Task receive queue length.
+#define BTTASK_LENGTH (30)			///< Task control queue length.
+#define BTTASK_DATALENGTH (30)		///< Task data queue length.
+#define BTTASK_TXLENGTH (30)		///< Length of the queue of notifications waiting for free mbufs.
 #ifdef CONFIG_BLE_DATA_TASK0
 #define BTTASK_CPU (0) ///< CPU core number.
 #else
@@ -101,18 +165,77 @@ struct SMac
 {
 	std::array<uint8_t, 6> mac; ///< Device MAC address (6 bytes)
 	int8_t rssi;				///< Received signal strength
+	uint8_t type;				///< Address type (BLE_ADDR_PUBLIC, BLE_ADDR_RANDOM; BLE_ADDR_PUBLIC_ID/BLE_ADDR_RANDOM_ID - identity of a resolved address)
 
 	/**
 	 * @brief Operator to compare two MAC addresses
 	 * @param other Second MAC address for comparison
-	 * @return true if MAC addresses match, false otherwise
+	 * @return true if MAC addresses and their types match, false otherwise
 	 */
 	bool operator==(const SMac &other) const
 	{
-		return this->mac == other.mac;
+		return (this->mac == other.mac) && (this->type == other.type);
 	}
 };
 
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+/**
+ * @brief Scan report of a batch
+ */
+struct SScanRecord
+{
+	bool isBeacon; ///< true - beacon is valid, false - mac is valid
+	union
+	{
+		SBeacon beacon; ///< iBeacon data
+		SMac mac;		///< Device MAC address
+	};
+};
+#endif
+
+/// Link parameter profiles negotiated after a connection.
+enum class EBTLinkProfile
+{
+	Default,	///< Keep the parameters chosen by the central.
+	Throughput, ///< 2M PHY, 251-byte PDUs, maximum MTU, 7.5-15 ms interval.
+	Balanced,	///< 2M PHY, 251-byte PDUs, maximum MTU, 30-50 ms interval.
+	LowPower	///< 1M PHY, default PDUs, 100-200 ms interval with peripheral latency.
+};
+
+/**
+ * @brief Negotiated link parameters
+ */
+struct SBTLinkInfo
+{
+	uint16_t conn;	   ///< Connection handle
+	uint8_t txPhy;	   ///< Transmit PHY (1 - 1M, 2 - 2M, 3 - Coded)
+	uint8_t rxPhy;	   ///< Receive PHY (1 - 1M, 2 - 2M, 3 - Coded)
+	uint16_t txOctets; ///< Requested maximum link layer payload
+	uint16_t mtu;	   ///< ATT MTU
+	uint16_t interval; ///< Connection interval in 1.25 ms units
+	uint16_t latency;  ///< Peripheral latency in connection events
+	uint16_t timeout;  ///< Supervision timeout in 10 ms units
+};
+
+/**
+ * @brief Data mode connection
+ */
+struct SBTConn
+{
+	uint16_t handle;   ///< Connection handle
+	uint16_t mtu;	   ///< Negotiated ATT MTU
+	uint16_t txOctets; ///< Requested maximum link layer payload
+#ifdef CONFIG_BLE_DATA_FRAMED
+	uint8_t rxSeq;		  ///< Expected sequence number of the next received fragment
+	uint16_t rxOffset;	  ///< Bytes of the current frame already received
+	STaskMessage rxFrame; ///< Frame being reassembled (msgBody is nullptr if none)
+#endif
+#ifdef CONFIG_BLE_DATA_L2CAP
+	struct ble_l2cap_chan *coc; ///< Open L2CAP CoC channel (nullptr if none)
+	bool cocStalled;			///< The channel waits for credits from the peer
+#endif
+};
+
 /// Data reception event function.
 /*!
  * \param[in] data data.
@@ -127,9 +250,23 @@ typedef void onBLEDataRx(uint8_t *data, size_t size);
  *
  * @param[in] data Pointer to the iBeacon data structure (can be nullptr)
  * @param[in] mac Pointer to the MAC address structure (can be nullptr)
+ *
+ * The callback owns the structures and releases them with CBTTask::freeBody().
  */
 typedef void onBeaconRx(SBeacon *data, SMac *mac);
 
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+/**
+ * @brief Callback function for processing a batch of scan reports
+ *
+ * Called in the BT task. The records are valid during the call only.
+ *
+ * @param[in] records Scan reports in the order of reception
+ * @param[in] count Number of records
+ */
+typedef void onScanBatch(SScanRecord *records, uint16_t count);
+#endif
+
 /**
  * @brief Callback function for processing connection events
  *
@@ -139,6 +276,36 @@ typedef void onBeaconRx(SBeacon *data, SMac *mac);
  */
 typedef void onBLEConnect(bool connected);
 
+/**
+ * @brief Callback function for link parameter changes
+ *
+ * Called in the NimBLE host task after each negotiation step (PHY, MTU,
+ * connection parameters) with the current values.
+ *
+ * @param[in] info Link parameters
+ */
+typedef void onBLELink(SBTLinkInfo *info);
+
+/**
+ * @brief Callback function for transmit backpressure
+ *
+ * Called when the bytes waiting for transmission reach the high watermark
+ * (in the sending task) or drop to the low watermark (in the BT task).
+ *
+ * @param[in] high true if the high watermark is reached, false if the low one
+ */
+typedef void onBLETxLevel(bool high);
+
+/**
+ * @brief Transmit pipeline state
+ */
+struct SBTTxStatus
+{
+	uint32_t queued;  ///< Bytes accepted by sendData()/sendData2() and not yet passed to the stack
+	uint16_t credits; ///< Notifications the mbuf pool can take right now
+	uint16_t slots;	  ///< Free entries in the task message queue
+};
+
 /// BLE data channel logic class.
 class CBTTask : public CBaseTask, CLock
 {
@@ -149,13 +316,16 @@ private:
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
 	static const ble_uuid16_t chr_uuid2; ///< Second channel UUID.
 #endif
+#ifdef CONFIG_BLE_DATA_RX_ACK
+	static const ble_uuid16_t chr_uuid_ack; ///< Receive acknowledgement UUID.
+#endif
 
 	static const struct ble_gatt_svc_def gatt_svr_svcs[]; ///< Service configuration.
 	static const struct ble_gatt_chr_def gatt_svr_chrs[]; ///< Service characteristics configuration.
 
 protected:
 	EBTMode mMode = EBTMode::Off; ///< Current operation mode.
-	bool mConnect = false;		  ///< Connection flag.
+	bool mConnect = false;		  ///< At least one connection is established.
 	onBLEDataRx *mOnRx = nullptr; ///< Callback function for receiving data on the main channel.
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
 	onBLEDataRx *mOnRx2 = nullptr; ///< Callback function for receiving data on the second channel.
@@ -163,6 +333,459 @@ protected:
 	onBLEConnect *mOnConnect = nullptr; ///< Callback function for connection events.
 
 	uint8_t own_addr_type; ///< BLE address type.
+	uint16_t mTxGen = 0;   ///< Stack generation. Mbufs queued before the last deinit are dropped.
+	uint16_t mMtu = 23;	   ///< Smallest ATT MTU of the connections.
+
+	SBTConn mConn[CONFIG_BLE_DATA_MAX_CONNECTIONS]; ///< Connection table.
+	uint8_t mConnCount = 0;							///< Number of connections.
+
+	/// Find a connection.
+	/*!
+	  \param[in] handle connection handle.
+	  \return connection or nullptr.
+	*/
+	SBTConn *connFind(uint16_t handle);
+
+	/// Add a connection.
+	/*!
+	  \param[in] handle connection handle.
+	  \return false if the table is full.
+	*/
+	bool connAdd(uint16_t handle);
+
+	/// Remove a connection.
+	/*!
+	  \param[in] handle connection handle.
+	*/
+	void connRemove(uint16_t handle);
+
+	/// Update mMtu from the connection table.
+	void connMtu();
+
+	/// Send a notification.
+	/*!
+	  \param[in] conn connection handle or BLE_HS_CONN_HANDLE_NONE for all connections.
+	  \param[in] attr attribute handle.
+	  \param[in] om payload, consumed in all cases.
+	  \return BLE_HS_ENOMEM if nothing was sent for lack of mbufs, otherwise 0 or BLE error code.
+	*/
+	int notify(uint16_t conn, uint16_t attr, struct os_mbuf *om);
+
+	/// Send a main or second channel packet to one connection.
+	/*!
+	  \param[in] handle connection handle.
+	  \param[in] attr attribute handle.
+	  \param[in] om payload, consumed in all cases.
+	  \return 0 or BLE error code.
+	*/
+	int connSend(uint16_t handle, uint16_t attr, struct os_mbuf *om);
+
+#ifdef CONFIG_BLE_DATA_L2CAP
+	/// L2CAP CoC event handler.
+	/*!
+	  \param[in] event event.
+	  \param[in] arg not used.
+	  \return 0 to accept the channel.
+	*/
+	static int ble_l2cap_event(struct ble_l2cap_event *event, void *arg);
+#endif
+
+	/// Resume advertising if it is not running.
+	static void advertiseResume();
+
+	EBTLinkProfile mLinkProfile = EBTLinkProfile::Default; ///< Profile applied to new connections.
+	onBLELink *mOnLink = nullptr;						   ///< Callback function for link parameter changes.
+
+	/// Request the link parameters of the current profile.
+	/*!
+	  Called in the NimBLE host task after a connection.
+	  \param[in] conn connection.
+	*/
+	void linkNegotiate(SBTConn *conn);
+
+	/// Report the link parameters through mOnLink.
+	/*!
+	  \param[in] handle connection handle.
+	*/
+	void linkReport(uint16_t handle);
+
+	/// Callback function for the MTU exchange.
+	/*!
+	  \param[in] conn_handle connection handle.
+	  \param[in] error exchange status.
+	  \param[in] mtu negotiated MTU.
+	  \param[in] arg not used.
+	  \return 0.
+	*/
+	static int linkMtuEvent(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg);
+
+	QueueHandle_t mDataQueue;			///< Data messages; the task queue carries control messages.
+	std::atomic<bool> mDataBell{false}; ///< MSG_DATA_READY is queued.
+
+	/// Post a data message.
+	/*!
+	  \param[in] msg message.
+	  \param[in] xTicksToWait message queue timeout time.
+	  \param[in] free_mem free the message body on failure.
+	  \return true if no error.
+	*/
+	bool postData(STaskMessage *msg, TickType_t xTicksToWait, bool free_mem);
+
+	/// Process data messages until a control message is queued.
+	void dataFlush();
+
+	/// Process a data message.
+	/*!
+	  \param[in] msg message.
+	*/
+	void dataHandle(STaskMessage *msg);
+
+	/// Check that the data queue is empty.
+	/*!
+	  \return true if there are no data messages.
+	*/
+	inline bool dataIdle() { return uxQueueMessagesWaiting(mDataQueue) == 0; };
+
+	/// Check for a transmit message.
+	/*!
+	  \param[in] id message ID.
+	  \return true if the message is sent to a data channel.
+	*/
+	static inline bool txMessage(uint16_t id)
+	{
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+		if ((id == MSG_WRITE_DATA2) || (id == MSG_WRITE_MBUF2))
+			return true;
+#endif
+#ifdef CONFIG_BLE_DATA_PROBE
+		if (id == MSG_PROBE)
+			return true;
+#endif
+		return (id == MSG_WRITE_DATA) || (id == MSG_WRITE_DATA_TO) || (id == MSG_WRITE_MBUF);
+	};
+
+	/// Check if a message carries a caller-filled mbuf.
+	/*!
+	  \param[in] id message ID.
+	  \return true for MSG_WRITE_MBUF and MSG_WRITE_MBUF2.
+	*/
+	static inline bool txMbuf(uint16_t id)
+	{
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+		if (id == MSG_WRITE_MBUF2)
+			return true;
+#endif
+		return (id == MSG_WRITE_MBUF);
+	};
+
+#ifdef CONFIG_BLE_DATA_POOL
+	static CBlockPool *mPool; ///< Message body pools. Created once and kept for the life of the program.
+#endif
+
+	/// Allocate a message body.
+	/*!
+	  The body is released by freeBody(), never by vPortFree() or sendMessage() with free_mem.
+	  \param[out] msg message.
+	  \param[in] id message ID.
+	  \param[in] size body size.
+	  \param[in] pooled take the body from the pools (if enabled).
+	  \return pointer to the body.
+	*/
+	static uint8_t *allocBody(STaskMessage *msg, uint16_t id, uint16_t size, bool pooled = true);
+
+	STaskMessage mTxQueue[BTTASK_TXLENGTH]; ///< Notifications waiting for free mbufs.
+	uint8_t mTxHead = 0;					///< Index of the first pending notification.
+	uint8_t mTxCount = 0;					///< Number of pending notifications.
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+	bool mTxSkip = false; ///< Second channel writes are cancelled until the next main channel packet.
+#endif
+
+	/// Check the mbuf pool.
+	/*!
+	  \return true if one more notification may be sent.
+	*/
+	bool txReady();
+
+	/// Free the body of a transmit message.
+	/*!
+	  \param[in] msg message.
+	*/
+	void txFree(STaskMessage *msg);
+
+	/// Try to send a transmit message.
+	/*!
+	  \param[in] msg message. The body is freed unless BLE_HS_ENOMEM is returned.
+	  \return BLE_HS_ENOMEM if the message has to wait for free mbufs, otherwise 0.
+	*/
+	int txSend(STaskMessage *msg);
+
+	/// Queue a transmit message and send pending ones.
+	/*!
+	  \param[in] msg message.
+	*/
+	void txPush(STaskMessage *msg);
+
+	/// Send pending messages while the mbuf pool has room.
+	void txFlush();
+
+	std::atomic<uint32_t> mTxBytes{0};	///< Bytes waiting for transmission.
+	std::atomic<uint32_t> mTxMbufBytes{0}; ///< Part of mTxBytes in mbuf messages of the current pool.
+	std::atomic<bool> mTxHigh{false};	///< High watermark is reached.
+	uint32_t mTxHighLevel = UINT32_MAX; ///< High watermark (bytes).
+	uint32_t mTxLowLevel = 0;			///< Low watermark (bytes).
+	onBLETxLevel *mOnTxLevel = nullptr; ///< Callback function for watermark crossings.
+
+	/// Get the payload size of a transmit message.
+	/*!
+	  \param[in] msg message.
+	  \return size in bytes.
+	*/
+	uint16_t txLength(STaskMessage *msg);
+
+	/// Account bytes accepted for transmission.
+	/*!
+	  \param[in] len size in bytes.
+	*/
+	void txAccount(uint32_t len);
+
+	/// Account bytes passed to the stack or dropped.
+	/*!
+	  \param[in] len size in bytes.
+	  \param[in] mbuf the bytes come from an mbuf message of the current pool.
+	*/
+	void txDone(uint32_t len, bool mbuf = false);
+
+#ifdef CONFIG_BLE_DATA_METRICS
+	CBTMetrics mMetrics; ///< Channel metrics.
+
+	/// Get the metrics channel of a transmit message.
+	/*!
+	  \param[in] msg message.
+	  \return channel.
+	*/
+	EBTChannel txChannel(STaskMessage *msg);
+#endif
+
+	/// Check that nothing waits for transmission.
+	/*!
+	  \return true if there are no pending notifications.
+	*/
+	inline bool txIdle()
+	{
+#ifdef CONFIG_BLE_DATA_TX_RING
+		if (!mTxRing->empty())
+			return false;
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+		if (!mTxRing2->empty())
+			return false;
+#endif
+#endif
+		return (mTxCount == 0);
+	};
+
+#ifdef CONFIG_BLE_DATA_TX_RING
+	CRingBuffer *mTxRing; ///< Main channel streaming ring.
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+	CRingBuffer *mTxRing2; ///< Second channel streaming ring.
+#endif
+	std::atomic<bool> mTxBell{false}; ///< MSG_TX_RING is queued.
+	SemaphoreHandle_t mTxRoom[2];	  ///< Given when the task frees room in the main and second channel rings.
+	std::atomic<bool> mTxWait[2] = {{false}, {false}}; ///< A producer waits for room in the ring.
+
+	/// Drop all packets of a streaming ring.
+	/*!
+	  \param[in] ring ring.
+	  \return payload bytes dropped.
+	*/
+	uint32_t ringClear(CRingBuffer *ring);
+
+	/// Wake the producer waiting for room in a streaming ring.
+	/*!
+	  \param[in] ring ring.
+	*/
+	inline void ringRoom(CRingBuffer *ring)
+	{
+		int ch = (ring == mTxRing) ? 0 : 1;
+		if (mTxWait[ch].load() && mTxWait[ch].exchange(false))
+			xSemaphoreGive(mTxRoom[ch]);
+	};
+
+	/// Send packets from a streaming ring.
+	/*!
+	  \param[in] ring ring.
+	  \param[in] attr attribute handle.
+	  \return BLE_HS_ENOMEM if packets are left in the ring, otherwise 0.
+	*/
+	int ringFlush(CRingBuffer *ring, uint16_t attr);
+
+	/// Write a packet into a streaming ring and wake the task.
+	/*!
+	  \param[in] ring ring.
+	  \param[in] hdr header (can be nullptr).
+	  \param[in] hsize header size.
+	  \param[in] data data.
+	  \param[in] size data size.
+	  \param[in] xTicksToWait time to wait for room in the ring.
+	  \return true if no error.
+	*/
+	bool ringPush(CRingBuffer *ring, const uint8_t *hdr, uint16_t hsize, const uint8_t *data, uint16_t size, TickType_t xTicksToWait);
+#endif
+
+	uint32_t mRxDrops = 0; ///< Received packets dropped because the task could not take them.
+
+#ifdef CONFIG_BLE_DATA_RX_ACK
+	uint16_t mRxCount[2] = {0, 0}; ///< Packets delivered to the application per channel, from all connections.
+	uint8_t mRxUnacked = 0;		   ///< Packets delivered since the last acknowledgement.
+
+	/// Fill the acknowledgement value.
+	/*!
+	  \param[out] data 4 bytes: main and second channel counters (little-endian).
+	*/
+	void rxAckData(uint8_t *data);
+
+	/// Count a packet delivered to the application.
+	/*!
+	  \param[in] chn channel number (1 or 2).
+	*/
+	void rxAck(uint16_t chn);
+
+	/// Notify the delivered packet counters.
+	void rxAckSend();
+#endif
+
+	/// Check that no acknowledgement waits for mbufs.
+	/*!
+	  \return true if the delivered packets are acknowledged.
+	*/
+	inline bool ackIdle()
+	{
+#ifdef CONFIG_BLE_DATA_RX_ACK
+		return (mRxUnacked == 0) || !mConnect;
+#else
+		return true;
+#endif
+	};
+
+	/// Drop a received packet.
+	/*!
+	  Called in the NimBLE host task.
+	  \param[in] chn channel number (1 or 2).
+	  \return ATT error code for the client.
+	*/
+	int rxDrop(uint16_t chn);
+
+#ifdef CONFIG_BLE_DATA_PROBE
+	std::atomic<bool> mProbe{false}; ///< Echo mode of the main channel.
+
+	/// Queue a received probe for the echo.
+	/*!
+	  Called in the NimBLE host task.
+	  \param[in] conn_handle connection handle.
+	  \param[in] om probe.
+	  \param[in] len probe size.
+	  \param[in] stamp entry time of the write handler in us.
+	  \return ATT error code for the client.
+	*/
+	int probeRx(uint16_t conn_handle, struct os_mbuf *om, uint16_t len, uint32_t stamp);
+
+	/// Echo a probe.
+	/*!
+	  \param[in] msg probe message; its body is freed unless BLE_HS_ENOMEM is returned.
+	  \return BLE_HS_ENOMEM if the probe must wait for free mbufs, otherwise 0.
+	*/
+	int probeSend(STaskMessage *msg);
+#endif
+
+#ifdef CONFIG_BLE_DATA_RX_RING
+	CRingBuffer *mRxRing;			  ///< Received packets: channel number (1 byte) and data.
+	std::atomic<bool> mRxBell{false}; ///< MSG_RX_RING is queued.
+
+	/// Deliver the packets from the receive ring to the callbacks.
+	void rxFlush();
+#endif
+
+	/// Check that the receive ring is empty.
+	/*!
+	  \return true if there is nothing to deliver.
+	*/
+	inline bool rxIdle()
+	{
+#ifdef CONFIG_BLE_DATA_RX_RING
+		return mRxRing->empty();
+#else
+		return true;
+#endif
+	};
+
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+	CSoftwareTimer *mAdaptTimer = nullptr;					///< Measurement window timer.
+	std::atomic<uint32_t> mAdaptBytes{0};					///< Bytes queued and received in the current window.
+	uint32_t mAdaptHigh = CONFIG_BLE_DATA_ADAPTIVE_HIGH;	///< Rate (bytes/s) that selects the short interval, 0 - off.
+	uint32_t mAdaptLow = CONFIG_BLE_DATA_ADAPTIVE_LOW;		///< Rate (bytes/s) that counts as idle.
+	std::atomic<uint16_t> mAdaptItvl{0};					///< Connection interval in use or requested (1.25 ms units).
+	uint8_t mAdaptIdle = 0;									///< Consecutive idle windows.
+
+	/// Evaluate the traffic of the last window and switch the interval.
+	void adaptTick();
+
+	/// Request the short or the long connection interval on all connections.
+	/*!
+	  \param[in] fast true for the short interval.
+	*/
+	void adaptSet(bool fast);
+
+	/// Take the interval in use on a connection.
+	/*!
+	  \param[in] handle Connection handle.
+	*/
+	void adaptSync(uint16_t handle);
+#endif
+
+#ifdef CONFIG_BLE_DATA_COALESCE
+	uint32_t mCoalesceTime = CONFIG_BLE_DATA_COALESCE_TIME; ///< Coalescing deadline (ms), 0 - off.
+	CSoftwareTimer *mCoalesceTimer = nullptr;				///< Coalescing deadline timer.
+	STaskMessage mCoalesce;									///< Packet being collected (msgBody is nullptr if none).
+	uint16_t mCoalesceSize = 0;								///< Bytes collected in mCoalesce.
+
+	/// Take the collected packet out of the coalescing buffer.
+	/*!
+	  Must be called under lock().
+	  \param[out] msg packet (msgBody is nullptr if the buffer is empty).
+	*/
+	void coalesceTake(STaskMessage *msg);
+#endif
+
+#ifdef CONFIG_BLE_DATA_FRAMED
+	uint8_t mTxSeq = 0;		///< Sequence number of the next transmitted fragment.
+	uint16_t mTxOffset = 0; ///< Bytes of the current frame already sent.
+	const uint8_t *mTxFrame = nullptr; ///< Data of the current frame (valid while mTxOffset is not 0).
+
+	/// Send a frame as a sequence of notifications.
+	/*!
+	  \param[in] conn connection handle or BLE_HS_CONN_HANDLE_NONE for all connections.
+	  \param[in] attr attribute handle.
+	  \param[in] data frame.
+	  \param[in] size frame size.
+	  \return 0 if no error.
+	*/
+	int notifyFrame(uint16_t conn, uint16_t attr, uint8_t *data, uint16_t size);
+
+	/// Process a received fragment.
+	/*!
+	  Called in the NimBLE host task. A completed frame is posted as MSG_READ_DATA.
+	  \param[in] conn connection.
+	  \param[in] om fragment.
+	  \param[in] len fragment size.
+	  \return ATT error code.
+	*/
+	int rxFragment(SBTConn *conn, struct os_mbuf *om, uint16_t len);
+
+	/// Discard the frame being reassembled.
+	/*!
+	  \param[in] conn connection.
+	*/
+	void rxFrameReset(SBTConn *conn);
+#endif
 
 	/// Set operation mode.
 	/*!
@@ -216,9 +839,16 @@ protected:
 #ifdef CONFIG_BLE_DATA_IBEACON_SCAN
 	onBeaconRx *mOnBeacon = nullptr;		///< Callback function for receiving beacon data.
 	uint32_t mBeaconSleepTime = 5000;		///< Sleep time between scans (ms)
+	uint32_t mScanTime = CONFIG_BLE_DATA_IBEACON_SCAN_TIMER; ///< Scan time of a duty cycle (ms)
+	uint16_t mScanItvl = 0;					///< Scan interval in 0.625 ms units (0 - controller default)
+	uint16_t mScanWindow = 0;				///< Scan window in 0.625 ms units (0 - controller default)
 	CSoftwareTimer *mBeaconTimer = nullptr; ///< Timer for controlling scanning
 	bool mBeaconSleep = false;				///< Scanner sleep mode flag
 	bool mBeaconFilter = true;
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+	ble_addr_t mAccept[CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE]; ///< Filter accept list of the controller.
+	uint8_t mAcceptCount = 0;								   ///< Entries in mAccept (0 - no filtering).
+#endif
 
 	/**
 	 * @brief Stack synchronization callback for iBeacon receiver mode
@@ -234,6 +864,92 @@ protected:
 	 */
 	static void ble_scan();
 
+	/**
+	 * @brief Load the filter accept list into the controller
+	 *
+	 * @return Scan filter policy (no filtering without CONFIG_BLE_DATA_SCAN_ACCEPT_LIST or with an empty list)
+	 */
+	static uint8_t scanAcceptApply();
+
+	/**
+	 * @brief Pass a scan report to the task
+	 *
+	 * @param[in] beacon iBeacon data (can be nullptr)
+	 * @param[in] mac MAC address (can be nullptr)
+	 */
+	static void scanReport(const SBeacon *beacon, const SMac *mac);
+
+	/**
+	 * @brief Make the MAC report of an advertiser
+	 *
+	 * @param[in] addr Advertiser address
+	 * @param[in] rssi RSSI in dBm
+	 * @param[out] mac Report
+	 * @param[in] any Ignore the selected address kinds
+	 * @return true if the address is to be reported
+	 */
+	static bool scanMac(const ble_addr_t *addr, int8_t rssi, SMac *mac, bool any);
+
+#ifdef CONFIG_BLE_DATA_SCAN_RANDOM
+	uint8_t mScanAddr = SCAN_ADDR_PUBLIC | SCAN_ADDR_STATIC | SCAN_ADDR_RPA; ///< Reported address kinds (SCAN_ADDR_*).
+#endif
+#ifdef CONFIG_BLE_DATA_SCAN_RPA_RESOLVE
+	CRpaResolver *mRpa = nullptr; ///< Identity addresses of bonded peers.
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+	onScanBatch *mOnBatch = nullptr;						///< Batch callback (nullptr - one message per report).
+	SScanRecord *mBatch[2] = {nullptr, nullptr};			///< Batch buffers of CONFIG_BLE_DATA_SCAN_BATCH_SIZE records.
+	uint8_t mBatchFill = 0;									///< Buffer filled by the host task.
+	uint16_t mBatchCount = 0;								///< Records in the filled buffer.
+	portMUX_TYPE mBatchMux = portMUX_INITIALIZER_UNLOCKED;	///< Batch lock.
+	std::atomic<bool> mBatchBell{false};					///< MSG_SCAN_BATCH is queued.
+	CSoftwareTimer *mBatchTimer = nullptr;					///< Batch deadline timer.
+
+	/**
+	 * @brief Append a scan report to the batch being filled
+	 *
+	 * @param[in] beacon iBeacon data (can be nullptr)
+	 * @param[in] mac MAC address (can be nullptr)
+	 */
+	void scanAppend(const SBeacon *beacon, const SMac *mac);
+
+	/**
+	 * @brief Deliver the collected scan reports to mOnBatch
+	 */
+	void scanFlush();
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+	CScanDedup *mDedup = nullptr; ///< Recently forwarded reports.
+
+	/**
+	 * @brief Suppress a repeated scan report
+	 *
+	 * @param[in] addr Advertiser address
+	 * @param[in] data Raw advertising data
+	 * @param[in] len Data length
+	 * @param[in] rssi RSSI in dBm
+	 * @return true if the report is new or changed and must be processed
+	 */
+	static bool scanDedup(const ble_addr_t *addr, const uint8_t *data, uint8_t len, int8_t rssi);
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+	CAdvFilter *mAdvFilter = nullptr; ///< Rules applied to the raw advertising data.
+
+	/**
+	 * @brief Apply the scan filter rules to a report
+	 *
+	 * @param[in] data Raw advertising data
+	 * @param[in] len Data length
+	 * @param[in] addr Advertiser address
+	 * @param[in] rssi RSSI in dBm
+	 * @return true if the rules handled the report, false if no rules are set
+	 */
+	static bool scanFilter(const uint8_t *data, uint8_t len, const ble_addr_t *addr, int8_t rssi);
+#endif
+
 	/**
 	 * @brief GAP event handler for scanning
 	 *
@@ -329,13 +1045,30 @@ protected:
 	static int ble_svc_gatt_handler2(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
 #endif
 
+#ifdef CONFIG_BLE_DATA_RX_ACK
+	/// Callback function for the receive acknowledgement characteristic.
+	/*!
+	 * @brief Acknowledgement characteristic access handler
+	 *
+	 * Handles reads of the delivered packet counters.
+	 *
+	 * @param[in] conn_handle Connection identifier
+	 * @param[in] attr_handle Attribute identifier
+	 * @param[in] ctxt GATT access context
+	 * @param[in] arg Additional arguments
+	 * @return Return code (0 on successful processing)
+	 */
+	static int ble_svc_gatt_ack_handler(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+#endif
+
 	/// Callback function for reading data from the channel.
 	/*!
+	  \param[in] conn_handle connection handle.
 	  \param[in] om data.
 	  \param[in] chn channel number.
 	  \return 0 if no error.
 	*/
-	static int gatt_svr_chr_write(struct os_mbuf *om, uint16_t chn = 1);
+	static int gatt_svr_chr_write(uint16_t conn_handle, struct os_mbuf *om, uint16_t chn = 1);
 
 	/// Constructor.
 	/*!
@@ -361,8 +1094,34 @@ protected:
 	 */
 	virtual void run() override;
 
+	/// Allocate an mbuf with a contiguous payload area.
+	/*!
+	  \param[in] size payload size.
+	  \param[out] data pointer to the payload area.
+	  \return mbuf or nullptr if not connected or the pool is exhausted.
+	*/
+	struct os_mbuf *allocMbuf(uint16_t size, uint8_t **data);
+
 	using CBaseTask::sendCmd;
 
+	/// Send a command with a pointer parameter.
+	/*!
+	  The pointer travels in msgBody, so it keeps its width where pointers
+	  are wider than paramID (host builds).
+	  \param[in] cmd command.
+	  \param[in] param short parameter.
+	  \param[in] ptr pointer, not owned by the message.
+	  \return true if no error.
+	*/
+	inline bool sendPtr(uint16_t cmd, uint16_t param, void *ptr)
+	{
+		STaskMessage msg;
+		msg.msgID = cmd;
+		msg.shortParam = param;
+		msg.msgBody = ptr;
+		return sendMessage(&msg, portMAX_DELAY, false);
+	};
+
 public:
 	static const char *device_name; ///< Bluetooth device name
 
@@ -414,10 +1173,116 @@ public:
 	{
 		if (filter)
 			sleep |= 0x80;
-		return sendCmd(MSG_INIT_BEACON_RX, sleep, (uint32_t)onBeacon);
+		return sendPtr(MSG_INIT_BEACON_RX, sleep, (void *)onBeacon);
+	};
+
+	/**
+	 * @brief Set the scan timing
+	 *
+	 * Applied from the next scan; the stack keeps running between scans.
+	 * setBeacon() sets the sleep time again.
+	 *
+	 * @param[in] interval Scan interval in ms, 3 to 10240 (0 - controller default)
+	 * @param[in] window Scan window in ms, 3 to the interval (0 - controller default, only with the default interval)
+	 * @param[in] scanTime Scan time of a duty cycle in ms (not 0)
+	 * @param[in] sleepTime Sleep time between scans in ms (0 - scan continuously)
+	 * @param[in] xTicksToWait Message queue timeout
+	 * @return true if the values are valid and the command is sent successfully
+	 */
+	bool setScanTiming(uint16_t interval, uint16_t window, uint32_t scanTime, uint32_t sleepTime, TickType_t xTicksToWait = portMAX_DELAY);
+
+#ifdef CONFIG_BLE_DATA_SCAN_RANDOM
+	/**
+	 * @brief Select the address kinds reported as MAC addresses
+	 *
+	 * With CONFIG_BLE_DATA_SCAN_RPA_RESOLVE a resolvable private address of
+	 * a bonded peer is reported as its identity address. May be called
+	 * while scanning.
+	 *
+	 * @param[in] kinds Bit mask of SCAN_ADDR_* values
+	 */
+	inline void setScanAddresses(uint8_t kinds)
+	{
+		mScanAddr = kinds;
+	};
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_DEDUP
+	/**
+	 * @brief Set the duplicate suppression of scan reports
+	 *
+	 * A report with the same address and advertising data as one forwarded
+	 * less than window ms ago is dropped unless its RSSI changed by at least
+	 * rssiDelta dB. May be called while scanning.
+	 *
+	 * @param[in] window Suppression window in ms (0 - every report is forwarded)
+	 * @param[in] rssiDelta RSSI change in dB (0 - RSSI is ignored)
+	 */
+	inline void setScanDedup(uint32_t window, uint8_t rssiDelta)
+	{
+		mDedup->setWindow(window, rssiDelta);
+	};
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_FILTER
+	/**
+	 * @brief Set the scan filter rules
+	 *
+	 * While rules are set they replace the built-in iBeacon and public
+	 * address checks: the first matching rule decides whether a report is
+	 * dropped, reported as a MAC address or reported as a beacon. May be
+	 * called while scanning.
+	 *
+	 * @param[in] rules Rules in priority order, see CAdvFilter (nullptr - built-in checks)
+	 * @param[in] count Number of rules
+	 * @param[in] def Action when no rule matches
+	 * @return false if the rules cannot be compiled; the previous rules stay active
+	 */
+	inline bool setScanFilter(const SAdvRule *rules, uint8_t count, EAdvAction def = EAdvAction::Drop)
+	{
+		return mAdvFilter->setRules(rules, count, def);
 	};
 #endif
 
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+	/**
+	 * @brief Set the filter accept list of the controller
+	 *
+	 * Only advertisers with a listed public address reach the host, so
+	 * iBeacons of other devices are not reported either. A running scan is
+	 * restarted with the new list; otherwise it is applied at the next scan.
+	 *
+	 * @param[in] macs Public addresses in SMac byte order (nullptr - report all devices)
+	 * @param[in] count Number of addresses (up to CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE)
+	 * @param[in] xTicksToWait Message queue timeout
+	 * @return true if the command is sent successfully
+	 */
+	bool setAcceptList(const std::array<uint8_t, 6> *macs, uint8_t count, TickType_t xTicksToWait = portMAX_DELAY);
+#endif
+
+#ifdef CONFIG_BLE_DATA_SCAN_BATCH
+	/**
+	 * @brief Set iBeacon scanning mode with batched delivery
+	 *
+	 * Reports are collected in a preallocated buffer and passed to the
+	 * callback when CONFIG_BLE_DATA_SCAN_BATCH_SIZE records are collected or
+	 * CONFIG_BLE_DATA_SCAN_BATCH_TIME ms after the first one.
+	 *
+	 * @param[in] onBatch Callback function for processing batches
+	 * @param[in] sleep Sleep time between scans in seconds
+	 * @param[in] filter Parse iBeacon data
+	 * @return true if the command is sent successfully
+	 */
+	inline bool setBeaconBatch(onScanBatch *onBatch, uint16_t sleep = 5, bool filter = true)
+	{
+		sleep |= 0x100;
+		if (filter)
+			sleep |= 0x80;
+		return sendPtr(MSG_INIT_BEACON_RX, sleep, (void *)onBatch);
+	};
+#endif
+#endif
+
 #ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
 	/// Enable data channels mode.
 	/*!
@@ -427,13 +1292,15 @@ public:
 	*/
 	inline bool setData(onBLEDataRx *onRx, onBLEDataRx *onRx2, onBLEConnect *onConnect = nullptr)
 	{
-		sendCmd(MSG_INIT_DATA3, 0, (uint32_t)onConnect);
-		sendCmd(MSG_INIT_DATA2, 0, (uint32_t)onRx2);
-		return sendCmd(MSG_INIT_DATA, 0, (uint32_t)onRx);
+		sendPtr(MSG_INIT_DATA3, 0, (void *)onConnect);
+		sendPtr(MSG_INIT_DATA2, 0, (void *)onRx2);
+		return sendPtr(MSG_INIT_DATA, 0, (void *)onRx);
 	};
 
 	/// Send data to the second channel.
 	/*!
+	  In streaming mode (CONFIG_BLE_DATA_TX_RING) data is written into a ring
+	  that only one task may fill.
 	  \param[in] data data.
 	  \param[in] size data size.
 	  \param[in] index data packet number.
@@ -449,13 +1316,15 @@ public:
 	*/
 	inline bool setData(onBLEDataRx *onRx, onBLEConnect *onConnect = nullptr)
 	{
-		sendCmd(MSG_INIT_DATA3, 0, (uint32_t)onConnect);
-		return sendCmd(MSG_INIT_DATA, 0, (uint32_t)onRx);
+		sendPtr(MSG_INIT_DATA3, 0, (void *)onConnect);
+		return sendPtr(MSG_INIT_DATA, 0, (void *)onRx);
 	};
 #endif
 
 	/// Send data to the main channel.
 	/*!
+	  In streaming mode (CONFIG_BLE_DATA_TX_RING) data is written into a ring
+	  that only one task may fill.
 	  \param[in] data data.
 	  \param[in] size data size.
 	  \param[in] xTicksToWait message queue timeout time.
@@ -463,6 +1332,218 @@ public:
 	*/
 	bool sendData(uint8_t *data, size_t size, TickType_t xTicksToWait = portMAX_DELAY);
 
+#ifdef CONFIG_BLE_DATA_COALESCE
+	/// Set the coalescing deadline of the main channel.
+	/*!
+	  Writes shorter than MTU-3 are packed into one notification, which is sent
+	  when it is full or when the deadline expires.
+	  \param[in] ms deadline in ms, 0 - every write is sent as a separate notification.
+	*/
+	inline void setCoalesce(uint32_t ms) { mCoalesceTime = ms; };
+#endif
+
+	/// Get the number of received packets dropped.
+	/*!
+	  A packet is dropped when the task queue or the receive ring is full;
+	  the client gets an ATT error for a write with response.
+	  \return number of packets.
+	*/
+	inline uint32_t getRxDrops() { return mRxDrops; };
+
+#ifdef CONFIG_BLE_DATA_PROBE
+	/// Enable the echo mode of the main channel.
+	/*!
+	  Every main channel write is sent back to its connection instead of
+	  reaching onBLEDataRx, and the time spent in the host task, the task
+	  queue and the notify call is added to the probe histograms of
+	  getMetrics(). Probes are echoed as received, without framing.
+	  \param[in] on true to echo.
+	*/
+	inline void setProbe(bool on) { mProbe.store(on); };
+#endif
+
+	/// Send data to the main channel of one connection.
+	/*!
+	  sendData() sends to all connections.
+	  \param[in] conn connection handle (see getConnections()).
+	  \param[in] data data.
+	  \param[in] size data size.
+	  \param[in] xTicksToWait message queue timeout time.
+	  \return true if no error.
+	*/
+	bool sendDataTo(uint16_t conn, uint8_t *data, size_t size, TickType_t xTicksToWait = portMAX_DELAY);
+
+	/// Set the link parameter profile.
+	/*!
+	  Applied to connections established after the call.
+	  \param[in] profile profile.
+	  \param[in] onLink callback function for the negotiated values (can be nullptr).
+	*/
+	inline void setLinkProfile(EBTLinkProfile profile, onBLELink *onLink = nullptr)
+	{
+		mOnLink = onLink;
+		mLinkProfile = profile;
+	};
+
+#ifdef CONFIG_BLE_DATA_ADAPTIVE
+	/// Set the traffic thresholds of the adaptive connection interval.
+	/*!
+	  The short interval is requested as soon as a window reaches high or ends
+	  with data still queued; the long one after CONFIG_BLE_DATA_ADAPTIVE_IDLE
+	  windows at or below low.
+	  \param[in] high rate in bytes/s, 0 - keep the current parameters.
+	  \param[in] low rate in bytes/s.
+	*/
+	inline void setAdaptive(uint32_t high, uint32_t low)
+	{
+		mAdaptLow = low;
+		mAdaptHigh = high;
+	};
+#endif
+
+	/// Get the established connections.
+	/*!
+	  \param[out] handles array of CONFIG_BLE_DATA_MAX_CONNECTIONS connection handles.
+	  \return number of connections.
+	*/
+	uint8_t getConnections(uint16_t *handles);
+
+	/// Send data to the main channel without blocking.
+	/*!
+	  \param[in] data data.
+	  \param[in] size data size.
+	  \param[out] status transmit pipeline state after the call (can be nullptr).
+	  \return true if the data is accepted.
+	*/
+	inline bool trySendData(uint8_t *data, size_t size, SBTTxStatus *status = nullptr)
+	{
+		bool res = sendData(data, size, 0);
+		if (status != nullptr)
+			getTxStatus(status);
+		return res;
+	};
+
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+	/// Send data to the second channel without blocking.
+	/*!
+	  \param[in] data data.
+	  \param[in] size data size.
+	  \param[in] index data packet number.
+	  \param[out] status transmit pipeline state after the call (can be nullptr).
+	  \return true if the data is accepted.
+	*/
+	inline bool trySendData2(uint8_t *data, size_t size, uint16_t index, SBTTxStatus *status = nullptr)
+	{
+		bool res = sendData2(data, size, index, 0);
+		if (status != nullptr)
+			getTxStatus(status);
+		return res;
+	};
+#endif
+
+	/// Get the transmit pipeline state.
+	/*!
+	  \param[out] status state.
+	*/
+	void getTxStatus(SBTTxStatus *status);
+
+	/// Set transmit watermarks.
+	/*!
+	  \param[in] high bytes waiting for transmission that trigger onTxLevel(true).
+	  \param[in] low bytes waiting for transmission that trigger onTxLevel(false) after the high one.
+	  \param[in] onTxLevel callback function (nullptr - off).
+	*/
+	inline void setTxWatermarks(uint32_t high, uint32_t low, onBLETxLevel *onTxLevel)
+	{
+		mOnTxLevel = nullptr;
+		mTxHighLevel = high;
+		mTxLowLevel = low;
+		mTxHigh.store(false);
+		mOnTxLevel = onTxLevel;
+	};
+
+	/// Release a message body.
+	/*!
+	  Also releases the beacon and MAC structures passed to onBeaconRx.
+	  \param[in] data body (pool block or heap memory).
+	*/
+	static void freeBody(void *data);
+
+#ifdef CONFIG_BLE_DATA_POOL
+	/// Get the usage of the message body pools.
+	/*!
+	  \param[out] stats array of BLOCKPOOL_MAX entries.
+	  \param[out] fallbacks bodies taken from the heap (can be nullptr).
+	  \return number of pools.
+	*/
+	static inline uint8_t getPoolStats(SBlockPoolStats *stats, uint32_t *fallbacks = nullptr)
+	{
+		return (mPool != nullptr) ? mPool->getStats(stats, fallbacks) : 0;
+	};
+#endif
+
+#ifdef CONFIG_BLE_DATA_METRICS
+	/// Get a snapshot of the channel metrics.
+	/*!
+	  \param[out] data snapshot.
+	*/
+	void getMetrics(SBTMetrics *data);
+
+	/// Get the channel metrics as JSON.
+	/*!
+	  \return JSON object.
+	*/
+	inline json getMetricsJSON()
+	{
+		SBTMetrics data;
+		getMetrics(&data);
+		return CBTMetrics::toJSON(&data);
+	};
+
+	/// Reset the channel metrics.
+	inline void resetMetrics() { mMetrics.reset(); };
+#endif
+
+	/// Allocate a transmit buffer from the NimBLE mbuf pool.
+	/*!
+	  The caller fills size bytes at *data in place and passes the buffer to sendBuffer().
+	  Valid only in data mode while connected. In framed mode the payload must fit in one fragment.
+	  \param[in] size payload size.
+	  \param[out] data pointer to the payload area.
+	  \return mbuf or nullptr if not connected or the pool is exhausted.
+	*/
+	struct os_mbuf *allocTxBuffer(uint16_t size, uint8_t **data);
+
+	/// Send a buffer from allocTxBuffer() to the main channel without copying.
+	/*!
+	  The buffer is consumed in all cases.
+	  \param[in] om buffer.
+	  \param[in] xTicksToWait message queue timeout time.
+	  \return true if no error.
+	*/
+	bool sendBuffer(struct os_mbuf *om, TickType_t xTicksToWait = portMAX_DELAY);
+
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+	/// Allocate a transmit buffer for the second channel.
+	/*!
+	  The packet number is written into the buffer header.
+	  \param[in] index data packet number.
+	  \param[in] size payload size.
+	  \param[out] data pointer to the payload area.
+	  \return mbuf or nullptr if not connected or the pool is exhausted.
+	*/
+	struct os_mbuf *allocTxBuffer2(uint16_t index, uint16_t size, uint8_t **data);
+
+	/// Send a buffer from allocTxBuffer2() to the second channel without copying.
+	/*!
+	  The buffer is consumed in all cases.
+	  \param[in] om buffer.
+	  \param[in] xTicksToWait message queue timeout time.
+	  \return true if no error.
+	*/
+	bool sendBuffer2(struct os_mbuf *om, TickType_t xTicksToWait = portMAX_DELAY);
+#endif
+
 	/// Set data for advertising.
 	/*!
 	  \param[in] data data.
@@ -0,0 +1,95 @@
+/*!
+    \file
+    \brief Fixed-size block pools for message bodies.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include <cstdint>
+#include <cstddef>
+
+#define BLOCKPOOL_MAX (4) ///< Maximum number of block sizes.
+
+/**
+ * @brief Usage of one block size
+ */
+struct SBlockPoolStats
+{
+    uint16_t size;    ///< Block size in bytes
+    uint16_t count;   ///< Number of blocks
+    uint16_t free;    ///< Free blocks now
+    uint16_t minFree; ///< Lowest number of free blocks seen
+    uint32_t allocs;  ///< Blocks taken
+};
+
+/**
+ * @brief Set of fixed-size block pools with heap fallback
+ *
+ * Each block size has its own contiguous region and a free list threaded
+ * through the free blocks, so alloc() and free() are O(1). A request is
+ * served by the smallest size that fits; when that pool is empty or the
+ * request is larger than any block, the heap is used. free() finds the
+ * owner by address, so heap blocks can be passed to it as well.
+ */
+class CBlockPool
+{
+protected:
+    /// One block size.
+    struct SPool
+    {
+        uint8_t *region;       ///< Blocks
+        void *head;            ///< First free block
+        SBlockPoolStats stats; ///< Usage
+    };
+
+    SPool mPools[BLOCKPOOL_MAX];                        ///< Pools in ascending block size
+    uint8_t mCount = 0;                                 ///< Number of pools
+    uint32_t mFallbacks = 0;                            ///< Requests served by the heap
+    portMUX_TYPE mMux = portMUX_INITIALIZER_UNLOCKED;   ///< Free list lock
+
+public:
+    /**
+     * @brief Constructor for the CBlockPool class
+     *
+     * @param[in] sizes Block sizes in ascending order (multiples of 4)
+     * @param[in] counts Number of blocks of each size (0 - size not used)
+     * @param[in] n Number of sizes (up to BLOCKPOOL_MAX)
+     * @param[in] psram Place the blocks in PSRAM
+     */
+    CBlockPool(const uint16_t *sizes, const uint16_t *counts, uint8_t n, bool psram = false);
+
+    /**
+     * @brief Destructor for the CBlockPool class
+     *
+     * All blocks must be returned before.
+     */
+    ~CBlockPool();
+
+    /**
+     * @brief Take a block
+     *
+     * @param[in] size Requested size in bytes
+     * @return Block, heap memory if no pool fits, or nullptr if the heap is exhausted
+     */
+    void *alloc(size_t size);
+
+    /**
+     * @brief Return a block
+     *
+     * @param[in] ptr Block from alloc() (heap memory is passed to vPortFree())
+     */
+    void free(void *ptr);
+
+    /**
+     * @brief Get the usage of the pools
+     *
+     * @param[out] stats Array of BLOCKPOOL_MAX entries
+     * @param[out] fallbacks Requests served by the heap (can be nullptr)
+     * @return Number of pools
+     */
+    uint8_t getStats(SBlockPoolStats *stats, uint32_t *fallbacks = nullptr);
+};
@@ -71,6 +71,20 @@ public:
      */
     void addMac(SMac *mac);
 
+#ifdef CONFIG_BLE_DATA_SCAN_ACCEPT_LIST
+    /**
+     * @brief Load the whitelist into the controller
+     *
+     * Passes the whitelist to CBTTask::setAcceptList(), so advertisers that
+     * are not listed are dropped by the controller. addMac() keeps checking
+     * the whitelist.
+     *
+     * @return true if the command is sent successfully, false if there is no
+     *         whitelist or it is longer than CONFIG_BLE_DATA_SCAN_ACCEPT_LIST_SIZE
+     */
+    bool pushWhiteList();
+#endif
+
     /**
      * @brief Calculate changes between scans
      *
@@ -0,0 +1,116 @@
+/*!
+    \file
+    \brief Lock-free single producer/single consumer ring of packets.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+
+/**
+ * @brief Byte ring of variable length packets
+ *
+ * One task writes packets with push(), another one reads them with front()/pop().
+ * Each packet is stored contiguously with a 2-byte length prefix, so the consumer
+ * gets a pointer into the ring without copying. No locks are taken; the two
+ * positions are published with release/acquire ordering.
+ */
+class CRingBuffer
+{
+protected:
+    uint8_t *mBuffer;               ///< Storage
+    uint32_t mSize;                 ///< Storage size in bytes
+    std::atomic<uint32_t> mHead{0}; ///< Read position (owned by the consumer)
+    std::atomic<uint32_t> mTail{0}; ///< Write position (owned by the producer)
+    uint16_t mFrontSize = 0;        ///< Size of the packet returned by front()
+    uint32_t mReserved = 0;         ///< Write position after the packet from reserve()
+
+public:
+    /**
+     * @brief Constructor
+     *
+     * @param[in] size Storage size in bytes
+     */
+    CRingBuffer(uint32_t size);
+
+    /**
+     * @brief Destructor
+     */
+    ~CRingBuffer();
+
+    /**
+     * @brief Append a packet (producer)
+     *
+     * The packet is the concatenation of an optional header and the data.
+     *
+     * @param[in] hdr Header (can be nullptr)
+     * @param[in] hsize Header size
+     * @param[in] data Data
+     * @param[in] size Data size
+     * @return true if the packet is stored, false if there is no room
+     */
+    bool push(const uint8_t *hdr, uint16_t hsize, const uint8_t *data, uint16_t size);
+
+    /**
+     * @brief Reserve room for a packet to be filled in place (producer)
+     *
+     * The packet becomes visible to the consumer on commit(). A reservation
+     * that is not committed is overwritten by the next one.
+     *
+     * @param[in] size Packet size
+     * @return Pointer to the packet area, or nullptr if there is no room
+     */
+    uint8_t *reserve(uint16_t size);
+
+    /**
+     * @brief Publish the packet from reserve() (producer)
+     */
+    void commit();
+
+    /**
+     * @brief Get the oldest packet (consumer)
+     *
+     * @param[out] size Packet size
+     * @return Pointer to the packet inside the ring, or nullptr if the ring is empty
+     */
+    uint8_t *front(uint16_t &size);
+
+    /**
+     * @brief Release the packet returned by front() (consumer)
+     */
+    void pop();
+
+    /**
+     * @brief Drop all packets (consumer)
+     */
+    inline void clear() { mHead.store(mTail.load(std::memory_order_acquire), std::memory_order_release); };
+
+    /**
+     * @brief Check if the ring is empty
+     *
+     * @return true if there are no packets
+     */
+    inline bool empty() { return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire); };
+
+    /**
+     * @brief Get the number of bytes in use, including length prefixes
+     *
+     * @return Bytes in use
+     */
+    inline uint32_t used()
+    {
+        uint32_t head = mHead.load(std::memory_order_acquire);
+        uint32_t tail = mTail.load(std::memory_order_acquire);
+        return (tail >= head) ? (tail - head) : (mSize - head + tail);
+    };
+
+    /**
+     * @brief Get the storage size
+     *
+     * @return Size in bytes
+     */
+    inline uint32_t size() { return mSize; };
+};
@@ -0,0 +1,87 @@
+/*!
+    \file
+    \brief Resolution of resolvable private addresses.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include "nimble/ble.h"
+#include <cstdint>
+
+/**
+ * @brief Resolver of resolvable private addresses against bonded IRKs
+ *
+ * The IRKs and identity addresses of the bonded peers are copied from the
+ * NimBLE store by load(). resolve() first looks the address up in a small
+ * cache and runs the AES-based hash for each IRK only on a miss, so a
+ * device costs one lookup per report until it rotates its address.
+ * Addresses that match no IRK are cached as well. Only the NimBLE host
+ * task calls resolve(); load() runs while discovery is stopped.
+ */
+class CRpaResolver
+{
+protected:
+    /// Bonded peer with an IRK.
+    struct SIrk
+    {
+        uint8_t key[16]; ///< IRK, most significant byte first
+        ble_addr_t id;   ///< Identity address
+    };
+
+    /// Resolved or unresolvable address.
+    struct SCache
+    {
+        uint8_t rpa[6]; ///< Resolvable private address
+        uint8_t irk;    ///< Index in mIrk (RPA_UNKNOWN - no IRK matches, RPA_EMPTY - free)
+        uint32_t used;  ///< Time of the last use in lookups
+    };
+
+    SIrk *mIrk;           ///< Bonded peers with an IRK
+    uint8_t mIrkCount;    ///< Entries in mIrk
+    uint8_t mIrkMax;      ///< Size of mIrk
+    SCache *mCache;       ///< Cache
+    uint16_t mCacheSize;  ///< Entries in mCache
+    uint32_t mClock = 0;  ///< Lookup counter
+
+    /**
+     * @brief Check an address against an IRK
+     *
+     * @param[in] key IRK, most significant byte first
+     * @param[in] rpa Address, least significant byte first
+     * @return true if the hash part of the address matches
+     */
+    static bool match(const uint8_t *key, const uint8_t *rpa);
+
+public:
+    /**
+     * @brief Constructor for the CRpaResolver class
+     *
+     * @param[in] cacheSize Number of cached addresses
+     * @param[in] maxIrk Maximum number of bonded peers
+     */
+    CRpaResolver(uint16_t cacheSize, uint8_t maxIrk);
+
+    /**
+     * @brief Destructor for the CRpaResolver class
+     */
+    ~CRpaResolver();
+
+    /**
+     * @brief Reload the IRKs of the bonded peers
+     *
+     * The cache is kept if the set of IRKs is unchanged.
+     */
+    void load();
+
+    /**
+     * @brief Resolve an address
+     *
+     * @param[in] rpa Resolvable private address, least significant byte first
+     * @param[out] id Identity address of the bonded peer
+     * @return true if the address belongs to a bonded peer
+     */
+    bool resolve(const uint8_t *rpa, ble_addr_t *id);
+};
@@ -0,0 +1,92 @@
+/*!
+    \file
+    \brief Suppression of repeated scan reports.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include <cstdint>
+
+#define SCANDEDUP_PROBE (8) ///< Slots searched per key.
+
+/**
+ * @brief Open-addressing table of recently reported advertisements
+ *
+ * Entries are keyed by the advertiser address and keep a hash of the last
+ * forwarded advertising data, so a device that changes its payload is
+ * reported at once. A report is suppressed if the same device sent the
+ * same payload less than the window ago and its RSSI moved less than the
+ * threshold since. Devices are told apart by the full address, so a hash
+ * collision never hides another device. Only the NimBLE host task
+ * calls check(); no locks are taken and nothing is allocated after the
+ * constructor. Expired entries are reused in place, so no tombstones are
+ * needed.
+ */
+class CScanDedup
+{
+protected:
+    /// Forwarded report.
+    struct SEntry
+    {
+        uint32_t hash;    ///< Payload hash of the last forwarded report
+        uint32_t time;    ///< Time of the last forwarded report in ms
+        uint8_t addr[6];  ///< Advertiser address
+        uint8_t addrType; ///< Advertiser address type
+        uint8_t used;     ///< Slot holds a device (0 - empty)
+        int8_t rssi;      ///< RSSI of the last forwarded report
+    };
+
+    SEntry *mTable;          ///< Slots
+    uint32_t mMask;          ///< Number of slots - 1
+    uint32_t mWindow;        ///< Suppression window in ms (0 - off)
+    uint8_t mRssiDelta;      ///< RSSI change in dB that is reported inside the window (0 - RSSI ignored)
+
+public:
+    /**
+     * @brief Constructor for the CScanDedup class
+     *
+     * @param[in] size Number of slots (rounded up to a power of 2)
+     * @param[in] window Suppression window in ms (0 - off)
+     * @param[in] rssiDelta RSSI change in dB that is reported inside the window (0 - RSSI ignored)
+     */
+    CScanDedup(uint16_t size, uint32_t window, uint8_t rssiDelta);
+
+    /**
+     * @brief Destructor for the CScanDedup class
+     */
+    ~CScanDedup();
+
+    /**
+     * @brief Change the suppression parameters
+     *
+     * @param[in] window Suppression window in ms (0 - off)
+     * @param[in] rssiDelta RSSI change in dB that is reported inside the window (0 - RSSI ignored)
+     */
+    inline void setWindow(uint32_t window, uint8_t rssiDelta)
+    {
+        mWindow = window;
+        mRssiDelta = rssiDelta;
+    };
+
+    /**
+     * @brief Forget all reports
+     *
+     * Must not run concurrently with check().
+     */
+    void clear();
+
+    /**
+     * @brief Check a report
+     *
+     * @param[in] addr Advertiser address (6 bytes)
+     * @param[in] addrType Advertiser address type
+     * @param[in] data Advertising data
+     * @param[in] len Data length
+     * @param[in] rssi RSSI in dBm
+     * @param[in] now Current time in ms
+     * @return true if the report is new or changed and must be forwarded
+     */
+    bool check(const uint8_t *addr, uint8_t addrType, const uint8_t *data, uint8_t len, int8_t rssi, uint32_t now);
+};
@@ -0,0 +1,379 @@
+/*!
+    \file
+    \brief Throughput and latency benchmark on the simulated link.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Streams fixed size packets on the main and the second channel at a
+    given rate (0 - as fast as the component accepts them) and reports per
+    channel:
+    - delivered payload bytes/s and notifications/s;
+    - p50/p99 latency from the sendData()/sendData2() call to the
+      notification accepted by the host (notify) and to the notification
+      received by the central (delivery);
+    and for both channels together heap allocations and CPU time per packet.
+
+    The main channel is measured as a byte stream, so a packet counts as
+    sent when its last byte is, which holds for plain, coalesced, framed
+    and ring transfers.
+
+    Options (--name=value):
+    - size, rate: main channel packet size and packets/s (size 0 - off);
+    - size2, rate2: the same for the second channel (default off);
+    - time: sending time in ms;
+    - profile: link profile requested by the component, 0..3 (EBTLinkProfile);
+    - mtu, interval, pdus, loss, delay: link (see sim::SLinkConfig);
+    - pool, block: mbuf count and block size (see sim::SPoolConfig).
+*/
+#include "CBTTask.h"
+#include "SimLink.h"
+#include "host/ble_hs.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <thread>
+#include <vector>
+
+#define BENCH_MAX_PACKETS (1 << 20) // Packets per channel recorded at most
+#define BENCH_DRAIN_MS (10000)      // Time to deliver the queued packets
+
+// Packets of one channel
+struct SChannel
+{
+    uint16_t size = 0;                 // Packet size, 0 - off
+    uint32_t rate = 0;                 // Packets/s, 0 - no pacing
+    std::vector<uint8_t> data;         // Packet
+    std::vector<int64_t> enqueued;     // Time of the send call per packet in us
+    std::vector<int64_t> notified;     // Time of the host notify per packet in us
+    std::vector<int64_t> delivered;    // Time of the central callback per packet in us
+    std::atomic<uint32_t> sent{0};     // Packets accepted by the component
+    std::atomic<uint32_t> failed{0};   // Packets refused by the component
+    uint64_t txBytes = 0;              // Payload bytes seen by the host (host task)
+    std::atomic<uint32_t> txPackets{0}; // Packets seen by the host
+    uint64_t rxBytes = 0;              // Payload bytes seen by the central (central thread)
+    std::atomic<uint32_t> rxPackets{0}; // Packets seen by the central
+    std::atomic<uint64_t> notifications{0}; // Notifications received by the central
+    std::atomic<int64_t> last{0};      // Time of the last delivery in us
+};
+
+static SChannel channels[2];
+static uint16_t central = BLE_HS_CONN_HANDLE_NONE;
+static std::atomic<bool> go{false};
+
+/**
+ * @brief Payload bytes of a notification
+ * @param chn Characteristic, from 1
+ * @param first First byte of the value
+ * @param size Value size
+ * @return Payload size without the framing header or the index
+ */
+static uint16_t payload(uint8_t chn, uint8_t first, uint16_t size)
+{
+    if (chn == 2)
+        return size - 2;
+#ifdef CONFIG_BLE_DATA_FRAMED
+    return size - ((first & 0x80) ? 3 : 1);
+#else
+    return size;
+#endif
+}
+
+/**
+ * @brief Time packets whose last byte was passed
+ * @param c Channel
+ * @param bytes Payload bytes so far
+ * @param count Packet counter
+ * @param times Receives the times
+ * @param now Current time in us
+ */
+static void account(SChannel &c, uint64_t bytes, std::atomic<uint32_t> &count, std::vector<int64_t> &times, int64_t now)
+{
+    uint32_t n = count.load(std::memory_order_relaxed);
+    while ((n < c.sent.load(std::memory_order_acquire)) && ((uint64_t)(n + 1) * c.size <= bytes))
+        times[n++] = now;
+    count.store(n, std::memory_order_release);
+}
+
+static void onTx(uint16_t conn, uint8_t chn, const struct os_mbuf *om)
+{
+    if ((conn != central) || (chn > 2))
+        return;
+    SChannel &c = channels[chn - 1];
+    int64_t now = esp_timer_get_time();
+    c.txBytes += payload(chn, om->om_data[0], OS_MBUF_PKTLEN(om));
+    account(c, c.txBytes, c.txPackets, c.notified, now);
+}
+
+static void onNotify(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size)
+{
+    if ((conn != central) || (chn > 2))
+        return;
+    SChannel &c = channels[chn - 1];
+    int64_t now = esp_timer_get_time();
+    c.notifications.fetch_add(1, std::memory_order_relaxed);
+    c.rxBytes += payload(chn, data[0], size);
+    account(c, c.rxBytes, c.rxPackets, c.delivered, now);
+    c.last.store(now, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Producer of one channel
+ * @param chn Channel index
+ * @param ms Sending time in ms
+ */
+static void produce(int chn, uint32_t ms)
+{
+    SChannel &c = channels[chn];
+    while (!go.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::milliseconds(ms);
+    for (uint32_t i = 0; i < c.enqueued.size(); i++)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end)
+            break;
+        if (c.rate != 0)
+        {
+            auto due = start + std::chrono::microseconds((uint64_t)i * 1000000 / c.rate);
+            if (due >= end)
+                break;
+            if (due > now)
+                std::this_thread::sleep_until(due);
+        }
+        c.enqueued[i] = esp_timer_get_time();
+        // Published before the call, so the hooks may time the packet during it
+        c.sent.store(i + 1, std::memory_order_release);
+        bool res = (chn == 0) ? CBTTask::Instance()->sendData(c.data.data(), c.size)
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+                              : CBTTask::Instance()->sendData2(c.data.data(), c.size, (uint16_t)i);
+#else
+                              : false;
+#endif
+        if (!res)
+        {
+            c.sent.store(i, std::memory_order_release);
+            c.failed++;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Percentile of the latencies
+ * @param from Start times
+ * @param to End times
+ * @param count Number of packets
+ * @param p Percentile, 0..100
+ * @return Latency in us
+ */
+static int64_t percentile(const std::vector<int64_t> &from, const std::vector<int64_t> &to, uint32_t count, uint32_t p)
+{
+    if (count == 0)
+        return 0;
+    std::vector<int64_t> lat(count);
+    for (uint32_t i = 0; i < count; i++)
+        lat[i] = to[i] - from[i];
+    size_t k = std::min<size_t>((size_t)count * p / 100, count - 1);
+    std::nth_element(lat.begin(), lat.begin() + k, lat.end());
+    return lat[k];
+}
+
+/**
+ * @brief CPU time of the process
+ * @return Time in ns
+ */
+static uint64_t processCpuTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Find an option
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @param name Option name
+ * @param def Default value
+ * @return Value
+ */
+static double option(int argc, char *argv[], const char *name, double def)
+{
+    size_t len = std::strlen(name);
+    for (int i = 1; i < argc; i++)
+    {
+        if ((std::strncmp(argv[i], "--", 2) == 0) && (std::strncmp(argv[i] + 2, name, len) == 0) && (argv[i][len + 2] == '='))
+            return std::atof(argv[i] + len + 3);
+    }
+    return def;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *names[2] = {"main", "second"};
+    sim::SLinkConfig link;
+    sim::SPoolConfig pool;
+    uint32_t ms;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if ((std::strncmp(argv[i], "--", 2) != 0) || (std::strchr(argv[i], '=') == nullptr))
+        {
+            std::fprintf(stderr, "usage: %s [--size=N] [--rate=N] [--size2=N] [--rate2=N] [--time=ms] [--profile=N] [--mtu=N] [--interval=N] [--pdus=N] [--loss=P] [--delay=us] [--pool=N] [--block=N]\n", argv[0]);
+            return 2;
+        }
+    }
+    channels[0].size = option(argc, argv, "size", 200);
+    channels[0].rate = option(argc, argv, "rate", 0);
+    channels[1].size = option(argc, argv, "size2", 0);
+    channels[1].rate = option(argc, argv, "rate2", 0);
+    ms = option(argc, argv, "time", 5000);
+    link.mtu = option(argc, argv, "mtu", link.mtu);
+    link.interval = option(argc, argv, "interval", link.interval);
+    link.pduPerEvent = option(argc, argv, "pdus", link.pduPerEvent);
+    link.loss = option(argc, argv, "loss", link.loss);
+    link.delay = option(argc, argv, "delay", link.delay);
+    pool.count = option(argc, argv, "pool", pool.count);
+    pool.size = option(argc, argv, "block", pool.size);
+#ifndef CONFIG_BLE_DATA_SECOND_CHANNEL
+    channels[1].size = 0;
+#endif
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    sim::setPool(pool);
+    sim::setTx(onTx);
+    sim::setNotify(onNotify);
+
+    CBTTask *bt = CBTTask::Instance();
+    bt->setLinkProfile((EBTLinkProfile)option(argc, argv, "profile", (int)EBTLinkProfile::Default));
+    bt->setData(
+        [](uint8_t *data, size_t size) {},
+#ifdef CONFIG_BLE_DATA_SECOND_CHANNEL
+        [](uint8_t *data, size_t size) {},
+#endif
+        nullptr);
+    central = sim::connect(link, 2000);
+    if (central == BLE_HS_CONN_HANDLE_NONE)
+    {
+        std::fprintf(stderr, "bench: no connection\n");
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Connection setup and parameter requests
+#ifndef CONFIG_BLE_DATA_FRAMED
+    if (channels[0].size > sim::mtu(central) - 3)
+    {
+        std::fprintf(stderr, "bench: main channel packets above MTU - 3 need CONFIG_BLE_DATA_FRAMED\n");
+        return 2;
+    }
+#endif
+    if (channels[1].size > sim::mtu(central) - 5)
+    {
+        std::fprintf(stderr, "bench: second channel packets above MTU - 5\n");
+        return 2;
+    }
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < 2; i++)
+    {
+        SChannel &c = channels[i];
+        if (c.size == 0)
+            continue;
+        size_t count = (c.rate != 0) ? std::min<uint64_t>((uint64_t)c.rate * ms / 1000 + 1, BENCH_MAX_PACKETS) : BENCH_MAX_PACKETS;
+        c.data.resize(c.size);
+        for (size_t k = 0; k < c.data.size(); k++)
+            c.data[k] = (uint8_t)k;
+        c.enqueued.assign(count, 0);
+        c.notified.assign(count, 0);
+        c.delivered.assign(count, 0);
+        producers.emplace_back(produce, i, ms);
+    }
+
+    sim::SLinkStats link0, link1;
+    sim::SAllocStats alloc0, alloc1;
+    sim::getStats(&link0);
+    sim::getAllocStats(&alloc0);
+    uint64_t cpu0 = processCpuTime();
+    uint64_t task0 = sim::taskCpuTime(BTTASK_NAME);
+    uint64_t host0 = sim::taskCpuTime("nimble_host");
+    int64_t start = esp_timer_get_time();
+    go = true;
+
+    for (auto &t : producers)
+        t.join();
+    auto drained = [] {
+        for (auto &c : channels)
+        {
+            if (c.rxPackets.load() != c.sent.load())
+                return false;
+        }
+        return true;
+    };
+    for (int i = 0; (i < BENCH_DRAIN_MS) && !drained(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    uint64_t cpu1 = processCpuTime();
+    uint64_t task1 = sim::taskCpuTime(BTTASK_NAME);
+    uint64_t host1 = sim::taskCpuTime("nimble_host");
+    sim::getAllocStats(&alloc1);
+    sim::getStats(&link1);
+    uint16_t itvl = sim::interval(central);
+    uint16_t mtu = sim::mtu(central);
+
+    std::printf("link: MTU %u, interval %.2f ms, %u PDUs/event, loss %.3f, delay %u us, pool %u x %u\n", mtu, itvl * 1.25,
+                link.pduPerEvent, link.loss, link.delay, pool.count, pool.size);
+    std::printf("%-7s %6s %9s %10s %12s %9s %9s %9s %9s\n", "channel", "size", "packets", "bytes/s", "notify/s",
+                "ntf p50", "ntf p99", "dlv p50", "dlv p99");
+    uint64_t packets = 0;
+    bool ok = drained();
+    for (int i = 0; i < 2; i++)
+    {
+        SChannel &c = channels[i];
+        if (c.size == 0)
+            continue;
+        uint32_t sent = c.sent.load();
+        uint32_t rx = c.rxPackets.load();
+        double sec = std::max<int64_t>(c.last.load() - start, 1) / 1e6;
+        packets += sent;
+        std::printf("%-7s %6u %9u %10.0f %12.1f %7.2fms %7.2fms %7.2fms %7.2fms\n", names[i], c.size, sent,
+                    (double)rx * c.size / sec, c.notifications.load() / sec,
+                    percentile(c.enqueued, c.notified, c.txPackets.load(), 50) / 1e3,
+                    percentile(c.enqueued, c.notified, c.txPackets.load(), 99) / 1e3,
+                    percentile(c.enqueued, c.delivered, rx, 50) / 1e3,
+                    percentile(c.enqueued, c.delivered, rx, 99) / 1e3);
+        if (c.failed.load() != 0)
+        {
+            std::fprintf(stderr, "bench: %s channel refused a packet\n", names[i]);
+            ok = false;
+        }
+    }
+    if (packets != 0)
+    {
+        std::printf("heap allocations per packet: %.3f (%.1f bytes)\n", (double)(alloc1.count - alloc0.count) / packets,
+                    (double)(alloc1.bytes - alloc0.bytes) / packets);
+        std::printf("CPU per packet: %.2f us process, %.2f us " BTTASK_NAME " task, %.2f us host task\n",
+                    (cpu1 - cpu0) / 1e3 / packets, (task1 - task0) / 1e3 / packets, (host1 - host0) / 1e3 / packets);
+    }
+    std::printf("link: %llu notifications, %llu PDUs, %llu lost, %llu events\n",
+                (unsigned long long)(link1.notifications - link0.notifications), (unsigned long long)(link1.pdus - link0.pdus),
+                (unsigned long long)(link1.lost - link0.lost), (unsigned long long)(link1.events - link0.events));
+    if (link1.truncated != link0.truncated)
+    {
+        std::fprintf(stderr, "bench: %llu notifications longer than MTU - 3\n", (unsigned long long)(link1.truncated - link0.truncated));
+        ok = false;
+    }
+    if (!drained())
+        std::fprintf(stderr, "bench: packets not delivered in %u ms\n", BENCH_DRAIN_MS);
+
+    sim::disconnect(central);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CBTTask::free();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,52 @@
+/*!
+    \file
+    \brief Configuration of the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Kconfig defaults of the component in data mode. Optional features are
+    switched on by the BT5DATA_SIM_FEATURES CMake list, which defines
+    CONFIG_BLE_DATA_<feature> for each entry; the values below only apply
+    to the features that are enabled.
+*/
+#pragma once
+
+#define CONFIG_BT_NIMBLE_ENABLED 1
+#define CONFIG_BT_NIMBLE_MAX_BONDS 3
+#define CONFIG_LOG_DEFAULT_LEVEL 2
+#define CONFIG_FREERTOS_CHECK_STACKOVERFLOW_NONE 1
+
+#define CONFIG_BLE_DATA_DEVICE_NAME "BLE Data"
+#define CONFIG_BLE_DATA_TASK0 1
+#define CONFIG_BLE_DATA_SECOND_CHANNEL 1
+#ifndef CONFIG_BLE_DATA_MAX_CONNECTIONS
+#define CONFIG_BLE_DATA_MAX_CONNECTIONS 1
+#endif
+#ifndef CONFIG_BLE_DATA_TX_RESERVE
+#define CONFIG_BLE_DATA_TX_RESERVE 4
+#endif
+
+#define CONFIG_BLE_DATA_FRAME_MAX 4096
+#define CONFIG_BLE_DATA_COALESCE_TIME 5
+#define CONFIG_BLE_DATA_TX_RING_SIZE 8192
+#define CONFIG_BLE_DATA_RX_ACK_EVERY 8
+#define CONFIG_BLE_DATA_RX_RING_SIZE 4096
+#define CONFIG_BLE_DATA_ADAPTIVE_WINDOW 500
+#define CONFIG_BLE_DATA_ADAPTIVE_HIGH 2000
+#define CONFIG_BLE_DATA_ADAPTIVE_LOW 200
+#define CONFIG_BLE_DATA_ADAPTIVE_IDLE 4
+#define CONFIG_BLE_DATA_POOL_32 16
+#define CONFIG_BLE_DATA_POOL_64 16
+#define CONFIG_BLE_DATA_POOL_256 16
+#define CONFIG_BLE_DATA_POOL_512 4
+
+#if defined(CONFIG_BLE_DATA_IBEACON_SCAN) || defined(CONFIG_BLE_DATA_IBEACON_TX) || defined(CONFIG_BLE_DATA_L2CAP)
+#error "The host simulation covers data mode only"
+#endif
+#if defined(CONFIG_BLE_DATA_COALESCE) && (defined(CONFIG_BLE_DATA_FRAMED) || defined(CONFIG_BLE_DATA_TX_RING))
+#error "CONFIG_BLE_DATA_COALESCE excludes FRAMED and TX_RING"
+#endif
+#if defined(CONFIG_BLE_DATA_PROBE) && !defined(CONFIG_BLE_DATA_METRICS)
+#error "CONFIG_BLE_DATA_PROBE needs METRICS"
+#endif
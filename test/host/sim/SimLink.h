@@ -0,0 +1,159 @@
+/*!
+    \file
+    \brief Simulated central and link of the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    The component runs as the peripheral on the simulated NimBLE host. The
+    functions below play the central: they connect to the advertising
+    peripheral, write to its characteristics and receive its notifications.
+    A controller thread moves the packets of both directions once per
+    connection interval, with a limited number of PDUs per event, PDU loss
+    repaired by retransmission and a fixed delay before the central sees a
+    notification. Notification mbufs return to the pool when the central
+    acknowledges the last PDU, so the pool fills when the link is slower
+    than the producer, as on the device.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace sim
+{
+    /// Parameters of the mbuf pool, used by the next nimble_port_init().
+    struct SPoolConfig
+    {
+        uint16_t count = 12; ///< Number of blocks
+        uint16_t size = 256; ///< Data bytes per block
+    };
+
+    /// Behaviour of the central and of the link.
+    struct SLinkConfig
+    {
+        uint16_t mtu = 247;         ///< ATT MTU of the central, 0 - no exchange
+        uint16_t interval = 24;     ///< Initial connection interval in 1.25 ms units
+        uint16_t latency = 0;       ///< Peripheral latency
+        uint16_t timeout = 400;     ///< Supervision timeout in 10 ms units
+        bool acceptUpdates = true;  ///< Accept connection parameter requests
+        bool phy2M = true;          ///< Accept the 2M PHY
+        uint16_t maxTxOctets = 251; ///< Largest link layer payload the central accepts
+        uint8_t pduPerEvent = 6;    ///< Largest number of PDUs per connection event
+        float loss = 0.0f;          ///< Probability that a PDU is lost and repeated
+        uint32_t delay = 0;         ///< Time from reception to the notification callback in us
+        uint32_t seed = 1;          ///< Seed of the loss generator
+    };
+
+    /// Link counters.
+    struct SLinkStats
+    {
+        uint64_t notifications;   ///< Notifications delivered to the central
+        uint64_t notifyBytes;     ///< Bytes of the delivered notifications
+        uint64_t writes;          ///< Writes delivered to the peripheral
+        uint64_t pdus;            ///< PDUs sent in both directions
+        uint64_t lost;            ///< Lost PDUs
+        uint64_t events;          ///< Connection events
+        uint64_t truncated;       ///< Notifications longer than MTU - 3
+        uint64_t rejectedWrites;  ///< Writes refused by the peripheral
+    };
+
+    /// Allocation counters.
+    struct SAllocStats
+    {
+        uint64_t count; ///< pvPortMalloc(), heap_caps_malloc() and operator new calls
+        uint64_t bytes; ///< Allocated bytes
+    };
+
+    /// Notification callback of the central.
+    /*!
+      Called in the central thread.
+      \param[in] conn connection handle.
+      \param[in] chn characteristic in registration order, from 1.
+      \param[in] data notification value.
+      \param[in] size value size.
+    */
+    typedef void onNotify(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size);
+
+    /// Notification hook of the host.
+    /*!
+      Called in the calling task of ble_gatts_notify_custom() when the host
+      accepts a notification.
+      \param[in] conn connection handle.
+      \param[in] chn characteristic in registration order, from 1.
+      \param[in] om notification value.
+    */
+    typedef void onTx(uint16_t conn, uint8_t chn, const struct os_mbuf *om);
+
+    /// Set the parameters of the mbuf pool.
+    void setPool(const SPoolConfig &config);
+
+    /// Set the notification callback of the central.
+    void setNotify(onNotify *cb);
+
+    /// Set the notification hook of the host.
+    void setTx(onTx *cb);
+
+    /// Wait until the peripheral advertises.
+    /*!
+      \param[in] ms timeout in ms.
+      \return true if the peripheral advertises.
+    */
+    bool waitAdvertising(uint32_t ms);
+
+    /// Connect to the advertising peripheral.
+    /*!
+      Also exchanges the MTU if config.mtu is not 0.
+      \param[in] config central and link behaviour.
+      \param[in] ms timeout of waiting for advertising in ms.
+      \return connection handle or 0xffff on timeout.
+    */
+    uint16_t connect(const SLinkConfig &config, uint32_t ms = 1000);
+
+    /// Disconnect.
+    /*!
+      \param[in] conn connection handle.
+    */
+    void disconnect(uint16_t conn);
+
+    /// Write to a characteristic.
+    /*!
+      The write is delivered at the next connection event.
+      \param[in] conn connection handle.
+      \param[in] chn characteristic in registration order, from 1.
+      \param[in] data value.
+      \param[in] size value size, up to MTU - 3.
+      \return false if the connection is gone or the mbuf pool is empty.
+    */
+    bool write(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size);
+
+    /// Get the negotiated ATT MTU.
+    /*!
+      \param[in] conn connection handle.
+      \return MTU, 0 if not connected.
+    */
+    uint16_t mtu(uint16_t conn);
+
+    /// Get the connection interval.
+    /*!
+      \param[in] conn connection handle.
+      \return interval in 1.25 ms units, 0 if not connected.
+    */
+    uint16_t interval(uint16_t conn);
+
+    /// Get the link counters.
+    void getStats(SLinkStats *stats);
+
+    /// Get the number of free mbuf blocks.
+    int freeBlocks();
+
+    /// Get the allocation counters.
+    void getAllocStats(SAllocStats *stats);
+
+    /// Get the CPU time of a task.
+    /*!
+      \param[in] name task name.
+      \return CPU time in ns, 0 if there is no such task.
+    */
+    uint64_t taskCpuTime(const char *name);
+}
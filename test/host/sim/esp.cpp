@@ -0,0 +1,197 @@
+/*!
+    \file
+    \brief ESP-IDF services for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+void sim_count_alloc(size_t size);
+
+static esp_log_level_t log_level = (esp_log_level_t)CONFIG_LOG_DEFAULT_LEVEL;
+static std::mutex log_mux;
+static const auto start_time = std::chrono::steady_clock::now();
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    log_level = level;
+}
+
+bool esp_log_enabled(esp_log_level_t level)
+{
+    return level <= log_level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+    va_list args;
+
+    if (!esp_log_enabled(level))
+        return;
+    std::lock_guard<std::mutex> lock(log_mux);
+    std::fprintf(stderr, "%c (%lld) %s: ", letters[level], (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, format);
+    std::vfprintf(stderr, format, args);
+    va_end(args);
+    std::fputc('\n', stderr);
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t len)
+{
+    const uint8_t *data = (const uint8_t *)buffer;
+
+    if (!esp_log_enabled(ESP_LOG_INFO))
+        return;
+    std::lock_guard<std::mutex> lock(log_mux);
+    for (uint16_t i = 0; i < len; i += 16)
+    {
+        std::fprintf(stderr, "I %s:", tag);
+        for (uint16_t k = i; (k < len) && (k < i + 16); k++)
+            std::fprintf(stderr, " %02x", data[k]);
+        std::fputc('\n', stderr);
+    }
+}
+
+int64_t esp_timer_get_time()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+uint32_t esp_random()
+{
+    static std::mutex mux;
+    static std::mt19937 gen(std::random_device{}());
+    std::lock_guard<std::mutex> lock(mux);
+    return gen();
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *dt = (uint8_t *)buf;
+    for (size_t i = 0; i < len; i++)
+        dt[i] = (uint8_t)esp_random();
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    sim_count_alloc(size);
+    return std::malloc(size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    std::free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return 256 * 1024;
+}
+
+// In-memory NVS: namespace/key -> value
+static std::mutex nvs_mux;
+static std::map<std::string, std::vector<uint8_t>> nvs_data;
+static std::vector<std::string> nvs_spaces;
+
+/**
+ * @brief Build the storage key of an NVS entry
+ * @param handle Namespace handle
+ * @param key Key
+ * @return Storage key
+ */
+static std::string nvs_key(nvs_handle_t handle, const char *key)
+{
+    return nvs_spaces[handle - 1] + "/" + key;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mux);
+    for (size_t i = 0; i < nvs_spaces.size(); i++)
+    {
+        if (nvs_spaces[i] == name)
+        {
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    nvs_spaces.push_back(name);
+    *out_handle = nvs_spaces.size();
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(nvs_mux);
+    auto it = nvs_data.find(nvs_key(handle, key));
+    if (it == nvs_data.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+    if (out_value != nullptr)
+    {
+        if (*length < it->second.size())
+            return ESP_ERR_INVALID_ARG;
+        std::memcpy(out_value, it->second.data(), it->second.size());
+    }
+    *length = it->second.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(nvs_mux);
+    nvs_data[nvs_key(handle, key)].assign((const uint8_t *)value, (const uint8_t *)value + length);
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    size_t length = 1;
+    return nvs_get_blob(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return nvs_set_blob(handle, key, &value, 1);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return nvs_get_blob(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return nvs_set_blob(handle, key, value, std::strlen(value) + 1);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> lock(nvs_mux);
+    return (nvs_data.erase(nvs_key(handle, key)) != 0) ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
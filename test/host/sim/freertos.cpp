@@ -0,0 +1,377 @@
+/*!
+    \file
+    \brief FreeRTOS API on Linux threads for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Tasks are detached threads, queues are fixed rings under a mutex and
+    semaphores are queues of empty items. Queue operations do not allocate,
+    so the allocation counters only see the code under test.
+*/
+#include "freertos/FreeRTOS.h"
+#include "SimLink.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <string>
+#include <thread>
+#include <time.h>
+
+struct SSimTask
+{
+    TaskFunction_t fn;  // Task function
+    void *param;        // Task parameter
+    std::string name;   // Task name
+    clockid_t clock;    // CPU time clock of the thread
+};
+
+struct SSimQueue
+{
+    std::mutex mux;
+    std::condition_variable rx; // Signalled when an item is added
+    std::condition_variable tx; // Signalled when an item is removed
+    uint8_t *buf;               // Items
+    UBaseType_t size;           // Item size
+    UBaseType_t length;         // Capacity
+    UBaseType_t head = 0;       // First item
+    UBaseType_t count = 0;      // Items in the queue
+};
+
+// Thrown by vTaskDelete(nullptr) to leave the task function
+struct SSimTaskExit
+{
+};
+
+static std::recursive_mutex critical;
+static thread_local SSimTask *current = nullptr;
+static const auto start_time = std::chrono::steady_clock::now();
+
+static std::mutex tasks_mux;
+static SSimTask *tasks[16];
+
+static std::atomic<uint64_t> alloc_count{0};
+static std::atomic<uint64_t> alloc_bytes{0};
+
+void sim_critical_enter()
+{
+    critical.lock();
+}
+
+void sim_critical_exit()
+{
+    critical.unlock();
+}
+
+/**
+ * @brief Count an allocation
+ * @param size Allocation size
+ */
+void sim_count_alloc(size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void *pvPortMalloc(size_t size)
+{
+    sim_count_alloc(size);
+    return std::malloc(size);
+}
+
+void vPortFree(void *ptr)
+{
+    std::free(ptr);
+}
+
+void *operator new(size_t size)
+{
+    sim_count_alloc(size);
+    void *ptr = std::malloc(size != 0 ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/**
+ * @brief Thread of a task
+ * @param task Task
+ */
+static void task_thread(SSimTask *task)
+{
+    current = task;
+    pthread_getcpuclockid(pthread_self(), &task->clock);
+    pthread_setname_np(pthread_self(), task->name.substr(0, 15).c_str());
+    {
+        std::lock_guard<std::mutex> lock(tasks_mux);
+        for (auto &t : tasks)
+        {
+            if (t == nullptr)
+            {
+                t = task;
+                break;
+            }
+        }
+    }
+    try
+    {
+        task->fn(task->param);
+    }
+    catch (SSimTaskExit &)
+    {
+    }
+    {
+        std::lock_guard<std::mutex> lock(tasks_mux);
+        for (auto &t : tasks)
+        {
+            if (t == task)
+                t = nullptr;
+        }
+    }
+    delete task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+    SSimTask *task = new SSimTask;
+    task->fn = fn;
+    task->param = param;
+    task->name = name;
+    if (handle != nullptr)
+        *handle = task;
+    std::thread(task_thread, task).detach();
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only the calling task can end itself: a thread cannot be killed
+    if ((task == nullptr) || (task == current))
+        throw SSimTaskExit();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return (TickType_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return current;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark2(TaskHandle_t task)
+{
+    return 0;
+}
+
+/**
+ * @brief Wait on a condition with a FreeRTOS timeout
+ * @param cv Condition
+ * @param lock Lock of the queue
+ * @param wait Timeout in ticks
+ * @param ready Condition check
+ * @return true if the condition is met
+ */
+template <typename T>
+static bool queue_wait(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, TickType_t wait, T ready)
+{
+    if (wait == portMAX_DELAY)
+    {
+        cv.wait(lock, ready);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(wait), ready);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    SSimQueue *queue = new SSimQueue;
+    queue->buf = (itemSize != 0) ? new uint8_t[length * itemSize] : nullptr;
+    queue->size = itemSize;
+    queue->length = length;
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete[] queue->buf;
+    delete queue;
+}
+
+/**
+ * @brief Add an item to a queue
+ * @param queue Queue
+ * @param item Item
+ * @param wait Timeout in ticks
+ * @param front Add to the front
+ * @return pdTRUE if the item was added
+ */
+static BaseType_t queue_send(QueueHandle_t queue, const void *item, TickType_t wait, bool front)
+{
+    std::unique_lock<std::mutex> lock(queue->mux);
+    if (!queue_wait(queue->tx, lock, wait, [queue]
+                    { return queue->count < queue->length; }))
+        return pdFALSE;
+    UBaseType_t pos;
+    if (front)
+        pos = queue->head = (queue->head + queue->length - 1) % queue->length;
+    else
+        pos = (queue->head + queue->count) % queue->length;
+    if (queue->size != 0)
+        std::memcpy(&queue->buf[pos * queue->size], item, queue->size);
+    queue->count++;
+    queue->rx.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    return queue_send(queue, item, wait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    return queue_send(queue, item, wait, true);
+}
+
+/**
+ * @brief Take or peek the first item of a queue
+ * @param queue Queue
+ * @param item Receives the item
+ * @param wait Timeout in ticks
+ * @param remove Remove the item
+ * @return pdTRUE if there was an item
+ */
+static BaseType_t queue_receive(QueueHandle_t queue, void *item, TickType_t wait, bool remove)
+{
+    std::unique_lock<std::mutex> lock(queue->mux);
+    if (!queue_wait(queue->rx, lock, wait, [queue]
+                    { return queue->count != 0; }))
+        return pdFALSE;
+    if (queue->size != 0)
+        std::memcpy(item, &queue->buf[queue->head * queue->size], queue->size);
+    if (remove)
+    {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        queue->tx.notify_one();
+    }
+    else
+        queue->rx.notify_one(); // Let the next waiting receiver see the item
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    return queue_receive(queue, item, wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    return queue_receive(queue, item, wait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->mux);
+    return queue->count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    std::lock_guard<std::mutex> lock(queue->mux);
+    return queue->length - queue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xQueueCreate(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    xSemaphoreGive(sem);
+    return sem;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+    return queue_receive(sem, nullptr, wait, true);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return queue_send(sem, nullptr, 0, false);
+}
+
+namespace sim
+{
+    /**
+     * @brief Get the allocation counters
+     * @param stats Receives the counters
+     */
+    void getAllocStats(SAllocStats *stats)
+    {
+        stats->count = alloc_count.load();
+        stats->bytes = alloc_bytes.load();
+    }
+
+    /**
+     * @brief Get the CPU time of a task
+     * @param name Task name
+     * @return CPU time in ns, 0 if there is no such task
+     */
+    uint64_t taskCpuTime(const char *name)
+    {
+        std::lock_guard<std::mutex> lock(tasks_mux);
+        for (auto t : tasks)
+        {
+            if ((t != nullptr) && (t->name == name))
+            {
+                struct timespec ts;
+                if (clock_gettime(t->clock, &ts) != 0)
+                    return 0;
+                return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+        }
+        return 0;
+    }
+}
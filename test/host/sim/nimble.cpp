@@ -0,0 +1,1237 @@
+/*!
+    \file
+    \brief Simulated NimBLE host, controller and central.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Three threads stand in for the radio side:
+    - the NimBLE host task runs GAP and GATT callbacks from an event ring;
+    - the controller runs the connection events of each connection;
+    - the central thread calls the notification callback after the delay
+      of the link.
+    All state is guarded by one mutex, which is never held while calling
+    into the component. The mbuf pool has its own lock, taken inside it.
+*/
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "SimLink.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define SIM_LEADING (8)          // Leading space of a block for ACL/L2CAP/ATT headers
+#define SIM_MAX_CONN (4)         // Connections
+#define SIM_MAX_CHR (8)          // Characteristics
+#define SIM_HOST_EVENTS (64)     // Host event ring
+#define SIM_CONN_QUEUE (64)      // Packets queued per direction and connection
+#define SIM_DELIVERY (64)        // Notifications waiting for the central callback
+#define SIM_PREFERRED_MTU (256)  // Default preferred MTU of the host
+#define SIM_UPDATE_EVENTS (6)    // Connection events until a parameter update takes effect
+#define SIM_TERM_LOCAL (0x216)   // BLE_HS_HCI_ERR(BLE_ERR_CONN_TERM_LOCAL)
+#define SIM_TERM_REMOTE (0x213)  // BLE_HS_HCI_ERR(BLE_ERR_REM_USER_CONN_TERM)
+#define SIM_UPDATE_REJECT (0x21a) // BLE_HS_HCI_ERR(BLE_ERR_UNSUPP_REM_FEATURE)
+
+static const char *TAG = "sim";
+
+struct ble_hs_cfg ble_hs_cfg;
+
+// Mbuf pool
+static std::mutex pool_mux;
+static std::vector<os_mbuf> pool_blocks;
+static std::vector<uint8_t> pool_data;
+static os_mbuf *pool_free = nullptr;
+static std::atomic<int> pool_count{0};
+static sim::SPoolConfig pool_config;
+
+// Packet queued on a connection
+struct SPacket
+{
+    os_mbuf *om;  // Packet
+    uint16_t attr; // Attribute handle
+    uint8_t pdus;  // PDUs still to send
+};
+
+// Fixed ring of packets
+struct SPacketRing
+{
+    SPacket items[SIM_CONN_QUEUE];
+    uint16_t head = 0;
+    uint16_t count = 0;
+
+    bool push(const SPacket &p)
+    {
+        if (count == SIM_CONN_QUEUE)
+            return false;
+        items[(head + count) % SIM_CONN_QUEUE] = p;
+        count++;
+        return true;
+    }
+    SPacket *front() { return (count != 0) ? &items[head] : nullptr; }
+    void pop()
+    {
+        head = (head + 1) % SIM_CONN_QUEUE;
+        count--;
+    }
+};
+
+struct SConn
+{
+    bool used = false;
+    uint16_t handle;
+    sim::SLinkConfig cfg;
+    uint16_t mtu;
+    bool mtuDone;
+    uint16_t itvl;
+    uint16_t latency;
+    uint16_t timeout;
+    uint8_t phy;
+    uint16_t txOctets;
+    ble_gap_event_fn *cb;
+    void *arg;
+    int64_t next;        // Time of the next connection event in us
+    uint64_t events;     // Connection events
+    bool update;         // Parameter update pending
+    uint64_t updateAt;   // Event of the update
+    ble_gap_upd_params params;
+    SPacketRing tx;      // Notifications
+    SPacketRing rx;      // Writes
+    std::mt19937 rng;
+};
+
+enum class EHostEvent : uint8_t
+{
+    Gap,   // GAP event for cb
+    Write, // Write to attr
+    Mtu,   // MTU exchange completion for mtuCb
+};
+
+struct SHostEvent
+{
+    EHostEvent type;
+    uint16_t conn;
+    uint16_t attr;
+    os_mbuf *om;
+    ble_gap_event gap;
+    ble_gap_event_fn *cb;
+    ble_gatt_mtu_fn *mtuCb;
+    void *arg;
+    uint64_t seq;
+};
+
+struct SDelivery
+{
+    int64_t due;
+    uint16_t conn;
+    uint8_t chn;
+    uint16_t size;
+    uint8_t data[BLE_ATT_MTU_MAX];
+};
+
+enum class EHostState
+{
+    Idle,
+    Starting,
+    Running,
+    Stopping,
+};
+
+// Never destroyed: the detached threads may still wait on them at exit
+static std::mutex &mux = *new std::mutex;
+static std::condition_variable &host_cv = *new std::condition_variable;       // Host events, host state
+static std::condition_variable &controller_cv = *new std::condition_variable; // Connections changed
+static std::condition_variable &central_cv = *new std::condition_variable;    // Deliveries, advertising
+static std::thread controller_thread;
+static std::thread central_thread;
+static bool threads_run = false;
+
+static EHostState host_state = EHostState::Idle;
+static TaskHandle_t host_task = nullptr;
+static bool synced = false;
+static SHostEvent host_events[SIM_HOST_EVENTS];
+static uint16_t host_head = 0;
+static uint16_t host_count = 0;
+static uint64_t host_seq = 0;  // Last queued event
+static uint64_t host_done = 0; // Last processed event
+
+static const ble_gatt_svc_def *svcs[4];
+static uint8_t svc_count = 0;
+static const ble_gatt_chr_def *chrs[SIM_MAX_CHR];
+static uint16_t chr_handles[SIM_MAX_CHR];
+static uint8_t chr_count = 0;
+static char device_name[32] = "nimble";
+
+static bool adv = false;
+static ble_gap_event_fn *adv_cb = nullptr;
+static void *adv_arg = nullptr;
+static uint16_t preferred_mtu = SIM_PREFERRED_MTU;
+static uint16_t next_handle = 1;
+static SConn conns[SIM_MAX_CONN];
+
+static SDelivery deliveries[SIM_DELIVERY];
+static uint16_t delivery_head = 0;
+static uint16_t delivery_count = 0;
+
+static sim::onNotify *notify_cb = nullptr;
+static sim::onTx *tx_cb = nullptr;
+static sim::SLinkStats stats;
+
+/**
+ * @brief Take a block from the pool
+ * @return Block or nullptr
+ */
+static os_mbuf *block_alloc()
+{
+    std::lock_guard<std::mutex> lock(pool_mux);
+    os_mbuf *om = pool_free;
+    if (om == nullptr)
+        return nullptr;
+    pool_free = om->om_next;
+    pool_count--;
+    om->om_data = om->om_databuf + SIM_LEADING;
+    om->om_len = 0;
+    om->om_pktlen = 0;
+    om->om_next = nullptr;
+    return om;
+}
+
+/**
+ * @brief Build the pool and put all blocks on the free list
+ */
+static void pool_reset()
+{
+    std::lock_guard<std::mutex> lock(pool_mux);
+    if (pool_blocks.size() != pool_config.count || (pool_data.size() != (size_t)pool_config.count * (pool_config.size + SIM_LEADING)))
+    {
+        pool_blocks.assign(pool_config.count, os_mbuf());
+        pool_data.assign((size_t)pool_config.count * (pool_config.size + SIM_LEADING), 0);
+    }
+    pool_free = nullptr;
+    for (size_t i = 0; i < pool_blocks.size(); i++)
+    {
+        os_mbuf *om = &pool_blocks[i];
+        om->om_databuf = &pool_data[i * (pool_config.size + SIM_LEADING)];
+        om->om_size = pool_config.size + SIM_LEADING;
+        om->om_next = pool_free;
+        pool_free = om;
+    }
+    pool_count = pool_blocks.size();
+}
+
+/**
+ * @brief Trailing space of a block
+ * @param om Block
+ * @return Free bytes after the data
+ */
+static uint16_t block_trailing(const os_mbuf *om)
+{
+    return (uint16_t)(om->om_databuf + om->om_size - (om->om_data + om->om_len));
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len)
+{
+    return block_alloc();
+}
+
+int os_msys_num_free()
+{
+    return pool_count.load();
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    os_mbuf *last = om;
+
+    while (last->om_next != nullptr)
+        last = last->om_next;
+    while (len != 0)
+    {
+        uint16_t n = std::min(len, block_trailing(last));
+        if (n == 0)
+        {
+            os_mbuf *next = block_alloc();
+            if (next == nullptr)
+                return BLE_HS_ENOMEM;
+            next->om_data = next->om_databuf; // Only the first block keeps the leading space
+            last->om_next = next;
+            last = next;
+            continue;
+        }
+        std::memcpy(last->om_data + last->om_len, src, n);
+        last->om_len += n;
+        om->om_pktlen += n;
+        src += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void *os_mbuf_extend(struct os_mbuf *om, uint16_t len)
+{
+    os_mbuf *last = om;
+
+    while (last->om_next != nullptr)
+        last = last->om_next;
+    if (block_trailing(last) < len)
+    {
+        if (len > pool_config.size + SIM_LEADING)
+            return nullptr;
+        os_mbuf *next = block_alloc();
+        if (next == nullptr)
+            return nullptr;
+        next->om_data = next->om_databuf;
+        last->om_next = next;
+        last = next;
+    }
+    void *ptr = last->om_data + last->om_len;
+    last->om_len += len;
+    om->om_pktlen += len;
+    return ptr;
+}
+
+struct os_mbuf *os_mbuf_dup(struct os_mbuf *om)
+{
+    os_mbuf *copy = block_alloc();
+    if (copy == nullptr)
+        return nullptr;
+    for (os_mbuf *m = om; m != nullptr; m = m->om_next)
+    {
+        if (os_mbuf_append(copy, m->om_data, m->om_len) != 0)
+        {
+            os_mbuf_free_chain(copy);
+            return nullptr;
+        }
+    }
+    return copy;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    uint8_t *out = (uint8_t *)dst;
+
+    for (; (om != nullptr) && (len > 0); om = om->om_next)
+    {
+        if (off >= om->om_len)
+        {
+            off -= om->om_len;
+            continue;
+        }
+        int n = std::min(len, om->om_len - off);
+        std::memcpy(out, om->om_data + off, n);
+        out += n;
+        len -= n;
+        off = 0;
+    }
+    return (len > 0) ? -1 : 0;
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om)
+{
+    std::lock_guard<std::mutex> lock(pool_mux);
+    while (om != nullptr)
+    {
+        os_mbuf *next = om->om_next;
+        om->om_next = pool_free;
+        pool_free = om;
+        pool_count++;
+        om = next;
+    }
+    return 0;
+}
+
+struct os_mbuf *ble_hs_mbuf_att_pkt()
+{
+    return block_alloc();
+}
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len)
+{
+    os_mbuf *om = ble_hs_mbuf_att_pkt();
+    if (om == nullptr)
+        return nullptr;
+    if (os_mbuf_append(om, buf, len) != 0)
+    {
+        os_mbuf_free_chain(om);
+        return nullptr;
+    }
+    return om;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len)
+{
+    uint16_t len = std::min(om->om_pktlen, max_len);
+    os_mbuf_copydata(om, 0, len, flat);
+    if (out_copy_len != nullptr)
+        *out_copy_len = len;
+    return (len < om->om_pktlen) ? BLE_HS_EMSGSIZE : 0;
+}
+
+/**
+ * @brief Find a connection
+ * @param handle Connection handle
+ * @return Connection or nullptr, mux must be held
+ */
+static SConn *conn_find(uint16_t handle)
+{
+    for (auto &c : conns)
+    {
+        if (c.used && (c.handle == handle))
+            return &c;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Find the characteristic of an attribute handle
+ * @param attr Attribute handle
+ * @return Characteristic index or -1
+ */
+static int chr_find(uint16_t attr)
+{
+    for (uint8_t i = 0; i < chr_count; i++)
+    {
+        if (chr_handles[i] == attr)
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Queue a host event
+ * @param ev Event
+ * @return Sequence number of the event, 0 if the ring is full; mux must be held
+ */
+static uint64_t host_post(const SHostEvent &ev)
+{
+    if ((host_count == SIM_HOST_EVENTS) || (host_state != EHostState::Running))
+        return 0;
+    SHostEvent &slot = host_events[(host_head + host_count) % SIM_HOST_EVENTS];
+    slot = ev;
+    slot.seq = ++host_seq;
+    host_count++;
+    host_cv.notify_all();
+    return slot.seq;
+}
+
+/**
+ * @brief Queue a GAP event for a connection
+ * @param c Connection
+ * @param gap Event
+ * @return Sequence number of the event; mux must be held
+ */
+static uint64_t gap_post(SConn *c, const ble_gap_event &gap)
+{
+    SHostEvent ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.type = EHostEvent::Gap;
+    ev.conn = c->handle;
+    ev.gap = gap;
+    ev.cb = c->cb;
+    ev.arg = c->arg;
+    return host_post(ev);
+}
+
+/**
+ * @brief Release the queues of a connection
+ * @param c Connection, mux must be held
+ */
+static void conn_clear(SConn *c)
+{
+    for (SPacketRing *ring : {&c->tx, &c->rx})
+    {
+        while (SPacket *p = ring->front())
+        {
+            os_mbuf_free_chain(p->om);
+            ring->pop();
+        }
+    }
+    c->used = false;
+}
+
+/**
+ * @brief Drop a connection and report it to the peripheral
+ * @param c Connection
+ * @param reason Disconnect reason; mux must be held
+ */
+static void conn_drop(SConn *c, int reason)
+{
+    ble_gap_event gap;
+    std::memset(&gap, 0, sizeof(gap));
+    gap.type = BLE_GAP_EVENT_DISCONNECT;
+    gap.disconnect.reason = reason;
+    gap.disconnect.conn.conn_handle = c->handle;
+    gap.disconnect.conn.conn_itvl = c->itvl;
+    gap.disconnect.conn.conn_latency = c->latency;
+    gap.disconnect.conn.supervision_timeout = c->timeout;
+    gap_post(c, gap);
+    conn_clear(c);
+}
+
+/**
+ * @brief Number of link layer PDUs of an ATT packet
+ * @param c Connection
+ * @param len ATT value size
+ * @return PDUs
+ */
+static uint8_t pdu_count(const SConn *c, uint16_t len)
+{
+    uint16_t l2cap = len + 3 + 4; // ATT opcode and handle, L2CAP header
+    return (uint8_t)((l2cap + c->txOctets - 1) / c->txOctets);
+}
+
+/**
+ * @brief Run a connection event
+ * @param c Connection, mux must be held
+ */
+static void conn_event(SConn *c)
+{
+    int64_t itvl = (int64_t)c->itvl * 1250;
+    int rate = (c->phy == BLE_GAP_LE_PHY_2M) ? 2 : 1;
+    // Full PDU, empty acknowledgement and two inter frame spaces
+    int64_t exchange = ((c->txOctets + 10) * 8 + 10 * 8) / rate + 300;
+    int budget = std::max<int>(1, std::min<int64_t>(c->cfg.pduPerEvent, itvl / exchange));
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+    c->events++;
+    stats.events++;
+    if (c->update && (c->events >= c->updateAt))
+    {
+        ble_gap_event gap;
+        c->update = false;
+        c->itvl = std::max(c->params.itvl_min, (uint16_t)6);
+        c->latency = c->params.latency;
+        c->timeout = c->params.supervision_timeout;
+        std::memset(&gap, 0, sizeof(gap));
+        gap.type = BLE_GAP_EVENT_CONN_UPDATE;
+        gap.conn_update.conn_handle = c->handle;
+        gap_post(c, gap);
+    }
+    for (int i = 0; i < budget; i++)
+    {
+        SPacket *up = c->rx.front();
+        SPacket *down = c->tx.front();
+        if ((up == nullptr) && (down == nullptr))
+            break;
+        if (up != nullptr)
+        {
+            stats.pdus++;
+            if (dist(c->rng) < c->cfg.loss)
+                stats.lost++;
+            else if ((up->pdus > 1) || (host_count < SIM_HOST_EVENTS))
+            {
+                if (--up->pdus == 0)
+                {
+                    SHostEvent ev;
+                    std::memset(&ev, 0, sizeof(ev));
+                    ev.type = EHostEvent::Write;
+                    ev.conn = c->handle;
+                    ev.attr = up->attr;
+                    ev.om = up->om;
+                    if (host_post(ev) == 0)
+                        os_mbuf_free_chain(up->om);
+                    c->rx.pop();
+                }
+            }
+        }
+        if (down != nullptr)
+        {
+            stats.pdus++;
+            if (dist(c->rng) < c->cfg.loss)
+                stats.lost++;
+            else if ((down->pdus > 1) || (delivery_count < SIM_DELIVERY))
+            {
+                if (--down->pdus == 0)
+                {
+                    SDelivery &d = deliveries[(delivery_head + delivery_count) % SIM_DELIVERY];
+                    d.due = esp_timer_get_time() + c->cfg.delay;
+                    d.conn = c->handle;
+                    d.chn = (uint8_t)(chr_find(down->attr) + 1);
+                    d.size = std::min<uint16_t>(OS_MBUF_PKTLEN(down->om), sizeof(d.data));
+                    os_mbuf_copydata(down->om, 0, d.size, d.data);
+                    delivery_count++;
+                    stats.notifications++;
+                    stats.notifyBytes += d.size;
+                    os_mbuf_free_chain(down->om); // Acknowledged by the central
+                    c->tx.pop();
+                    central_cv.notify_all();
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Controller thread
+ */
+static void controller_run()
+{
+    std::unique_lock<std::mutex> lock(mux);
+    while (threads_run)
+    {
+        int64_t now = esp_timer_get_time();
+        int64_t next = now + 100000;
+        for (auto &c : conns)
+        {
+            if (!c.used)
+                continue;
+            if (c.next <= now)
+            {
+                conn_event(&c);
+                c.next += (int64_t)c.itvl * 1250;
+                if (c.next <= now)
+                    c.next = now + (int64_t)c.itvl * 1250; // Overrun: skip the missed events
+            }
+            next = std::min(next, c.next);
+        }
+        controller_cv.wait_for(lock, std::chrono::microseconds(next - now));
+    }
+}
+
+/**
+ * @brief Central thread
+ */
+static void central_run()
+{
+    static uint8_t data[BLE_ATT_MTU_MAX];
+    std::unique_lock<std::mutex> lock(mux);
+    while (threads_run)
+    {
+        if (delivery_count == 0)
+        {
+            central_cv.wait(lock);
+            continue;
+        }
+        SDelivery &d = deliveries[delivery_head];
+        int64_t now = esp_timer_get_time();
+        if (d.due > now)
+        {
+            central_cv.wait_for(lock, std::chrono::microseconds(d.due - now));
+            continue;
+        }
+        uint16_t conn = d.conn;
+        uint8_t chn = d.chn;
+        uint16_t size = d.size;
+        std::memcpy(data, d.data, size);
+        delivery_head = (delivery_head + 1) % SIM_DELIVERY;
+        delivery_count--;
+        sim::onNotify *cb = notify_cb;
+        lock.unlock();
+        if (cb != nullptr)
+            cb(conn, chn, data, size);
+        lock.lock();
+    }
+}
+
+esp_err_t nimble_port_init()
+{
+    pool_reset();
+    std::lock_guard<std::mutex> lock(mux);
+    svc_count = 0;
+    chr_count = 0;
+    adv = false;
+    synced = false;
+    preferred_mtu = SIM_PREFERRED_MTU;
+    delivery_count = 0;
+    std::memset(&stats, 0, sizeof(stats));
+    if (!threads_run)
+    {
+        threads_run = true;
+        controller_thread = std::thread(controller_run);
+        controller_thread.detach();
+        central_thread = std::thread(central_run);
+        central_thread.detach();
+    }
+    return ESP_OK;
+}
+
+esp_err_t nimble_port_deinit()
+{
+    std::lock_guard<std::mutex> lock(mux);
+    svc_count = 0;
+    chr_count = 0;
+    return ESP_OK;
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn)
+{
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        host_state = EHostState::Starting;
+    }
+    xTaskCreatePinnedToCore(host_task_fn, "nimble_host", 4096, nullptr, 5, &host_task, 0);
+}
+
+void nimble_port_freertos_deinit()
+{
+    vTaskDelete(host_task);
+}
+
+void nimble_port_run()
+{
+    std::unique_lock<std::mutex> lock(mux);
+    // Handles are assigned when the GATT server starts
+    uint16_t handle = 0x10;
+    chr_count = 0;
+    for (uint8_t s = 0; s < svc_count; s++)
+    {
+        handle += 2; // Service declaration
+        for (const ble_gatt_chr_def *chr = svcs[s]->characteristics; (chr != nullptr) && (chr->uuid != nullptr); chr++)
+        {
+            if (chr_count == SIM_MAX_CHR)
+                break;
+            chrs[chr_count] = chr;
+            chr_handles[chr_count] = handle + 1;
+            if (chr->val_handle != nullptr)
+                *chr->val_handle = handle + 1;
+            chr_count++;
+            handle += 3; // Declaration, value and client configuration
+        }
+    }
+    host_head = 0;
+    host_count = 0;
+    host_state = EHostState::Running;
+    synced = true;
+    lock.unlock();
+    if (ble_hs_cfg.sync_cb != nullptr)
+        ble_hs_cfg.sync_cb();
+    lock.lock();
+
+    for (;;)
+    {
+        host_cv.wait(lock, []
+                     { return (host_count != 0) || (host_state == EHostState::Stopping); });
+        if (host_state == EHostState::Stopping)
+            break;
+        SHostEvent ev = host_events[host_head];
+        host_head = (host_head + 1) % SIM_HOST_EVENTS;
+        host_count--;
+        lock.unlock();
+        switch (ev.type)
+        {
+        case EHostEvent::Gap:
+            if (ev.cb != nullptr)
+                ev.cb(&ev.gap, ev.arg);
+            break;
+        case EHostEvent::Write:
+        {
+            int i = chr_find(ev.attr);
+            int rc = BLE_ATT_ERR_UNLIKELY;
+            if ((i >= 0) && (chrs[i]->access_cb != nullptr))
+            {
+                ble_gatt_access_ctxt ctxt;
+                ctxt.op = BLE_GATT_ACCESS_OP_WRITE_CHR;
+                ctxt.om = ev.om;
+                ctxt.chr = chrs[i];
+                rc = chrs[i]->access_cb(ev.conn, ev.attr, &ctxt, chrs[i]->arg);
+            }
+            os_mbuf_free_chain(ev.om);
+            if (rc != 0)
+            {
+                std::lock_guard<std::mutex> l(mux);
+                stats.rejectedWrites++;
+            }
+            else
+            {
+                std::lock_guard<std::mutex> l(mux);
+                stats.writes++;
+            }
+            break;
+        }
+        case EHostEvent::Mtu:
+        {
+            ble_gatt_error err = {0, 0};
+            if (ev.mtuCb != nullptr)
+                ev.mtuCb(ev.conn, &err, ev.gap.mtu.value, ev.arg);
+            break;
+        }
+        }
+        lock.lock();
+        host_done = ev.seq;
+        host_cv.notify_all();
+    }
+
+    // Pending events are dropped with the host
+    while (host_count != 0)
+    {
+        SHostEvent &ev = host_events[host_head];
+        if (ev.type == EHostEvent::Write)
+            os_mbuf_free_chain(ev.om);
+        host_head = (host_head + 1) % SIM_HOST_EVENTS;
+        host_count--;
+    }
+    host_done = host_seq;
+    synced = false;
+    host_state = EHostState::Idle;
+    host_cv.notify_all();
+}
+
+int nimble_port_stop()
+{
+    std::unique_lock<std::mutex> lock(mux);
+    adv = false;
+    for (auto &c : conns)
+    {
+        if (c.used)
+            conn_clear(&c);
+    }
+    delivery_count = 0;
+    if (host_state == EHostState::Idle)
+        return 0;
+    host_cv.wait(lock, []
+                 { return host_state != EHostState::Starting; });
+    if (host_state == EHostState::Running)
+        host_state = EHostState::Stopping;
+    host_cv.notify_all();
+    host_cv.wait(lock, []
+                 { return host_state == EHostState::Idle; });
+    return 0;
+}
+
+int ble_hs_synced()
+{
+    std::lock_guard<std::mutex> lock(mux);
+    return synced;
+}
+
+int ble_hs_util_ensure_addr(int prefer_random)
+{
+    return 0;
+}
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type)
+{
+    *out_addr_type = BLE_OWN_ADDR_PUBLIC;
+    return 0;
+}
+
+extern "C" void ble_store_config_init(void)
+{
+}
+
+int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg)
+{
+    return 0;
+}
+
+void ble_svc_gap_init()
+{
+}
+
+void ble_svc_gatt_init()
+{
+}
+
+const char *ble_svc_gap_device_name()
+{
+    return device_name;
+}
+
+int ble_svc_gap_device_name_set(const char *name)
+{
+    if (std::strlen(name) >= sizeof(device_name))
+        return BLE_HS_EINVAL;
+    std::strcpy(device_name, name);
+    return 0;
+}
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs)
+{
+    return (defs == nullptr) ? BLE_HS_EINVAL : 0;
+}
+
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *defs)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    for (; defs->type != BLE_GATT_SVC_TYPE_END; defs++)
+    {
+        if (svc_count == sizeof(svcs) / sizeof(svcs[0]))
+            return BLE_HS_ENOMEM;
+        svcs[svc_count++] = defs;
+    }
+    return 0;
+}
+
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om)
+{
+    int rc = 0;
+    int chn;
+    sim::onTx *hook;
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        SConn *c = conn_find(conn_handle);
+        chn = chr_find(att_handle);
+        hook = tx_cb;
+        if (c == nullptr)
+            rc = BLE_HS_ENOTCONN;
+        else if (chn < 0)
+            rc = BLE_HS_ENOENT;
+        else if (OS_MBUF_PKTLEN(om) > c->mtu - 3)
+            stats.truncated++; // NimBLE truncates the value to the MTU
+    }
+    if (rc != 0)
+    {
+        os_mbuf_free_chain(om);
+        return rc;
+    }
+    if (hook != nullptr)
+        hook(conn_handle, (uint8_t)(chn + 1), om);
+
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        rc = BLE_HS_ENOTCONN;
+    else
+    {
+        uint16_t len = std::min<uint16_t>(OS_MBUF_PKTLEN(om), c->mtu - 3);
+        if (!c->tx.push({om, att_handle, pdu_count(c, len)}))
+            rc = BLE_HS_ENOMEM;
+    }
+    if (rc != 0)
+        os_mbuf_free_chain(om);
+    return rc;
+}
+
+int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb, void *cb_arg)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    if (c->mtuDone)
+        return BLE_HS_EALREADY;
+    c->mtuDone = true;
+    c->mtu = std::max<uint16_t>(BLE_ATT_MTU_DFLT, std::min<uint16_t>(preferred_mtu, (c->cfg.mtu != 0) ? c->cfg.mtu : BLE_ATT_MTU_DFLT));
+
+    SHostEvent ev;
+    std::memset(&ev, 0, sizeof(ev));
+    ev.type = EHostEvent::Mtu;
+    ev.conn = conn_handle;
+    ev.mtuCb = cb;
+    ev.arg = cb_arg;
+    ev.gap.mtu.value = c->mtu;
+    host_post(ev);
+
+    ble_gap_event gap;
+    std::memset(&gap, 0, sizeof(gap));
+    gap.type = BLE_GAP_EVENT_MTU;
+    gap.mtu.conn_handle = conn_handle;
+    gap.mtu.value = c->mtu;
+    gap_post(c, gap);
+    return 0;
+}
+
+uint16_t ble_att_mtu(uint16_t conn_handle)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    return (c != nullptr) ? c->mtu : 0;
+}
+
+int ble_att_set_preferred_mtu(uint16_t mtu)
+{
+    if ((mtu < BLE_ATT_MTU_DFLT) || (mtu > BLE_ATT_MTU_MAX))
+        return BLE_HS_EINVAL;
+    std::lock_guard<std::mutex> lock(mux);
+    preferred_mtu = mtu;
+    return 0;
+}
+
+/**
+ * @brief Size of the advertising data of the fields
+ * @param fields Fields
+ * @return Bytes
+ */
+static int adv_size(const struct ble_hs_adv_fields *fields)
+{
+    int size = 0;
+    if (fields->flags != 0)
+        size += 3;
+    if (fields->tx_pwr_lvl_is_present)
+        size += 3;
+    if (fields->name != nullptr)
+        size += 2 + fields->name_len;
+    if (fields->num_uuids16 != 0)
+        size += 2 + 2 * fields->num_uuids16;
+    if ((fields->mfg_data != nullptr) && (fields->mfg_data_len != 0))
+        size += 2 + fields->mfg_data_len;
+    return size;
+}
+
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *adv_fields)
+{
+    return (adv_size(adv_fields) > BLE_HS_ADV_MAX_SZ) ? BLE_HS_EMSGSIZE : 0;
+}
+
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields)
+{
+    return (adv_size(rsp_fields) > BLE_HS_ADV_MAX_SZ) ? BLE_HS_EMSGSIZE : 0;
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    if (!synced)
+        return BLE_HS_EAGAIN;
+    if (adv)
+        return BLE_HS_EALREADY;
+    adv = true;
+    adv_cb = cb;
+    adv_arg = cb_arg;
+    central_cv.notify_all();
+    return 0;
+}
+
+int ble_gap_adv_stop()
+{
+    std::lock_guard<std::mutex> lock(mux);
+    if (!adv)
+        return BLE_HS_EALREADY;
+    adv = false;
+    return 0;
+}
+
+int ble_gap_adv_active()
+{
+    std::lock_guard<std::mutex> lock(mux);
+    return adv;
+}
+
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    conn_drop(c, SIM_TERM_LOCAL);
+    return 0;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    std::memset(out_desc, 0, sizeof(*out_desc));
+    out_desc->conn_handle = handle;
+    out_desc->conn_itvl = c->itvl;
+    out_desc->conn_latency = c->latency;
+    out_desc->supervision_timeout = c->timeout;
+    return 0;
+}
+
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    if ((params->itvl_min < 6) || (params->itvl_min > params->itvl_max))
+        return BLE_HS_EINVAL;
+    if (c->update)
+        return BLE_HS_EALREADY;
+    if (!c->cfg.acceptUpdates)
+    {
+        ble_gap_event gap;
+        std::memset(&gap, 0, sizeof(gap));
+        gap.type = BLE_GAP_EVENT_CONN_UPDATE;
+        gap.conn_update.status = SIM_UPDATE_REJECT;
+        gap.conn_update.conn_handle = conn_handle;
+        gap_post(c, gap);
+        return 0;
+    }
+    c->update = true;
+    c->updateAt = c->events + SIM_UPDATE_EVENTS;
+    c->params = *params;
+    return 0;
+}
+
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    c->phy = (c->cfg.phy2M && (tx_phys_mask & BLE_GAP_LE_PHY_2M_MASK)) ? BLE_GAP_LE_PHY_2M : BLE_GAP_LE_PHY_1M;
+    ble_gap_event gap;
+    std::memset(&gap, 0, sizeof(gap));
+    gap.type = BLE_GAP_EVENT_PHY_UPDATE_COMPLETE;
+    gap.phy_updated.conn_handle = conn_handle;
+    gap.phy_updated.tx_phy = c->phy;
+    gap.phy_updated.rx_phy = c->phy;
+    gap_post(c, gap);
+    return 0;
+}
+
+int ble_gap_read_le_phy(uint16_t conn_handle, uint8_t *tx_phy, uint8_t *rx_phy)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    *tx_phy = *rx_phy = c->phy;
+    return 0;
+}
+
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time)
+{
+    if ((tx_octets < BLE_HCI_SET_DATALEN_TX_OCTETS_MIN) || (tx_octets > BLE_HCI_SET_DATALEN_TX_OCTETS_MAX))
+        return BLE_HS_EINVAL;
+    std::lock_guard<std::mutex> lock(mux);
+    SConn *c = conn_find(conn_handle);
+    if (c == nullptr)
+        return BLE_HS_ENOTCONN;
+    c->txOctets = std::max<uint16_t>(BLE_HCI_SET_DATALEN_TX_OCTETS_MIN, std::min(tx_octets, c->cfg.maxTxOctets));
+    return 0;
+}
+
+namespace sim
+{
+    void setPool(const SPoolConfig &config)
+    {
+        pool_config = config;
+    }
+
+    void setNotify(onNotify *cb)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        notify_cb = cb;
+    }
+
+    void setTx(onTx *cb)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        tx_cb = cb;
+    }
+
+    bool waitAdvertising(uint32_t ms)
+    {
+        std::unique_lock<std::mutex> lock(mux);
+        return central_cv.wait_for(lock, std::chrono::milliseconds(ms), []
+                                   { return adv; });
+    }
+
+    uint16_t connect(const SLinkConfig &config, uint32_t ms)
+    {
+        std::unique_lock<std::mutex> lock(mux);
+        if (!central_cv.wait_for(lock, std::chrono::milliseconds(ms), []
+                                 { return adv; }))
+            return BLE_HS_CONN_HANDLE_NONE;
+        SConn *c = nullptr;
+        for (auto &slot : conns)
+        {
+            if (!slot.used)
+            {
+                c = &slot;
+                break;
+            }
+        }
+        if (c == nullptr)
+            return BLE_HS_CONN_HANDLE_NONE;
+
+        c->used = true;
+        c->handle = next_handle++;
+        c->cfg = config;
+        c->mtu = BLE_ATT_MTU_DFLT;
+        c->mtuDone = false;
+        c->itvl = config.interval;
+        c->latency = config.latency;
+        c->timeout = config.timeout;
+        c->phy = BLE_GAP_LE_PHY_1M;
+        c->txOctets = BLE_HCI_SET_DATALEN_TX_OCTETS_MIN;
+        c->cb = adv_cb;
+        c->arg = adv_arg;
+        c->next = esp_timer_get_time() + (int64_t)c->itvl * 1250;
+        c->events = 0;
+        c->update = false;
+        c->rng.seed(config.seed);
+        adv = false; // Connectable advertising ends with the connection
+
+        ble_gap_event gap;
+        std::memset(&gap, 0, sizeof(gap));
+        gap.type = BLE_GAP_EVENT_CONNECT;
+        gap.connect.conn_handle = c->handle;
+        uint64_t seq = gap_post(c, gap);
+        if (config.mtu != 0)
+        {
+            // Exchange started by the central
+            c->mtuDone = true;
+            c->mtu = std::max<uint16_t>(BLE_ATT_MTU_DFLT, std::min<uint16_t>(preferred_mtu, config.mtu));
+            std::memset(&gap, 0, sizeof(gap));
+            gap.type = BLE_GAP_EVENT_MTU;
+            gap.mtu.conn_handle = c->handle;
+            gap.mtu.value = c->mtu;
+            seq = gap_post(c, gap);
+        }
+        controller_cv.notify_all();
+        uint16_t handle = c->handle;
+        host_cv.wait(lock, [seq]
+                     { return host_done >= seq; });
+        return handle;
+    }
+
+    void disconnect(uint16_t conn)
+    {
+        std::unique_lock<std::mutex> lock(mux);
+        SConn *c = conn_find(conn);
+        if (c == nullptr)
+            return;
+        conn_drop(c, SIM_TERM_REMOTE);
+        uint64_t seq = host_seq;
+        host_cv.wait(lock, [seq]
+                     { return host_done >= seq; });
+    }
+
+    bool write(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        SConn *c = conn_find(conn);
+        if ((c == nullptr) || (chn == 0) || (chn > chr_count) || (size > c->mtu - 3))
+            return false;
+        os_mbuf *om = ble_hs_mbuf_from_flat(data, size);
+        if (om == nullptr)
+            return false;
+        if (!c->rx.push({om, chr_handles[chn - 1], pdu_count(c, size)}))
+        {
+            os_mbuf_free_chain(om);
+            return false;
+        }
+        return true;
+    }
+
+    uint16_t mtu(uint16_t conn)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        SConn *c = conn_find(conn);
+        return (c != nullptr) ? c->mtu : 0;
+    }
+
+    uint16_t interval(uint16_t conn)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        SConn *c = conn_find(conn);
+        return (c != nullptr) ? c->itvl : 0;
+    }
+
+    void getStats(SLinkStats *out)
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        *out = stats;
+    }
+
+    int freeBlocks()
+    {
+        return os_msys_num_free();
+    }
+}
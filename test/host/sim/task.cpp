@@ -0,0 +1,194 @@
+/*!
+    \file
+    \brief Task component classes for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#include "CBaseTask.h"
+#include "CSoftwareTimer.h"
+#include "esp_timer.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief Task entry point
+ * @param pvParameters Task object
+ */
+void CBaseTask::vTask(void *pvParameters)
+{
+    CBaseTask *task = (CBaseTask *)pvParameters;
+    QueueHandle_t queue = task->mTaskQueue;
+
+    task->run();
+    task->mTaskQueue = nullptr;
+    vQueueDelete(queue);
+    task->mTaskHandle = nullptr; // The object may be deleted from here on
+    vTaskDelete(nullptr);
+}
+
+/**
+ * @brief Create the task and its queue
+ * @param name Task name
+ * @param usStack Stack size
+ * @param uxPriority Priority
+ * @param queueLength Queue length
+ * @param coreID CPU core
+ */
+void CBaseTask::init(const char *name, unsigned short usStack, UBaseType_t uxPriority, UBaseType_t queueLength, BaseType_t coreID)
+{
+    mTaskQueue = xQueueCreate(queueLength, sizeof(STaskMessage));
+    xTaskCreatePinnedToCore(vTask, name, usStack, this, uxPriority, &mTaskHandle, coreID);
+}
+
+/**
+ * @brief Receive a message
+ * @param msg Receives the message
+ * @param xTicksToWait Timeout in ticks
+ * @return true if a message was received
+ */
+bool CBaseTask::getMessage(STaskMessage *msg, TickType_t xTicksToWait)
+{
+    return xQueueReceive(mTaskQueue, msg, xTicksToWait) == pdTRUE;
+}
+
+/**
+ * @brief Send a message to the task
+ * @param msg Message
+ * @param xTicksToWait Timeout in ticks
+ * @param free_mem Free the message body if the message was not sent
+ * @return true if the message was sent
+ */
+bool CBaseTask::sendMessage(STaskMessage *msg, TickType_t xTicksToWait, bool free_mem)
+{
+    if ((mTaskQueue != nullptr) && (xQueueSend(mTaskQueue, msg, xTicksToWait) == pdTRUE))
+        return true;
+    if (free_mem && (msg->msgBody != nullptr))
+    {
+        vPortFree(msg->msgBody);
+        msg->msgBody = nullptr;
+    }
+    return false;
+}
+
+/**
+ * @brief Allocate a message body
+ * @param msg Message
+ * @param cmd Message ID
+ * @param size Body size
+ * @param psram Allow external memory
+ * @return Pointer to the body
+ */
+uint8_t *CBaseTask::allocNewMsg(STaskMessage *msg, uint16_t cmd, uint16_t size, bool psram)
+{
+    msg->msgID = cmd;
+    msg->shortParam = size;
+    msg->msgBody = pvPortMalloc(size);
+    return (uint8_t *)msg->msgBody;
+}
+
+// Timer thread: timers are few, so expiry is found by a scan
+struct SSimTimers
+{
+    std::mutex mux;
+    std::condition_variable cv;
+    CSoftwareTimer *timers[16] = {};
+    std::thread thread;
+
+    SSimTimers() : thread(&SSimTimers::run, this)
+    {
+        thread.detach();
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mux);
+        for (;;)
+        {
+            int64_t now = esp_timer_get_time();
+            int64_t next = now + 1000000;
+            for (auto t : timers)
+            {
+                if ((t == nullptr) || (t->mDue < 0))
+                    continue;
+                if (t->mDue <= now)
+                {
+                    t->mDue = -1;
+                    // Never blocks, so the lock keeps the timer and the task alive
+                    t->mTask->sendCmd(t->mCmd, t->mTimerNum, 0, 0);
+                }
+                else if (t->mDue < next)
+                    next = t->mDue;
+            }
+            cv.wait_for(lock, std::chrono::microseconds(next - now));
+        }
+    }
+};
+
+static SSimTimers &timers()
+{
+    static SSimTimers *t = new SSimTimers(); // Never destroyed: the thread is detached
+    return *t;
+}
+
+/**
+ * @brief Constructor for the CSoftwareTimer class
+ * @param timerNum Timer number
+ * @param cmd Command sent on expiry
+ */
+CSoftwareTimer::CSoftwareTimer(uint8_t timerNum, uint16_t cmd) : mTimerNum(timerNum), mCmd(cmd)
+{
+    SSimTimers &t = timers();
+    std::lock_guard<std::mutex> lock(t.mux);
+    for (auto &slot : t.timers)
+    {
+        if (slot == nullptr)
+        {
+            slot = this;
+            break;
+        }
+    }
+}
+
+/**
+ * @brief Destructor for the CSoftwareTimer class
+ */
+CSoftwareTimer::~CSoftwareTimer()
+{
+    SSimTimers &t = timers();
+    std::lock_guard<std::mutex> lock(t.mux);
+    for (auto &slot : t.timers)
+    {
+        if (slot == this)
+            slot = nullptr;
+    }
+}
+
+/**
+ * @brief Start or restart the timer
+ * @param task Task receiving the command
+ * @param event Expiry action
+ * @param ms Period in ms
+ * @return true if started
+ */
+bool CSoftwareTimer::start(CBaseTask *task, ETimerEvent event, uint32_t ms)
+{
+    SSimTimers &t = timers();
+    std::lock_guard<std::mutex> lock(t.mux);
+    mTask = task;
+    mDue = esp_timer_get_time() + (int64_t)ms * 1000;
+    t.cv.notify_one();
+    return true;
+}
+
+/**
+ * @brief Stop the timer
+ */
+void CSoftwareTimer::stop()
+{
+    SSimTimers &t = timers();
+    std::lock_guard<std::mutex> lock(t.mux);
+    mDue = -1;
+}
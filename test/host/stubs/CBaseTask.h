@@ -0,0 +1,106 @@
+/*!
+    \file
+    \brief Base task class of the task component for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Same interface as the task component: a FreeRTOS task with a message
+    queue, ended by MSG_END_TASK.
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <cstdint>
+
+#define MSG_END_TASK (0) ///< End the task command.
+
+/// Task message.
+struct STaskMessage
+{
+	uint16_t msgID;		 ///< Message ID.
+	uint16_t shortParam; ///< Short parameter (body size for messages with a body).
+	union
+	{
+		uint32_t paramID; ///< Parameter.
+		void *msgBody;	  ///< Message body.
+	};
+};
+
+/// Base class of a task with a message queue.
+class CBaseTask
+{
+protected:
+	TaskHandle_t mTaskHandle = nullptr;	 ///< Task handle, nullptr after the task ends.
+	QueueHandle_t mTaskQueue = nullptr; ///< Message queue, nullptr after the task ends.
+
+	/// Task body.
+	virtual void run() = 0;
+
+	/// Task entry point.
+	/*!
+	  \param[in] pvParameters the task object.
+	*/
+	static void vTask(void *pvParameters);
+
+	/// Receive a message.
+	/*!
+	  \param[out] msg message.
+	  \param[in] xTicksToWait timeout in ticks.
+	  \return true if a message was received.
+	*/
+	bool getMessage(STaskMessage *msg, TickType_t xTicksToWait = 0);
+
+public:
+	/// Destructor.
+	virtual ~CBaseTask() = default;
+
+	/// Create the task and its queue.
+	/*!
+	  \param[in] name task name.
+	  \param[in] usStack stack size.
+	  \param[in] uxPriority priority.
+	  \param[in] queueLength queue length.
+	  \param[in] coreID CPU core.
+	*/
+	void init(const char *name, unsigned short usStack, UBaseType_t uxPriority, UBaseType_t queueLength, BaseType_t coreID = tskNO_AFFINITY);
+
+	/// Send a message to the task.
+	/*!
+	  \param[in] msg message.
+	  \param[in] xTicksToWait timeout in ticks.
+	  \param[in] free_mem free the message body if the message was not sent.
+	  \return true if the message was sent.
+	*/
+	bool sendMessage(STaskMessage *msg, TickType_t xTicksToWait = 0, bool free_mem = false);
+
+	/// Send a command to the task.
+	/*!
+	  \param[in] cmd command.
+	  \param[in] param short parameter.
+	  \param[in] paramID parameter.
+	  \param[in] xTicksToWait timeout in ticks.
+	  \return true if the command was sent.
+	*/
+	inline bool sendCmd(uint16_t cmd, uint16_t param = 0, uint32_t paramID = 0, TickType_t xTicksToWait = portMAX_DELAY)
+	{
+		STaskMessage msg;
+		msg.msgID = cmd;
+		msg.shortParam = param;
+		msg.paramID = paramID;
+		return sendMessage(&msg, xTicksToWait, false);
+	};
+
+	/// Allocate a message body.
+	/*!
+	  \param[out] msg message.
+	  \param[in] cmd message ID.
+	  \param[in] size body size.
+	  \param[in] psram allow external memory.
+	  \return pointer to the body.
+	*/
+	static uint8_t *allocNewMsg(STaskMessage *msg, uint16_t cmd, uint16_t size, bool psram = false);
+};
@@ -0,0 +1,24 @@
+/*!
+    \file
+    \brief Mutex class of the task component for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+*/
+#pragma once
+
+#include <mutex>
+
+/// Mutex for derived classes.
+class CLock
+{
+protected:
+	std::recursive_mutex mMutex; ///< Mutex.
+
+public:
+	/// Take the mutex.
+	inline void lock() { mMutex.lock(); };
+
+	/// Release the mutex.
+	inline void unlock() { mMutex.unlock(); };
+};
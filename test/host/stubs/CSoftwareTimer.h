@@ -0,0 +1,54 @@
+/*!
+    \file
+    \brief Software timer class of the task component for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    All timers are served by one thread of the simulation.
+*/
+#pragma once
+
+#include "CBaseTask.h"
+#include <cstdint>
+
+/// Timer expiry action.
+enum class ETimerEvent
+{
+	SendBack, ///< Send the timer command to the task.
+};
+
+/// One-shot software timer.
+class CSoftwareTimer
+{
+protected:
+	uint8_t mTimerNum;			///< Timer number, sent as the short parameter.
+	uint16_t mCmd;				///< Command sent on expiry.
+	CBaseTask *mTask = nullptr; ///< Task receiving the command.
+	int64_t mDue = -1;			///< Expiry time in us, -1 if stopped.
+
+	friend struct SSimTimers;
+
+public:
+	/// Constructor.
+	/*!
+	  \param[in] timerNum timer number.
+	  \param[in] cmd command sent on expiry.
+	*/
+	CSoftwareTimer(uint8_t timerNum, uint16_t cmd);
+
+	/// Destructor.
+	~CSoftwareTimer();
+
+	/// Start or restart the timer.
+	/*!
+	  \param[in] task task receiving the command.
+	  \param[in] event expiry action.
+	  \param[in] ms period in ms.
+	  \return true if started.
+	*/
+	bool start(CBaseTask *task, ETimerEvent event, uint32_t ms);
+
+	/// Stop the timer.
+	void stop();
+};
@@ -0,0 +1,27 @@
+/*!
+    \file
+    \brief Trace macros of the trace component for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Traces go to the ESP-IDF log stand-in: warnings and errors at their
+    levels, data dumps at the debug level.
+*/
+#pragma once
+
+#include "esp_log.h"
+
+#define TRACE_ERROR(str, val) ESP_LOGE("trace", "%s %d", str, (int)(val))
+#define TRACE_WARNING(str, val) ESP_LOGW("trace", "%s %d", str, (int)(val))
+#define TRACE(str, val) ESP_LOGI("trace", "%s %d", str, (int)(val))
+#define TDEC(str, val) ESP_LOGI("trace", "%s %d", str, (int)(val))
+#define TRACEDATA(str, data, size)                      \
+    do                                                  \
+    {                                                   \
+        if (esp_log_enabled(ESP_LOG_DEBUG))             \
+        {                                               \
+            ESP_LOGD("trace", "%s", str);               \
+            esp_log_buffer_hex("trace", data, size);    \
+        }                                               \
+    } while (0)
@@ -0,0 +1,5 @@
+/*!
+    \file
+    \brief NimBLE console API for the host simulation build (not used).
+*/
+#pragma once
@@ -0,0 +1,10 @@
+/*!
+    \file
+    \brief ESP-IDF high resolution time for the host simulation build.
+*/
+#pragma once
+
+#include <cstdint>
+
+/// Time since the start of the process in us.
+int64_t esp_timer_get_time();
@@ -0,0 +1,74 @@
+/*!
+    \file
+    \brief FreeRTOS API on Linux threads for the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    One tick is one millisecond of the monotonic clock. Critical sections
+    take one process-wide recursive mutex, the way a single-core port masks
+    interrupts.
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include <cstdint>
+#include <cstddef>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef struct SSimTask *TaskHandle_t;
+typedef struct SSimQueue *QueueHandle_t;
+typedef struct SSimQueue *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef int portMUX_TYPE;
+
+#define pdTRUE (1)
+#define pdFALSE (0)
+#define pdPASS (pdTRUE)
+#define pdFAIL (pdFALSE)
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ (1000)
+#define portTICK_PERIOD_MS (1)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY (0x7fffffff)
+#define INCLUDE_vTaskDelete (1)
+#define portMUX_INITIALIZER_UNLOCKED (0)
+
+void sim_critical_enter();
+void sim_critical_exit();
+#define portENTER_CRITICAL(mux) sim_critical_enter()
+#define portEXIT_CRITICAL(mux) sim_critical_exit()
+#define portENTER_CRITICAL_ISR(mux) sim_critical_enter()
+#define portEXIT_CRITICAL_ISR(mux) sim_critical_exit()
+
+void *pvPortMalloc(size_t size);
+void vPortFree(void *ptr);
+
+// Tasks
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *param,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+UBaseType_t uxTaskGetStackHighWaterMark2(TaskHandle_t task);
+
+// Queues
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue);
+#define xQueueSendToBack xQueueSend
+
+// Semaphores are queues of empty items
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+#define vSemaphoreDelete(sem) vQueueDelete(sem)
@@ -0,0 +1,7 @@
+/*!
+    \file
+    \brief FreeRTOS queue API for the host simulation build.
+*/
+#pragma once
+
+#include "freertos/FreeRTOS.h"
@@ -0,0 +1,319 @@
+/*!
+    \file
+    \brief NimBLE host API of the host simulation build.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    The subset of the NimBLE host, GAP, GATT server and mbuf API that the
+    component uses in data mode, with the same names and semantics. The
+    NimBLE headers of the stub tree all include this one. The calls are
+    served by the simulated controller and central in sim/.
+*/
+#pragma once
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include <cstdint>
+#include <cstddef>
+
+// Error codes
+#define BLE_HS_EAGAIN (1)
+#define BLE_HS_EALREADY (2)
+#define BLE_HS_EINVAL (3)
+#define BLE_HS_EMSGSIZE (4)
+#define BLE_HS_ENOENT (5)
+#define BLE_HS_ENOMEM (6)
+#define BLE_HS_ENOTCONN (7)
+#define BLE_HS_ENOTSUP (8)
+#define BLE_HS_EBUSY (15)
+#define BLE_HS_ESTALLED (30)
+#define BLE_HS_FOREVER (INT32_MAX)
+#define BLE_HS_CONN_HANDLE_NONE (0xffff)
+#define BLE_ERR_CONN_LIMIT (0x09)
+#define BLE_ERR_REM_USER_CONN_TERM (0x13)
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN (0x0d)
+#define BLE_ATT_ERR_UNLIKELY (0x0e)
+#define BLE_ATT_ERR_INSUFFICIENT_RES (0x11)
+
+// ATT
+#define BLE_ATT_MTU_DFLT (23)
+#define BLE_ATT_MTU_MAX (527)
+#define BLE_HCI_SET_DATALEN_TX_OCTETS_MIN (0x001b)
+#define BLE_HCI_SET_DATALEN_TX_OCTETS_MAX (0x00fb)
+#define BLE_HCI_SET_DATALEN_TX_TIME_MAX (0x4290)
+
+// Addresses
+#define BLE_ADDR_PUBLIC (0x00)
+#define BLE_ADDR_RANDOM (0x01)
+#define BLE_ADDR_PUBLIC_ID (0x02)
+#define BLE_ADDR_RANDOM_ID (0x03)
+#define BLE_OWN_ADDR_PUBLIC (0x00)
+#define BLE_OWN_ADDR_RANDOM (0x01)
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t val[6];
+} ble_addr_t;
+
+// PHY
+#define BLE_GAP_LE_PHY_1M (1)
+#define BLE_GAP_LE_PHY_2M (2)
+#define BLE_GAP_LE_PHY_CODED (3)
+#define BLE_GAP_LE_PHY_1M_MASK (0x01)
+#define BLE_GAP_LE_PHY_2M_MASK (0x02)
+#define BLE_GAP_LE_PHY_CODED_MASK (0x04)
+#define BLE_GAP_LE_PHY_CODED_ANY (0)
+#define BLE_HCI_LE_PHY_1M (1)
+#define BLE_HCI_LE_PHY_2M (2)
+
+// UUIDs
+#define BLE_UUID_TYPE_16 (16)
+
+typedef struct
+{
+    uint8_t type;
+} ble_uuid_t;
+
+typedef struct
+{
+    ble_uuid_t u;
+    uint16_t value;
+} ble_uuid16_t;
+
+#define BLE_UUID16_INIT(uuid16)   \
+    {                             \
+        {BLE_UUID_TYPE_16}, uuid16 \
+    }
+
+// mbufs
+struct os_mbuf
+{
+    uint8_t *om_data;          ///< Start of the data in om_databuf
+    uint16_t om_len;           ///< Data bytes in this buffer
+    uint16_t om_pktlen;        ///< Data bytes in the chain (first buffer only)
+    struct os_mbuf *om_next;   ///< Next buffer of the chain
+    uint8_t *om_databuf;       ///< Storage of the block
+    uint16_t om_size;          ///< Size of the storage
+};
+
+#define OS_MBUF_PKTLEN(om) ((om)->om_pktlen)
+#define OS_MBUF_LEADINGSPACE(om) ((uint16_t)((om)->om_data - (om)->om_databuf))
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+int os_msys_num_free();
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+void *os_mbuf_extend(struct os_mbuf *om, uint16_t len);
+struct os_mbuf *os_mbuf_dup(struct os_mbuf *om);
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+int os_mbuf_free_chain(struct os_mbuf *om);
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len);
+struct os_mbuf *ble_hs_mbuf_att_pkt();
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len);
+
+// GATT server
+#define BLE_GATT_ACCESS_OP_READ_CHR (0)
+#define BLE_GATT_ACCESS_OP_WRITE_CHR (1)
+#define BLE_GATT_ACCESS_OP_READ_DSC (2)
+#define BLE_GATT_ACCESS_OP_WRITE_DSC (3)
+#define BLE_GATT_SVC_TYPE_END (0)
+#define BLE_GATT_SVC_TYPE_PRIMARY (1)
+#define BLE_GATT_SVC_TYPE_SECONDARY (2)
+#define BLE_GATT_CHR_F_READ (0x0002)
+#define BLE_GATT_CHR_F_WRITE_NO_RSP (0x0004)
+#define BLE_GATT_CHR_F_WRITE (0x0008)
+#define BLE_GATT_CHR_F_NOTIFY (0x0010)
+#define BLE_GATT_CHR_F_INDICATE (0x0020)
+
+struct ble_gatt_access_ctxt
+{
+    uint8_t op;
+    struct os_mbuf *om;
+    const struct ble_gatt_chr_def *chr;
+};
+
+typedef int ble_gatt_access_fn(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg);
+
+struct ble_gatt_chr_def
+{
+    const ble_uuid_t *uuid;
+    ble_gatt_access_fn *access_cb;
+    void *arg;
+    void *descriptors;
+    uint16_t flags;
+    uint8_t min_key_size;
+    uint16_t *val_handle;
+};
+
+struct ble_gatt_svc_def
+{
+    uint8_t type;
+    const ble_uuid_t *uuid;
+    const struct ble_gatt_svc_def **includes;
+    const struct ble_gatt_chr_def *characteristics;
+};
+
+struct ble_gatt_error
+{
+    uint16_t status;
+    uint16_t att_handle;
+};
+
+typedef int ble_gatt_mtu_fn(uint16_t conn_handle, const struct ble_gatt_error *error, uint16_t mtu, void *arg);
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs);
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs);
+int ble_gatts_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om);
+int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb, void *cb_arg);
+uint16_t ble_att_mtu(uint16_t conn_handle);
+int ble_att_set_preferred_mtu(uint16_t mtu);
+void ble_svc_gap_init();
+void ble_svc_gatt_init();
+const char *ble_svc_gap_device_name();
+int ble_svc_gap_device_name_set(const char *name);
+
+// GAP
+#define BLE_GAP_EVENT_CONNECT (0)
+#define BLE_GAP_EVENT_DISCONNECT (1)
+#define BLE_GAP_EVENT_CONN_UPDATE (3)
+#define BLE_GAP_EVENT_DISC (7)
+#define BLE_GAP_EVENT_DISC_COMPLETE (8)
+#define BLE_GAP_EVENT_ADV_COMPLETE (9)
+#define BLE_GAP_EVENT_MTU (15)
+#define BLE_GAP_EVENT_PHY_UPDATE_COMPLETE (23)
+#define BLE_GAP_EVENT_EXT_DISC (24)
+#define BLE_GAP_CONN_MODE_NON (0)
+#define BLE_GAP_CONN_MODE_DIR (1)
+#define BLE_GAP_CONN_MODE_UND (2)
+#define BLE_GAP_DISC_MODE_NON (0)
+#define BLE_GAP_DISC_MODE_LTD (1)
+#define BLE_GAP_DISC_MODE_GEN (2)
+#define BLE_HS_ADV_F_DISC_GEN (0x02)
+#define BLE_HS_ADV_F_BREDR_UNSUP (0x04)
+#define BLE_HS_ADV_TX_PWR_LVL_AUTO (-128)
+#define BLE_HS_ADV_MAX_SZ (31)
+
+struct ble_gap_conn_desc
+{
+    ble_addr_t our_id_addr;
+    ble_addr_t peer_id_addr;
+    ble_addr_t our_ota_addr;
+    ble_addr_t peer_ota_addr;
+    uint16_t conn_handle;
+    uint16_t conn_itvl;
+    uint16_t conn_latency;
+    uint16_t supervision_timeout;
+    uint8_t role;
+};
+
+struct ble_gap_event
+{
+    uint8_t type;
+    union
+    {
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+        } connect;
+        struct
+        {
+            int reason;
+            struct ble_gap_conn_desc conn;
+        } disconnect;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+        } conn_update;
+        struct
+        {
+            uint16_t conn_handle;
+            uint16_t channel_id;
+            uint16_t value;
+        } mtu;
+        struct
+        {
+            int status;
+            uint16_t conn_handle;
+            uint8_t tx_phy;
+            uint8_t rx_phy;
+        } phy_updated;
+        struct
+        {
+            int reason;
+        } adv_complete;
+    };
+};
+
+typedef int ble_gap_event_fn(struct ble_gap_event *event, void *arg);
+
+struct ble_gap_adv_params
+{
+    uint8_t conn_mode;
+    uint8_t disc_mode;
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint8_t channel_map;
+    uint8_t filter_policy;
+    uint8_t high_duty_cycle;
+};
+
+struct ble_gap_upd_params
+{
+    uint16_t itvl_min;
+    uint16_t itvl_max;
+    uint16_t latency;
+    uint16_t supervision_timeout;
+    uint16_t min_ce_len;
+    uint16_t max_ce_len;
+};
+
+struct ble_hs_adv_fields
+{
+    uint8_t flags;
+    const ble_uuid16_t *uuids16;
+    uint8_t num_uuids16;
+    unsigned uuids16_is_complete : 1;
+    const uint8_t *name;
+    uint8_t name_len;
+    unsigned name_is_complete : 1;
+    int8_t tx_pwr_lvl;
+    unsigned tx_pwr_lvl_is_present : 1;
+    const uint8_t *mfg_data;
+    uint8_t mfg_data_len;
+};
+
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *adv_fields);
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *rsp_fields);
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg);
+int ble_gap_adv_stop();
+int ble_gap_adv_active();
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason);
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc);
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params);
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask, uint16_t phy_opts);
+int ble_gap_read_le_phy(uint16_t conn_handle, uint8_t *tx_phy, uint8_t *rx_phy);
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time);
+
+// Host
+struct ble_store_status_event;
+typedef void ble_hs_reset_fn(int reason);
+typedef void ble_hs_sync_fn(void);
+typedef int ble_store_status_fn(struct ble_store_status_event *event, void *arg);
+
+struct ble_hs_cfg
+{
+    ble_hs_reset_fn *reset_cb;
+    ble_hs_sync_fn *sync_cb;
+    ble_store_status_fn *store_status_cb;
+};
+
+extern struct ble_hs_cfg ble_hs_cfg;
+
+int ble_hs_synced();
+int ble_hs_util_ensure_addr(int prefer_random);
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type);
+int ble_store_util_status_rr(struct ble_store_status_event *event, void *arg);
@@ -0,0 +1,13 @@
+/*!
+    \file
+    \brief NimBLE port API for the host simulation build.
+*/
+#pragma once
+
+#include "host/ble_hs.h"
+#include "esp_err.h"
+
+esp_err_t nimble_port_init();
+esp_err_t nimble_port_deinit();
+void nimble_port_run();
+int nimble_port_stop();
@@ -0,0 +1,10 @@
+/*!
+    \file
+    \brief NimBLE FreeRTOS port API for the host simulation build.
+*/
+#pragma once
+
+#include "nimble/nimble_port.h"
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn);
+void nimble_port_freertos_deinit();
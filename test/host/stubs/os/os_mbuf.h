@@ -0,0 +1,7 @@
+/*!
+    \file
+    \brief NimBLE mbuf API for the host simulation build.
+*/
+#pragma once
+
+#include "host/ble_hs.h"
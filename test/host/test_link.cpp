@@ -0,0 +1,250 @@
+/*!
+    \file
+    \brief Data mode test on the simulated link.
+    \authors Bliznets R.A.(r.bliznets@gmail.com)
+    \version 1.0.0.0
+    \date 16.10.2026
+
+    Connects CONFIG_BLE_DATA_MAX_CONNECTIONS centrals over a lossy link,
+    writes to both channels and streams notifications on both channels.
+    The main channel is checked as a byte stream, which holds for plain,
+    coalesced and framed transfers; second channel packets keep their
+    boundaries and carry the 2-byte index.
+*/
+#include "CBTTask.h"
+#include "SimLink.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CHECK(cond)                                                              \
+    do                                                                           \
+    {                                                                            \
+        if (!(cond))                                                             \
+        {                                                                        \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            return 1;                                                            \
+        }                                                                        \
+    } while (0)
+
+#define CONN_MAX (CONFIG_BLE_DATA_MAX_CONNECTIONS)
+
+static std::mutex mux;
+static std::atomic<int> connected{0};
+static std::vector<uint8_t> rx1;              // Main channel writes received by the peripheral
+static std::vector<std::vector<uint8_t>> rx2; // Second channel writes received by the peripheral
+
+// Notifications received by the centrals
+struct SCentral
+{
+    uint16_t handle;
+    std::vector<uint8_t> main;               // Main channel byte stream
+    std::vector<std::vector<uint8_t>> second; // Second channel packets
+#ifdef CONFIG_BLE_DATA_FRAMED
+    std::vector<uint8_t> frame; // Frame being reassembled
+    uint16_t frameSize = 0;
+#endif
+};
+static SCentral centrals[CONN_MAX];
+
+static void onRx(uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    rx1.insert(rx1.end(), data, data + size);
+}
+
+static void onRx2(uint8_t *data, size_t size)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    rx2.emplace_back(data, data + size);
+}
+
+static void onConnect(bool on)
+{
+    connected += on ? 1 : -1;
+}
+
+static void onNotify(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size)
+{
+    std::lock_guard<std::mutex> lock(mux);
+    for (auto &c : centrals)
+    {
+        if (c.handle != conn)
+            continue;
+        if (chn == 2)
+            c.second.emplace_back(data, data + size);
+        else if (chn == 1)
+        {
+#ifdef CONFIG_BLE_DATA_FRAMED
+            uint16_t hlen = (data[0] & 0x80) ? 3 : 1;
+            if (data[0] & 0x80)
+            {
+                c.frame.clear();
+                c.frameSize = data[1] | (data[2] << 8);
+            }
+            c.frame.insert(c.frame.end(), data + hlen, data + size);
+            if (data[0] & 0x40)
+            {
+                if (c.frame.size() == c.frameSize)
+                    c.main.insert(c.main.end(), c.frame.begin(), c.frame.end());
+                c.frame.clear();
+            }
+#else
+            c.main.insert(c.main.end(), data, data + size);
+#endif
+        }
+    }
+}
+
+/**
+ * @brief Write from a central, waiting for free mbufs
+ * @param conn Connection handle
+ * @param chn Characteristic
+ * @param data Value
+ * @param size Value size
+ * @return true if written
+ */
+static bool write(uint16_t conn, uint8_t chn, const uint8_t *data, uint16_t size)
+{
+    for (int i = 0; i < 200; i++)
+    {
+        if (sim::write(conn, chn, data, size))
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+/**
+ * @brief Wait for a condition
+ * @param ready Condition
+ * @param ms Timeout in ms
+ * @return true if the condition is met
+ */
+template <typename T>
+static bool waitFor(T ready, uint32_t ms)
+{
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mux);
+            if (ready())
+                return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::lock_guard<std::mutex> lock(mux);
+    return ready();
+}
+
+int main()
+{
+    sim::SLinkConfig link;
+    link.interval = 12;
+    link.loss = 0.05f;
+    link.delay = 2000;
+    sim::setNotify(onNotify);
+
+    CBTTask *bt = CBTTask::Instance();
+    bt->setData(onRx, onRx2, onConnect);
+    for (int i = 0; i < CONN_MAX; i++)
+    {
+        link.seed = i + 1;
+        centrals[i].handle = sim::connect(link, 2000);
+        CHECK(centrals[i].handle != BLE_HS_CONN_HANDLE_NONE);
+    }
+    CHECK(waitFor([]
+                  { return connected.load() == CONN_MAX; }, 2000));
+    uint16_t mtu = sim::mtu(centrals[0].handle);
+    CHECK(mtu == 247);
+
+    // Central to peripheral
+    std::vector<uint8_t> sent1;
+    std::vector<std::vector<uint8_t>> sent2;
+    for (int i = 0; i < 20; i++)
+    {
+        uint8_t pkt[64];
+        uint16_t size = 8 + i;
+        for (uint16_t k = 0; k < size; k++)
+            pkt[k] = (uint8_t)(i * 7 + k);
+#ifdef CONFIG_BLE_DATA_FRAMED
+        uint8_t frame[67] = {(uint8_t)(0xc0 | (i & 0x3f)), (uint8_t)size, 0};
+        std::memcpy(&frame[3], pkt, size);
+        CHECK(write(centrals[0].handle, 1, frame, size + 3));
+#else
+        CHECK(write(centrals[0].handle, 1, pkt, size));
+#endif
+        sent1.insert(sent1.end(), pkt, pkt + size);
+        CHECK(write(centrals[0].handle, 2, pkt, size));
+        sent2.emplace_back(pkt, pkt + size);
+    }
+    CHECK(waitFor([]
+                  { return (rx1.size() == 20 * 8 + 190) && (rx2.size() == 20); }, 3000));
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        CHECK(rx1 == sent1);
+        CHECK(rx2 == sent2);
+    }
+
+    // Peripheral to central
+    std::vector<uint8_t> stream;
+#ifdef CONFIG_BLE_DATA_FRAMED
+    uint16_t maxSize = 1000;
+#else
+    uint16_t maxSize = mtu - 3;
+#endif
+    for (int i = 0; i < 200; i++)
+    {
+        std::vector<uint8_t> pkt(1 + (i * 37) % maxSize);
+        for (size_t k = 0; k < pkt.size(); k++)
+            pkt[k] = (uint8_t)(i + k * 3);
+        CHECK(bt->sendData(pkt.data(), pkt.size()));
+        stream.insert(stream.end(), pkt.begin(), pkt.end());
+        if (i % 2 == 0)
+        {
+            pkt.resize(std::min<size_t>(pkt.size(), mtu - 5));
+            CHECK(bt->sendData2(pkt.data(), pkt.size(), i));
+            pkt.insert(pkt.begin(), {(uint8_t)i, 0});
+            sent2.emplace_back(pkt);
+        }
+    }
+    sent2.erase(sent2.begin(), sent2.begin() + 20);
+    size_t total = stream.size();
+    CHECK(waitFor([total]
+                  {
+                      for (auto &c : centrals)
+                      {
+                          if ((c.main.size() < total) || (c.second.size() < 100))
+                              return false;
+                      }
+                      return true; }, 20000));
+    {
+        std::lock_guard<std::mutex> lock(mux);
+        for (auto &c : centrals)
+        {
+            CHECK(c.main == stream);
+            CHECK(c.second == sent2);
+        }
+    }
+
+    sim::SLinkStats stats;
+    sim::getStats(&stats);
+    CHECK(stats.truncated == 0);
+    CHECK(stats.rejectedWrites == 0);
+    CHECK(stats.lost != 0);
+
+    for (auto &c : centrals)
+        sim::disconnect(c.handle);
+    CHECK(waitFor([]
+                  { return connected.load() == 0; }, 2000));
+    CBTTask::free();
+    CHECK(sim::freeBlocks() == sim::SPoolConfig().count);
+    std::printf("OK: %llu notifications, %llu PDUs, %llu lost\n", (unsigned long long)stats.notifications,
+                (unsigned long long)stats.pdus, (unsigned long long)stats.lost);
+    return 0;
+}